@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/file.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "admission.h"
+#include "common.h"
+#include "lock.h"
+
+/*
+ * Node-wide admission control for the import and create phases (max_concurrent_imports).
+ *
+ * The queue is a file, <runtime_path>/locks/admission, protected by flock(2). Each line is an
+ * entry "<pid> <start time>", in arrival order. The first max_concurrent_imports entries are
+ * admitted, the others poll the queue until they reach the head, which gives FIFO ordering.
+ * Entries of processes that exited without leaving the queue (e.g. killed steps) are dropped by
+ * the next process updating the queue; the start time protects against PID reuse.
+ *
+ * The queue file is only accessible by root, it is opened by the step before privileges are
+ * dropped and the task context uses the inherited file descriptor.
+ */
+
+#define ADMISSION_POLL_MS 100
+#define ADMISSION_MAX_ENTRIES 4096
+
+struct admission_entry {
+	pid_t pid;
+	unsigned long long start_time;
+};
+
+enum admission_op {
+	ADMISSION_ENTER,
+	ADMISSION_CHECK,
+	ADMISSION_LEAVE,
+};
+
+bool admission_enabled(const struct plugin_config *config)
+{
+	return (config->max_concurrent_imports > 0);
+}
+
+/* Returns the start time of the process, in clock ticks after boot, or 0 if it doesn't exist. */
+static unsigned long long process_start_time(pid_t pid)
+{
+	char path[64];
+	char buf[1024];
+	unsigned long long start_time = 0;
+	FILE *fp;
+	char *p;
+	size_t n;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "re");
+	if (fp == NULL)
+		return (0);
+
+	n = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[n] = '\0';
+
+	/* The command name can contain spaces, the start time is the 20th field after it. */
+	p = strrchr(buf, ')');
+	if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+				&start_time) != 1)
+		return (0);
+
+	return (start_time);
+}
+
+/*
+ * The queue is shared by all users: with hidepid, the processes of other users are not visible in
+ * /proc, so only use the start time if it is available.
+ */
+static bool admission_entry_alive(const struct admission_entry *e)
+{
+	unsigned long long start_time;
+
+	if (kill(e->pid, 0) < 0 && errno == ESRCH)
+		return (false);
+
+	start_time = process_start_time(e->pid);
+
+	return (start_time == 0 || start_time == e->start_time);
+}
+
+/* As root, open the queue file. */
+int admission_open(const struct plugin_config *config)
+{
+	int ret;
+	int fd;
+	char path[PATH_MAX];
+
+	ret = lock_create_dir(config);
+	if (ret < 0)
+		return (-1);
+
+	ret = snprintf(path, sizeof(path), "%s/locks/admission", config->runtime_path);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		slurm_error("pyxis: couldn't open %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	return (fd);
+}
+
+/*
+ * Update the queue under the file lock, and return the position of the calling process in the
+ * queue after the update (0 is the head of the queue), or -1 on error.
+ */
+static int admission_update(int fd, enum admission_op op)
+{
+	int ret;
+	FILE *fp = NULL;
+	struct admission_entry *entries = NULL;
+	struct admission_entry self;
+	size_t len = 0;
+	int position = -1;
+	int rv = -1;
+
+	self.pid = getpid();
+	self.start_time = process_start_time(self.pid);
+
+	entries = calloc(ADMISSION_MAX_ENTRIES + 1, sizeof(*entries));
+	if (entries == NULL)
+		return (-1);
+
+	do {
+		ret = flock(fd, LOCK_EX);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		slurm_error("pyxis: couldn't lock admission queue: %s", strerror(errno));
+		free(entries);
+		return (-1);
+	}
+
+	fp = fdopen(dup(fd), "r+");
+	if (fp == NULL)
+		goto fail;
+	rewind(fp);
+
+	while (len < ADMISSION_MAX_ENTRIES) {
+		struct admission_entry e;
+
+		if (fscanf(fp, "%d %llu\n", &e.pid, &e.start_time) != 2)
+			break;
+
+		if (e.pid == self.pid && e.start_time == self.start_time) {
+			if (op == ADMISSION_LEAVE)
+				continue;
+		} else if (!admission_entry_alive(&e)) {
+			continue;
+		}
+
+		entries[len++] = e;
+	}
+
+	if (op == ADMISSION_ENTER)
+		entries[len++] = self;
+
+	rewind(fp);
+	for (size_t i = 0; i < len; ++i) {
+		fprintf(fp, "%d %llu\n", entries[i].pid, entries[i].start_time);
+		if (entries[i].pid == self.pid && entries[i].start_time == self.start_time)
+			position = i;
+	}
+	if (fflush(fp) != 0 || ftruncate(fileno(fp), ftell(fp)) < 0) {
+		slurm_error("pyxis: couldn't update admission queue: %s", strerror(errno));
+		goto fail;
+	}
+
+	rv = (op == ADMISSION_LEAVE) ? 0 : position;
+
+fail:
+	if (fp != NULL)
+		fclose(fp);
+	flock(fd, LOCK_UN);
+	free(entries);
+
+	return (rv);
+}
+
+/*
+ * Block until the calling process is admitted.
+ * *position is set to the initial position of the process in the queue, 0 if it was admitted
+ * immediately.
+ */
+int admission_acquire(const struct plugin_config *config, int fd, unsigned int *position)
+{
+	int pos;
+	struct timespec delay = { .tv_sec = 0, .tv_nsec = ADMISSION_POLL_MS * 1000000L };
+
+	*position = 0;
+
+	pos = admission_update(fd, ADMISSION_ENTER);
+	if (pos < 0)
+		goto fail;
+
+	if (pos >= config->max_concurrent_imports)
+		*position = pos - config->max_concurrent_imports + 1;
+
+	while (pos >= config->max_concurrent_imports) {
+		nanosleep(&delay, NULL);
+
+		pos = admission_update(fd, ADMISSION_CHECK);
+		if (pos < 0)
+			goto fail;
+	}
+
+	return (0);
+
+fail:
+	slurm_error("pyxis: couldn't enter the admission queue");
+	return (-1);
+}
+
+void admission_release(int fd)
+{
+	if (admission_update(fd, ADMISSION_LEAVE) < 0)
+		slurm_error("pyxis: couldn't leave the admission queue");
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef ADMISSION_H_
+#define ADMISSION_H_
+
+#include <stdbool.h>
+
+#include "config.h"
+
+bool admission_enabled(const struct plugin_config *config);
+
+int admission_open(const struct plugin_config *config);
+
+int admission_acquire(const struct plugin_config *config, int fd, unsigned int *position);
+
+void admission_release(int fd);
+
+#endif /* ADMISSION_H_ */
@@ -17,6 +17,7 @@ static struct plugin_args pyxis_args = {
 	.workdir = NULL,
 	.container_name = NULL,
 	.container_name_flags = NULL,
+	.container_clone = NULL,
 	.container_save = NULL,
 	.mount_home = -1,
 	.remap_root = -1,
@@ -70,7 +71,8 @@ struct spank_option spank_opts[] =
 		"NAME",
 		"[pyxis] name to use for saving and loading the container on the host. "
 			"Unnamed containers are removed after the slurm task is complete; named containers are not. "
-			"If a container with this name already exists, the existing container is used and the import is skipped.",
+			"If a container with this name already exists, the existing container is used and the import is skipped. "
+			"With NAME:clone=SOURCE, the container is created from the existing named container SOURCE.",
 		1, 0, spank_option_container_name
 	},
 	{
@@ -514,9 +516,29 @@ static int spank_option_container_name(int val, const char *optarg, int remote)
 	if (flags == NULL || flags[0] == '\0')
 		flags = "auto";
 
-	if (strcmp(flags, "auto") != 0 && strcmp(flags, "create") != 0 &&
+	/* The image and the changes of an existing container are the starting point of the new one. */
+	if (strncmp(flags, "clone=", 6) == 0) {
+		if (flags[6] == '\0') {
+			slurm_error("pyxis: --container-name: clone: empty source container name");
+			goto fail;
+		}
+
+		pyxis_args.container_clone = strdup(flags + 6);
+		if (pyxis_args.container_clone == NULL) {
+			slurm_error("pyxis: could not allocate memory");
+			goto fail;
+		}
+		flags = "clone";
+	}
+
+	if (strcmp(flags, "clone") == 0 && pyxis_args.container_clone == NULL) {
+		slurm_error("pyxis: --container-name: clone flag requires a source container, e.g. \"clone=NAME\"");
+		goto fail;
+	}
+
+	if (strcmp(flags, "auto") != 0 && strcmp(flags, "clone") != 0 && strcmp(flags, "create") != 0 &&
 	    strcmp(flags, "exec") != 0 && strcmp(flags, "no_exec") != 0) {
-		slurm_error("pyxis: --container-name: flag must be \"auto\", \"create\", \"exec\" or \"no_exec\"");
+		slurm_error("pyxis: --container-name: flag must be \"auto\", \"create\", \"exec\", \"no_exec\" or \"clone=NAME\"");
 		goto fail;
 	}
 
@@ -537,6 +559,10 @@ static int spank_option_container_name(int val, const char *optarg, int remote)
 	rv = 0;
 
 fail:
+	if (rv < 0) {
+		free(pyxis_args.container_clone);
+		pyxis_args.container_clone = NULL;
+	}
 	free(optarg_dup);
 
 	return (rv);
@@ -748,6 +774,22 @@ bool pyxis_args_enabled(void)
 	return (true);
 }
 
+/*
+ * Pass the image, or its pinned reference if any, to the job prolog (as SPANK_PYXIS_CONTAINER_IMAGE).
+ * This only has an effect when a new job allocation is requested.
+ */
+void pyxis_args_export_image(spank_t sp, const char *pinned)
+{
+	spank_err_t rc;
+
+	if (pyxis_args.image == NULL)
+		return;
+
+	rc = spank_job_control_setenv(sp, "PYXIS_CONTAINER_IMAGE", pinned != NULL ? pinned : pyxis_args.image, 1);
+	if (rc != ESPANK_SUCCESS)
+		slurm_debug("pyxis: couldn't set job control environment variable: %s", spank_strerror(rc));
+}
+
 void pyxis_args_free(void)
 {
 	free(pyxis_args.image);
@@ -755,6 +797,7 @@ void pyxis_args_free(void)
 	free(pyxis_args.workdir);
 	free(pyxis_args.container_name);
 	free(pyxis_args.container_name_flags);
+	free(pyxis_args.container_clone);
 	free(pyxis_args.container_save);
 	array_free(&pyxis_args.env_vars, &pyxis_args.env_vars_len);
 }
@@ -23,6 +23,7 @@ struct plugin_args {
 	char *workdir;
 	char *container_name;
 	char *container_name_flags;
+	char *container_clone;
 	char *container_save;
 	int mount_home;
 	int remap_root;
@@ -48,4 +49,6 @@ void pyxis_args_free(void);
 
 void pyxis_args_check_environment_variables(spank_t sp);
 
+void pyxis_args_export_image(spank_t sp, const char *pinned);
+
 #endif /* ARGS_H_ */
@@ -0,0 +1,1399 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "cache.h"
+#include "chunk.h"
+#include "common.h"
+#include "digest.h"
+
+/*
+ * Layout of the node-local image cache:
+ *   <cache_path>/<uid>/             per-user directory, owned by the user
+ *   <cache_path>/<uid>/index        list of cached squashfs files, with usage statistics
+ *   <cache_path>/<uid>/index.lock   lock serializing all index updates
+ *   <cache_path>/<uid>/<digest>.squashfs
+ *   <cache_path>/<uid>/refs/<jobid>  digests used by a running job, one per line
+ *   <cache_path>/<uid>/<digest>.chunks   manifest of the squashfs file in the chunk store
+ *   <cache_path>/<uid>/<digest>.profile  pages of the squashfs file read by a container, see prewarm.c
+ *   <cache_path>/<uid>/chunks/           content-defined chunk store of the user, see chunk.c
+ *   <cache_path>/<uid>/rootfs/<digest>/  extracted squashfs file, shared lower directory of the
+ *                                        overlay containers of the image, see overlay.c
+ *   <cache_path>/<uid>/containers/<name>/image  digest of a named overlay container, see overlay.c
+ *
+ * Squashfs files are produced by "enroot import" running with the credentials of the user, so
+ * entries are not shared between users. Lookups and imports run in the task context, without
+ * privileges, so the index of a user also lives in the directory of the user. The size limit, the
+ * disk usage watermarks and LRU eviction apply to the whole node, they are enforced as root by
+ * cache_gc(), from slurmd. Entries referenced by a running job are never evicted: the reference
+ * file of a job is removed by the job epilog, or ignored after a reboot.
+ *
+ * With cache_chunks, published squashfs files are also split into the chunk store of the user, so
+ * successive versions of an image only store the chunks that changed. cache_gc() first removes the
+ * squashfs files that have a manifest, they are assembled again from the chunks on the next
+ * lookup. Manifests are evicted next, along with the chunks that no other manifest references.
+ *
+ * Extracted root filesystems are the largest part of an entry, and the cheapest to rebuild from the
+ * squashfs file: they are evicted first. Their size is measured once, when they are published.
+ */
+
+#define CACHE_INDEX_HEADER "pyxis-cache-index 1"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+struct cache_entry {
+	uid_t uid;
+	char digest[DIGEST_MAX + 1];
+	uint64_t size;
+	time_t last_used;
+	uint64_t hits;
+	uint64_t rootfs_size;
+	uint64_t generation;
+	bool referenced;
+	bool assembled;
+	bool chunked;
+	bool extracted;
+};
+
+struct cache_index {
+	struct cache_entry *entries;
+	size_t len;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t generation;
+};
+
+bool cache_enabled(const struct plugin_config *config)
+{
+	return (config->cache_path[0] != '\0');
+}
+
+int cache_create_dir(const struct plugin_config *config)
+{
+	int ret;
+
+	if (!cache_enabled(config))
+		return (0);
+
+	/* We only attempt to create the last component of the path. */
+	ret = mkdir(config->cache_path, 0755);
+	if (ret < 0 && errno != EEXIST) {
+		slurm_error("pyxis: couldn't mkdir %s: %s", config->cache_path, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* As root, create the per-user cache directory where "enroot import" will write squashfs files. */
+int cache_create_user_dir(const struct plugin_config *config, uid_t uid, gid_t gid)
+{
+	int ret;
+	char path[PATH_MAX];
+
+	ret = snprintf(path, sizeof(path), "%s/%u", config->cache_path, uid);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	return create_user_dir(path, uid, gid);
+}
+
+static int cache_user_dir_open(const struct plugin_config *config, uid_t uid)
+{
+	int ret;
+	int fd;
+	char path[PATH_MAX];
+
+	ret = snprintf(path, sizeof(path), "%s/%u", config->cache_path, uid);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 && errno != ENOENT)
+		slurm_error("pyxis: cache: couldn't open %s: %s", path, strerror(errno));
+
+	return (fd);
+}
+
+static int cache_entry_name(const char *digest, char (*name)[NAME_MAX + 1])
+{
+	int ret;
+
+	ret = snprintf(*name, sizeof(*name), "%s.squashfs", digest);
+	if (ret < 0 || ret >= sizeof(*name))
+		return (-1);
+
+	return (0);
+}
+
+static int cache_manifest_name(const char *digest, char (*name)[NAME_MAX + 1])
+{
+	int ret;
+
+	ret = snprintf(*name, sizeof(*name), "%s%s", digest, CHUNK_MANIFEST_SUFFIX);
+	if (ret < 0 || ret >= sizeof(*name))
+		return (-1);
+
+	return (0);
+}
+
+static int cache_profile_name(const char *digest, char (*name)[NAME_MAX + 1])
+{
+	int ret;
+
+	ret = snprintf(*name, sizeof(*name), "%s.profile", digest);
+	if (ret < 0 || ret >= sizeof(*name))
+		return (-1);
+
+	return (0);
+}
+
+static int cache_index_lock(int dir_fd)
+{
+	int ret;
+	int fd;
+
+	fd = open_user_file(dir_fd, "index.lock", O_RDWR | O_CREAT);
+	if (fd < 0) {
+		slurm_error("pyxis: cache: couldn't open index lock: %s", strerror(errno));
+		return (-1);
+	}
+
+	do {
+		ret = flock(fd, LOCK_EX);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		slurm_error("pyxis: cache: couldn't lock index: %s", strerror(errno));
+		close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+static struct cache_entry *cache_index_find(struct cache_index *index, uid_t uid, const char *digest)
+{
+	for (size_t i = 0; i < index->len; ++i) {
+		if (index->entries[i].uid == uid && strcmp(index->entries[i].digest, digest) == 0)
+			return (&index->entries[i]);
+	}
+
+	return (NULL);
+}
+
+static struct cache_entry *cache_index_add(struct cache_index *index, uid_t uid, const char *digest)
+{
+	struct cache_entry *p;
+
+	p = realloc(index->entries, sizeof(*p) * (index->len + 1));
+	if (p == NULL)
+		return (NULL);
+	index->entries = p;
+
+	p = &index->entries[index->len];
+	memset(p, 0, sizeof(*p));
+	p->uid = uid;
+	snprintf(p->digest, sizeof(p->digest), "%s", digest);
+	index->len += 1;
+
+	return (p);
+}
+
+/* The generation of the index never goes back, GC uses it to detect an entry used since its snapshot. */
+static void cache_entry_use(struct cache_index *index, struct cache_entry *entry)
+{
+	entry->last_used = time(NULL);
+	index->generation += 1;
+	entry->generation = index->generation;
+}
+
+static void cache_index_remove(struct cache_index *index, struct cache_entry *entry)
+{
+	size_t i = entry - index->entries;
+
+	memmove(&index->entries[i], &index->entries[i + 1], sizeof(*entry) * (index->len - i - 1));
+	index->len -= 1;
+}
+
+static void cache_index_free(struct cache_index *index)
+{
+	free(index->entries);
+	memset(index, 0, sizeof(*index));
+}
+
+static int cache_index_load(int dir_fd, struct cache_index *index)
+{
+	int ret;
+	int fd;
+	FILE *fp;
+	char *line;
+	struct cache_entry entry;
+	long long last_used = 0;
+
+	memset(index, 0, sizeof(*index));
+
+	fd = open_user_file(dir_fd, "index", O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return (0);
+		slurm_error("pyxis: cache: couldn't open index: %s", strerror(errno));
+		return (-1);
+	}
+
+	fp = fdopen(fd, "r");
+	if (fp == NULL) {
+		close(fd);
+		return (-1);
+	}
+
+	/* An unknown index is discarded, existing squashfs files will be added back on lookup. */
+	line = get_line_from_file(fp);
+	if (line == NULL || strcmp(line, CACHE_INDEX_HEADER) != 0) {
+		slurm_info("pyxis: cache: ignoring invalid index file");
+		free(line);
+		fclose(fp);
+		return (0);
+	}
+	free(line);
+
+	while ((line = get_line_from_file(fp)) != NULL) {
+		if (strncmp(line, "stats ", 6) == 0) {
+			sscanf(line, "stats %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+			       &index->hits, &index->misses, &index->evictions, &index->generation);
+		} else {
+			memset(&entry, 0, sizeof(entry));
+			/* The size of the root filesystem and the generation were added later, they are optional. */
+			ret = sscanf(line, "entry %u %" XSTR(DIGEST_MAX) "s %" SCNu64 " %lld %" SCNu64 " %" SCNu64 " %" SCNu64,
+				     &entry.uid, entry.digest, &entry.size, &last_used, &entry.hits, &entry.rootfs_size,
+				     &entry.generation);
+			entry.last_used = last_used;
+
+			if (ret < 5 || !digest_valid(entry.digest) ||
+			    cache_index_find(index, entry.uid, entry.digest) != NULL) {
+				slurm_info("pyxis: cache: ignoring invalid index line: %s", line);
+			} else if (cache_index_add(index, entry.uid, entry.digest) == NULL) {
+				free(line);
+				fclose(fp);
+				cache_index_free(index);
+				return (-1);
+			} else {
+				index->entries[index->len - 1] = entry;
+			}
+		}
+
+		free(line);
+	}
+
+	fclose(fp);
+
+	return (0);
+}
+
+static int cache_index_save(int dir_fd, const struct cache_index *index)
+{
+	int ret;
+	int fd;
+	FILE *fp;
+
+	/* Never truncate an existing file, it might be a link planted by the user. */
+	if (unlinkat(dir_fd, "index.tmp", 0) < 0 && errno != ENOENT)
+		goto fail;
+
+	fd = open_user_file(dir_fd, "index.tmp", O_WRONLY | O_CREAT | O_EXCL);
+	if (fd < 0) {
+		slurm_error("pyxis: cache: couldn't open index.tmp: %s", strerror(errno));
+		return (-1);
+	}
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		goto fail;
+	}
+
+	fprintf(fp, "%s\n", CACHE_INDEX_HEADER);
+	fprintf(fp, "stats %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", index->hits, index->misses,
+		index->evictions, index->generation);
+	for (size_t i = 0; i < index->len; ++i)
+		fprintf(fp, "entry %u %s %" PRIu64 " %lld %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", index->entries[i].uid,
+			index->entries[i].digest, index->entries[i].size, (long long)index->entries[i].last_used,
+			index->entries[i].hits, index->entries[i].rootfs_size, index->entries[i].generation);
+
+	ret = ferror(fp);
+	if (fclose(fp) != 0 || ret != 0)
+		goto fail;
+
+	/* Atomically replace the previous index. */
+	ret = renameat(dir_fd, "index.tmp", dir_fd, "index");
+	if (ret < 0)
+		goto fail;
+
+	return (0);
+
+fail:
+	slurm_error("pyxis: cache: couldn't write index: %s", strerror(errno));
+	unlinkat(dir_fd, "index.tmp", 0);
+	return (-1);
+}
+
+static int cache_entry_unlink(int dir_fd, const struct cache_entry *entry)
+{
+	int ret;
+	char name[NAME_MAX + 1];
+
+	ret = cache_entry_name(entry->digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	ret = unlinkat(dir_fd, name, 0);
+	if (ret < 0 && errno == ENOENT)
+		ret = 0;
+
+	return (ret);
+}
+
+/* Rebuild an evicted squashfs file from the chunk store, with the index locked. */
+static int cache_chunks_assemble(int dir_fd, const char *digest, const char *name, struct stat *st)
+{
+	int ret;
+	int fd;
+	char manifest[NAME_MAX + 1];
+	char temp[NAME_MAX + 1];
+
+	ret = cache_manifest_name(digest, &manifest);
+	if (ret < 0)
+		return (-1);
+
+	ret = fstatat(dir_fd, manifest, st, AT_SYMLINK_NOFOLLOW);
+	if (ret < 0)
+		return (-1);
+
+	ret = snprintf(temp, sizeof(temp), ".%s.assemble.tmp", digest);
+	if (ret < 0 || ret >= sizeof(temp))
+		return (-1);
+
+	fd = openat(dir_fd, temp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		slurm_error("pyxis: cache: couldn't open %s: %s", temp, strerror(errno));
+		return (-1);
+	}
+
+	ret = chunk_assemble(dir_fd, manifest, fd);
+	if (close(fd) < 0 || ret < 0)
+		goto fail;
+
+	ret = renameat(dir_fd, temp, dir_fd, name);
+	if (ret < 0)
+		goto fail;
+
+	ret = fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW);
+	if (ret < 0)
+		return (-1);
+
+	slurm_info("pyxis: cache: assembled %s from the chunk store (%lld bytes)", digest, (long long)st->st_size);
+
+	return (0);
+
+fail:
+	/* A manifest that can't be assembled is useless, the next import replaces it. */
+	slurm_info("pyxis: cache: couldn't assemble %s from the chunk store", digest);
+	unlinkat(dir_fd, temp, 0);
+	unlinkat(dir_fd, manifest, 0);
+	return (-1);
+}
+
+/* Add a freshly published squashfs file to the chunk store, with the index locked. */
+static int cache_chunks_store(int dir_fd, const char *digest, const char *name)
+{
+	int ret;
+	int fd;
+	char manifest[NAME_MAX + 1];
+	struct chunk_stats stats;
+
+	ret = cache_manifest_name(digest, &manifest);
+	if (ret < 0)
+		return (-1);
+
+	fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	ret = chunk_store(dir_fd, fd, manifest, &stats);
+	close(fd);
+	if (ret < 0)
+		return (-1);
+
+	slurm_info("pyxis: cache: stored %s in the chunk store: %" PRIu64 " chunks, %" PRIu64 " new (%" PRIu64 " bytes)",
+		   digest, stats.chunks, stats.new_chunks, stats.new_bytes);
+
+	return (0);
+}
+
+/*
+ * Returns -1 if an error occurs.
+ * Returns 0 if the digest is not in the cache.
+ * Returns 1 and sets *path if the digest is in the cache.
+ */
+int cache_lookup(const struct plugin_config *config, uid_t uid, const char *digest, char **path)
+{
+	int ret;
+	int lock_fd = -1;
+	int dir_fd = -1;
+	char name[NAME_MAX + 1];
+	struct cache_index index = { 0 };
+	struct cache_entry *entry;
+	struct stat st;
+	int rv = -1;
+
+	*path = NULL;
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	ret = cache_entry_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	dir_fd = cache_user_dir_open(config, uid);
+	if (dir_fd < 0)
+		return (-1);
+
+	lock_fd = cache_index_lock(dir_fd);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = cache_index_load(dir_fd, &index);
+	if (ret < 0)
+		goto fail;
+
+	entry = cache_index_find(&index, uid, digest);
+
+	ret = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW);
+	if (ret < 0 && errno == ENOENT && config->cache_chunks)
+		ret = cache_chunks_assemble(dir_fd, digest, name, &st);
+	if (ret == 0 && S_ISREG(st.st_mode)) {
+		ret = xasprintf(path, "%s/%u/%s", config->cache_path, uid, name);
+		if (ret < 0)
+			goto fail;
+
+		if (entry == NULL) {
+			entry = cache_index_add(&index, uid, digest);
+			if (entry == NULL)
+				goto fail;
+		}
+		entry->size = st.st_size;
+		cache_entry_use(&index, entry);
+		entry->hits += 1;
+		index.hits += 1;
+		rv = 1;
+	} else {
+		/* The file was removed behind our back, or it was never there. */
+		if (entry != NULL)
+			cache_index_remove(&index, entry);
+		index.misses += 1;
+		rv = 0;
+	}
+
+	slurm_info("pyxis: cache: %s for %s (hits: %" PRIu64 ", misses: %" PRIu64 ", evictions: %" PRIu64 ")",
+		   rv == 1 ? "hit" : "miss", digest, index.hits, index.misses, index.evictions);
+
+	/* Failing to record statistics should not fail the lookup. */
+	(void)cache_index_save(dir_fd, &index);
+
+fail:
+	if (rv < 0) {
+		free(*path);
+		*path = NULL;
+	}
+	cache_index_free(&index);
+	xclose(dir_fd);
+	xclose(lock_fd);
+
+	return (rv);
+}
+
+int cache_temp_path(const struct plugin_config *config, uid_t uid, const char *digest,
+		    uint32_t jobid, uint32_t stepid, char **path)
+{
+	int ret;
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	ret = xasprintf(path, "%s/%u/.%s.%u.%u.tmp", config->cache_path, uid, digest, jobid, stepid);
+	if (ret < 0 || ret >= PATH_MAX) {
+		free(*path);
+		*path = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+int cache_profile_path(const struct plugin_config *config, uid_t uid, const char *digest, char **path)
+{
+	int ret;
+	char name[NAME_MAX + 1];
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	ret = cache_profile_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	ret = xasprintf(path, "%s/%u/%s", config->cache_path, uid, name);
+	if (ret < 0 || ret >= PATH_MAX) {
+		free(*path);
+		*path = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Atomically move a freshly imported squashfs file into the cache. */
+int cache_publish(const struct plugin_config *config, uid_t uid, const char *digest,
+		  const char *temp_path, char **path)
+{
+	int ret;
+	int lock_fd = -1;
+	int dir_fd = -1;
+	const char *temp_name;
+	char name[NAME_MAX + 1];
+	struct cache_index index = { 0 };
+	struct cache_entry *entry;
+	struct stat st;
+	int rv = -1;
+
+	*path = NULL;
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	ret = cache_entry_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	temp_name = strrchr(temp_path, '/');
+	temp_name = (temp_name == NULL) ? temp_path : temp_name + 1;
+
+	dir_fd = cache_user_dir_open(config, uid);
+	if (dir_fd < 0)
+		return (-1);
+
+	lock_fd = cache_index_lock(dir_fd);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = cache_index_load(dir_fd, &index);
+	if (ret < 0)
+		goto fail;
+
+	ret = fstatat(dir_fd, temp_name, &st, AT_SYMLINK_NOFOLLOW);
+	if (ret < 0 || !S_ISREG(st.st_mode) || st.st_uid != uid) {
+		slurm_error("pyxis: cache: not a valid squashfs file: %s", temp_path);
+		goto fail;
+	}
+
+	ret = renameat(dir_fd, temp_name, dir_fd, name);
+	if (ret < 0) {
+		slurm_error("pyxis: cache: couldn't rename %s: %s", temp_path, strerror(errno));
+		goto fail;
+	}
+
+	ret = xasprintf(path, "%s/%u/%s", config->cache_path, uid, name);
+	if (ret < 0)
+		goto fail;
+
+	entry = cache_index_find(&index, uid, digest);
+	if (entry == NULL) {
+		entry = cache_index_add(&index, uid, digest);
+		if (entry == NULL)
+			goto fail;
+	}
+	entry->size = st.st_size;
+	cache_entry_use(&index, entry);
+
+	slurm_info("pyxis: cache: added %s for uid %u (%" PRIu64 " bytes)", digest, uid, entry->size);
+
+	/* The squashfs file is usable without its chunks, failures are not fatal. */
+	if (config->cache_chunks && cache_chunks_store(dir_fd, digest, name) < 0)
+		slurm_info("pyxis: cache: couldn't add %s to the chunk store", digest);
+
+	(void)cache_index_save(dir_fd, &index);
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		free(*path);
+		*path = NULL;
+	}
+	cache_index_free(&index);
+	xclose(dir_fd);
+	xclose(lock_fd);
+
+	return (rv);
+}
+
+/*
+ * Returns -1 if an error occurs.
+ * Returns 0 if the image was not extracted yet.
+ * Returns 1 and sets *path if the root filesystem of the image is in the cache.
+ */
+int cache_rootfs_lookup(const struct plugin_config *config, uid_t uid, const char *digest, char **path)
+{
+	int ret;
+	char name[NAME_MAX + 1];
+	struct stat st;
+
+	*path = NULL;
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	ret = digest_dir_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	ret = xasprintf(path, "%s/%u/rootfs/%s", config->cache_path, uid, name);
+	if (ret < 0)
+		return (-1);
+
+	ret = lstat(*path, &st);
+	if (ret == 0 && S_ISDIR(st.st_mode))
+		return (1);
+
+	free(*path);
+	*path = NULL;
+
+	if (ret < 0 && errno != ENOENT) {
+		slurm_error("pyxis: cache: couldn't stat the root filesystem of %s: %s", digest, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Add the disk usage of a tree to *bytes, without following symlinks or descending into another
+ * filesystem. Directories that can't be read only count for themselves.
+ */
+static int cache_rootfs_size(int dir_fd, const char *name, dev_t dev, uint64_t *bytes)
+{
+	int fd;
+	DIR *dirp;
+	struct dirent *d;
+	struct stat st;
+
+	if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return (-1);
+
+	if (st.st_dev != dev)
+		return (0);
+
+	*bytes += (uint64_t)st.st_blocks * 512;
+
+	if (!S_ISDIR(st.st_mode))
+		return (0);
+
+	fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return (0);
+
+	dirp = fdopendir(fd);
+	if (dirp == NULL) {
+		close(fd);
+		return (0);
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+			continue;
+
+		(void)cache_rootfs_size(dirfd(dirp), d->d_name, dev, bytes);
+	}
+
+	closedir(dirp);
+
+	return (0);
+}
+
+/*
+ * Atomically move a freshly extracted root filesystem into the cache. The tree must be on the same
+ * filesystem as the cache, e.g. under the overlay directory of the step.
+ */
+int cache_rootfs_publish(const struct plugin_config *config, uid_t uid, const char *digest,
+			 const char *temp_path, char **path)
+{
+	int ret;
+	int lock_fd = -1;
+	int dir_fd = -1;
+	int rootfs_fd = -1;
+	char name[NAME_MAX + 1];
+	struct cache_index index = { 0 };
+	struct cache_entry *entry;
+	struct stat st;
+	uint64_t rootfs_bytes = 0;
+	int rv = -1;
+
+	*path = NULL;
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	ret = digest_dir_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	/* Measured once here, cache_gc() doesn't walk the trees. */
+	ret = lstat(temp_path, &st);
+	if (ret == 0)
+		ret = cache_rootfs_size(AT_FDCWD, temp_path, st.st_dev, &rootfs_bytes);
+	if (ret < 0) {
+		slurm_error("pyxis: cache: couldn't walk %s: %s", temp_path, strerror(errno));
+		return (-1);
+	}
+
+	dir_fd = cache_user_dir_open(config, uid);
+	if (dir_fd < 0)
+		return (-1);
+
+	ret = mkdirat(dir_fd, "rootfs", 0700);
+	if (ret < 0 && errno != EEXIST) {
+		slurm_error("pyxis: cache: couldn't create the rootfs directory: %s", strerror(errno));
+		goto fail;
+	}
+
+	rootfs_fd = openat(dir_fd, "rootfs", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (rootfs_fd < 0)
+		goto fail;
+
+	lock_fd = cache_index_lock(dir_fd);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = cache_index_load(dir_fd, &index);
+	if (ret < 0)
+		goto fail;
+
+	ret = renameat(AT_FDCWD, temp_path, rootfs_fd, name);
+	if (ret < 0) {
+		slurm_error("pyxis: cache: couldn't rename %s: %s", temp_path, strerror(errno));
+		goto fail;
+	}
+
+	ret = xasprintf(path, "%s/%u/rootfs/%s", config->cache_path, uid, name);
+	if (ret < 0)
+		goto fail;
+
+	entry = cache_index_find(&index, uid, digest);
+	if (entry == NULL) {
+		entry = cache_index_add(&index, uid, digest);
+		if (entry == NULL)
+			goto fail;
+	}
+	cache_entry_use(&index, entry);
+	entry->rootfs_size = rootfs_bytes;
+
+	slurm_info("pyxis: cache: added the root filesystem of %s for uid %u (%" PRIu64 " bytes)",
+		   digest, uid, entry->rootfs_size);
+
+	(void)cache_index_save(dir_fd, &index);
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		free(*path);
+		*path = NULL;
+	}
+	cache_index_free(&index);
+	xclose(lock_fd);
+	xclose(rootfs_fd);
+	xclose(dir_fd);
+
+	return (rv);
+}
+
+/*
+ * Record that a job uses a cache entry, so that cache_gc() doesn't evict it until the job ends.
+ * Callers add the reference before cache_lookup(): an entry collected by cache_gc() before the
+ * reference was added is used by the lookup afterwards, and cache_gc_evict() skips it.
+ */
+int cache_ref_add(const struct plugin_config *config, uid_t uid, uint32_t jobid, const char *digest)
+{
+	int ret;
+	int dir_fd = -1;
+	int refs_fd = -1;
+	int fd = -1;
+	char name[32];
+	int rv = -1;
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	dir_fd = cache_user_dir_open(config, uid);
+	if (dir_fd < 0)
+		return (-1);
+
+	ret = mkdirat(dir_fd, "refs", 0700);
+	if (ret < 0 && errno != EEXIST)
+		goto fail;
+
+	refs_fd = openat(dir_fd, "refs", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (refs_fd < 0)
+		goto fail;
+
+	snprintf(name, sizeof(name), "%u", jobid);
+	fd = open_user_file(refs_fd, name, O_WRONLY | O_APPEND | O_CREAT);
+	if (fd < 0)
+		goto fail;
+
+	/* Writes smaller than PIPE_BUF with O_APPEND are not interleaved between steps. */
+	if (dprintf(fd, "%s\n", digest) < 0)
+		goto fail;
+
+	rv = 0;
+
+fail:
+	if (rv < 0)
+		slurm_info("pyxis: cache: couldn't add reference to %s for job %u: %s", digest, jobid, strerror(errno));
+	xclose(fd);
+	xclose(refs_fd);
+	xclose(dir_fd);
+
+	return (rv);
+}
+
+/* Remove the temporary files of the imports of a job, left behind if they were killed. */
+static void cache_temp_cleanup(int dir_fd, uint32_t jobid)
+{
+	int fd;
+	DIR *dirp;
+	struct dirent *d;
+	char digest[DIGEST_MAX + 1];
+	uint32_t id, stepid;
+	int n;
+
+	fd = dup(dir_fd);
+	if (fd < 0)
+		return;
+
+	dirp = fdopendir(fd);
+	if (dirp == NULL) {
+		close(fd);
+		return;
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		n = 0;
+		if (sscanf(d->d_name, ".%" XSTR(DIGEST_MAX) "[^.].%u.%u.tmp%n", digest, &id, &stepid, &n) != 3 ||
+		    n == 0 || d->d_name[n] != '\0' || id != jobid)
+			continue;
+
+		if (unlinkat(dirfd(dirp), d->d_name, 0) < 0 && errno != ENOENT)
+			slurm_info("pyxis: cache: couldn't remove %s: %s", d->d_name, strerror(errno));
+	}
+
+	closedir(dirp);
+}
+
+/* As root, from the job epilog, drop the references of a job. */
+int cache_ref_release(const struct plugin_config *config, uid_t uid, uint32_t jobid)
+{
+	int ret;
+	int dir_fd;
+	char name[32];
+
+	if (!cache_enabled(config))
+		return (0);
+
+	dir_fd = cache_user_dir_open(config, uid);
+	if (dir_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	snprintf(name, sizeof(name), "refs/%u", jobid);
+	ret = unlinkat(dir_fd, name, 0);
+	if (ret < 0 && errno == ENOENT)
+		ret = 0;
+	if (ret < 0)
+		slurm_error("pyxis: cache: couldn't remove references of job %u: %s", jobid, strerror(errno));
+
+	cache_temp_cleanup(dir_fd, jobid);
+
+	close(dir_fd);
+
+	return (ret);
+}
+
+/* Mark the entries listed in a file, one digest per line. */
+static void cache_gc_mark_file(int fd, struct cache_index *index)
+{
+	FILE *fp;
+	char *line;
+	struct cache_entry *entry;
+
+	fp = fdopen(fd, "r");
+	if (fp == NULL) {
+		close(fd);
+		return;
+	}
+
+	while ((line = get_line_from_file(fp)) != NULL) {
+		for (size_t i = 0; i < index->len; ++i) {
+			entry = &index->entries[i];
+			if (strcmp(entry->digest, line) == 0)
+				entry->referenced = true;
+		}
+		free(line);
+	}
+
+	fclose(fp);
+}
+
+/* Mark the entries of a user referenced by a running job. */
+static void cache_gc_mark_referenced(int dir_fd, struct cache_index *index, time_t boot_time)
+{
+	int refs_fd;
+	int fd;
+	DIR *dirp;
+	struct dirent *d;
+	struct stat st;
+
+	refs_fd = openat(dir_fd, "refs", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (refs_fd < 0)
+		return;
+
+	dirp = fdopendir(refs_fd);
+	if (dirp == NULL) {
+		close(refs_fd);
+		return;
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+
+		fd = open_user_file(dirfd(dirp), d->d_name, O_RDONLY);
+		if (fd < 0)
+			continue;
+
+		if (fstat(fd, &st) == 0 && st.st_mtime < boot_time) {
+			slurm_info("pyxis: cache: removing stale references of job %s", d->d_name);
+			unlinkat(dirfd(dirp), d->d_name, 0);
+			close(fd);
+			continue;
+		}
+
+		cache_gc_mark_file(fd, index);
+	}
+
+	closedir(dirp);
+}
+
+/* Mark the entries of a user used by a named overlay container, they can't be imported again. */
+static void cache_gc_mark_containers(int dir_fd, struct cache_index *index)
+{
+	int containers_fd;
+	int container_fd;
+	int fd;
+	DIR *dirp;
+	struct dirent *d;
+
+	containers_fd = openat(dir_fd, "containers", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (containers_fd < 0)
+		return;
+
+	dirp = fdopendir(containers_fd);
+	if (dirp == NULL) {
+		close(containers_fd);
+		return;
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+
+		container_fd = openat(dirfd(dirp), d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (container_fd < 0)
+			continue;
+
+		fd = open_user_file(container_fd, "image", O_RDONLY);
+		if (fd >= 0)
+			cache_gc_mark_file(fd, index);
+
+		close(container_fd);
+	}
+
+	closedir(dirp);
+}
+
+/* Check which entries of a user still have a squashfs file, a manifest, and a root filesystem. */
+static void cache_gc_stat_entries(int dir_fd, struct cache_index *index)
+{
+	struct cache_entry *entry;
+	char name[NAME_MAX + 1];
+	struct stat st;
+	int rootfs_fd;
+
+	rootfs_fd = openat(dir_fd, "rootfs", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	for (size_t i = 0; i < index->len; ++i) {
+		entry = &index->entries[i];
+
+		if (cache_entry_name(entry->digest, &name) == 0 &&
+		    fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode)) {
+			entry->assembled = true;
+			entry->size = st.st_size;
+		}
+
+		if (cache_manifest_name(entry->digest, &name) == 0 &&
+		    fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+			entry->chunked = true;
+
+		if (digest_dir_name(entry->digest, &name) == 0 && rootfs_fd >= 0 &&
+		    fstatat(rootfs_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+			entry->extracted = true;
+	}
+
+	xclose(rootfs_fd);
+}
+
+static int cache_entry_cmp(const void *a, const void *b)
+{
+	const struct cache_entry *e1 = a, *e2 = b;
+
+	if (e1->last_used < e2->last_used)
+		return (-1);
+	if (e1->last_used > e2->last_used)
+		return (1);
+	return (0);
+}
+
+/*
+ * Append the entries of all the users to *entries, and mark the ones referenced by running jobs.
+ * Unreferenced chunks are removed, *chunk_bytes is set to the size of the chunk stores.
+ */
+static int cache_gc_collect(const struct plugin_config *config, struct cache_entry **entries, size_t *len,
+			    uint64_t *chunk_bytes)
+{
+	time_t boot = boot_time();
+	int ret;
+	DIR *dirp;
+	struct dirent *d;
+	uid_t uid;
+	int n;
+	int dir_fd, lock_fd;
+	struct cache_index index;
+	struct cache_entry *p;
+	uint64_t swept, used;
+	int rv = 0;
+
+	*chunk_bytes = 0;
+
+	dirp = opendir(config->cache_path);
+	if (dirp == NULL) {
+		slurm_error("pyxis: cache: couldn't open %s: %s", config->cache_path, strerror(errno));
+		return (-1);
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		n = 0;
+		if (sscanf(d->d_name, "%u%n", &uid, &n) != 1 || d->d_name[n] != '\0')
+			continue;
+
+		dir_fd = cache_user_dir_open(config, uid);
+		if (dir_fd < 0)
+			continue;
+
+		lock_fd = cache_index_lock(dir_fd);
+		if (lock_fd < 0) {
+			close(dir_fd);
+			rv = -1;
+			continue;
+		}
+
+		ret = cache_index_load(dir_fd, &index);
+		if (ret == 0) {
+			cache_gc_mark_referenced(dir_fd, &index, boot);
+			cache_gc_mark_containers(dir_fd, &index);
+			cache_gc_stat_entries(dir_fd, &index);
+
+			if (chunk_sweep(dir_fd, &swept, &used) == 0)
+				*chunk_bytes += used;
+			else
+				rv = -1;
+		}
+		close(lock_fd);
+		close(dir_fd);
+		if (ret < 0) {
+			rv = -1;
+			continue;
+		}
+
+		p = realloc(*entries, sizeof(*p) * (*len + index.len));
+		if (p == NULL) {
+			cache_index_free(&index);
+			rv = -1;
+			break;
+		}
+		*entries = p;
+
+		for (size_t i = 0; i < index.len; ++i) {
+			/* The directory tells which user owns the entry, not the content of the index. */
+			index.entries[i].uid = uid;
+			(*entries)[(*len)++] = index.entries[i];
+		}
+
+		cache_index_free(&index);
+	}
+
+	closedir(dirp);
+
+	return (rv);
+}
+
+/* Remove the root filesystem of an entry, the squashfs file stays in the cache. */
+static int cache_rootfs_remove(int dir_fd, const char *digest)
+{
+	int ret;
+	int rootfs_fd;
+	char name[NAME_MAX + 1];
+
+	ret = digest_dir_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	/* The directory belongs to the user, don't follow a symlink planted in its place. */
+	rootfs_fd = openat(dir_fd, "rootfs", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (rootfs_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	ret = remove_tree(rootfs_fd, name);
+
+	close(rootfs_fd);
+
+	return (ret);
+}
+
+/*
+ * Evict an entry collected by cache_gc_collect(), or only its root filesystem, or only its squashfs
+ * file if it's in the chunk store.
+ * Returns 1 and sets *freed if the entry was evicted, 0 if it was used since it was collected, -1 on error.
+ */
+static int cache_gc_evict(const struct plugin_config *config, const struct cache_entry *victim, uint64_t *freed)
+{
+	int ret;
+	int dir_fd = -1;
+	int lock_fd = -1;
+	char manifest[NAME_MAX + 1];
+	char profile[NAME_MAX + 1];
+	struct cache_index index = { 0 };
+	struct cache_entry *entry;
+	uint64_t swept, used;
+	int rv = -1;
+
+	*freed = 0;
+
+	dir_fd = cache_user_dir_open(config, victim->uid);
+	if (dir_fd < 0)
+		return (-1);
+
+	lock_fd = cache_index_lock(dir_fd);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = cache_index_load(dir_fd, &index);
+	if (ret < 0)
+		goto fail;
+
+	entry = cache_index_find(&index, victim->uid, victim->digest);
+	if (entry == NULL) {
+		rv = 1;
+		goto fail;
+	}
+
+	/* last_used only has a one second granularity, the generation changes on every use. */
+	if (entry->generation != victim->generation || entry->last_used != victim->last_used) {
+		rv = 0;
+		goto fail;
+	}
+
+	if (victim->extracted) {
+		ret = cache_rootfs_remove(dir_fd, victim->digest);
+		if (ret < 0) {
+			slurm_info("pyxis: cache: couldn't remove the root filesystem of %s for uid %u: %s",
+				   victim->digest, victim->uid, strerror(errno));
+			goto fail;
+		}
+		*freed = victim->rootfs_size;
+
+		slurm_info("pyxis: cache: evicted the root filesystem of %s for uid %u (%" PRIu64 " bytes), keeping its squashfs file",
+			   victim->digest, victim->uid, victim->rootfs_size);
+
+		entry->rootfs_size = 0;
+		(void)cache_index_save(dir_fd, &index);
+		rv = 1;
+		goto fail;
+	}
+
+	ret = cache_entry_unlink(dir_fd, entry);
+	if (ret < 0) {
+		slurm_info("pyxis: cache: couldn't remove %s for uid %u: %s", victim->digest, victim->uid, strerror(errno));
+		goto fail;
+	}
+	if (victim->assembled)
+		*freed = victim->size;
+
+	/* The entry stays in the index, the squashfs file can be assembled again from its chunks. */
+	if (victim->assembled && victim->chunked) {
+		slurm_info("pyxis: cache: evicted the squashfs file of %s for uid %u (%" PRIu64 " bytes), keeping its chunks",
+			   victim->digest, victim->uid, victim->size);
+		rv = 1;
+		goto fail;
+	}
+
+	if (victim->chunked) {
+		ret = cache_manifest_name(victim->digest, &manifest);
+		if (ret < 0 || (unlinkat(dir_fd, manifest, 0) < 0 && errno != ENOENT)) {
+			slurm_info("pyxis: cache: couldn't remove the manifest of %s for uid %u", victim->digest, victim->uid);
+			goto fail;
+		}
+
+		if (chunk_sweep(dir_fd, &swept, &used) == 0)
+			*freed += swept;
+	}
+
+	/* The profile is kept while the squashfs file can be assembled again, it is identical. */
+	if (cache_profile_name(victim->digest, &profile) == 0)
+		(void)unlinkat(dir_fd, profile, 0);
+
+	slurm_info("pyxis: cache: evicted %s for uid %u (%" PRIu64 " bytes)", victim->digest, victim->uid, *freed);
+
+	index.evictions += 1;
+	cache_index_remove(&index, entry);
+	(void)cache_index_save(dir_fd, &index);
+
+	rv = 1;
+
+fail:
+	cache_index_free(&index);
+	xclose(lock_fd);
+	xclose(dir_fd);
+
+	return (rv);
+}
+
+/*
+ * Returns the number of bytes to free from the cache: enough to go back under cache_max_size, and
+ * if the disk usage of the filesystem is above the high watermark, enough to go down to the low
+ * watermark.
+ */
+static uint64_t cache_gc_target(const struct plugin_config *config, uint64_t total)
+{
+	struct statvfs st;
+	uint64_t capacity, used, low;
+	uint64_t target = 0;
+
+	if (config->cache_max_size > 0 && total > config->cache_max_size)
+		target = total - config->cache_max_size;
+
+	if (config->cache_high_watermark == 0)
+		return (target);
+
+	if (statvfs(config->cache_path, &st) < 0) {
+		slurm_error("pyxis: cache: couldn't statvfs %s: %s", config->cache_path, strerror(errno));
+		return (target);
+	}
+
+	capacity = (uint64_t)st.f_blocks * st.f_frsize;
+	used = (uint64_t)(st.f_blocks - st.f_bfree) * st.f_frsize;
+	if (capacity == 0 || used * 100 <= capacity * config->cache_high_watermark)
+		return (target);
+
+	low = capacity / 100 * config->cache_low_watermark;
+	slurm_info("pyxis: cache: disk usage of %s is above %u%%, freeing space down to %u%%",
+		   config->cache_path, config->cache_high_watermark, config->cache_low_watermark);
+
+	if (used > low && used - low > target)
+		target = used - low;
+
+	return (target);
+}
+
+/*
+ * As root, evict least recently used entries, across all users, until the cache fits in
+ * cache_max_size and the disk usage is under the watermarks. Entries referenced by running jobs
+ * are kept.
+ */
+int cache_gc(const struct plugin_config *config)
+{
+	int ret;
+	struct cache_entry *entries = NULL;
+	size_t len = 0;
+	uint64_t total = 0;
+	uint64_t target, freed = 0, n;
+	int rv = 0;
+
+	if (!cache_enabled(config) || (config->cache_max_size == 0 && config->cache_high_watermark == 0))
+		return (0);
+
+	ret = cache_gc_collect(config, &entries, &len, &total);
+	if (ret < 0)
+		rv = -1;
+
+	for (size_t i = 0; i < len; ++i) {
+		if (entries[i].assembled)
+			total += entries[i].size;
+		if (entries[i].extracted)
+			total += entries[i].rootfs_size;
+	}
+
+	target = cache_gc_target(config, total);
+	if (target == 0)
+		goto out;
+
+	qsort(entries, len, sizeof(*entries), cache_entry_cmp);
+
+	for (size_t i = 0; i < len && freed < target; ++i) {
+		if (entries[i].referenced)
+			continue;
+
+		ret = cache_gc_evict(config, &entries[i], &n);
+		if (ret < 0)
+			rv = -1;
+		else if (ret == 1)
+			freed += n;
+	}
+
+	if (freed < target)
+		slurm_info("pyxis: cache: freed %" PRIu64 " bytes out of %" PRIu64 ", the other entries are in use",
+			   freed, target);
+
+out:
+	free(entries);
+
+	return (rv);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+bool cache_enabled(const struct plugin_config *config);
+
+int cache_create_dir(const struct plugin_config *config);
+
+int cache_create_user_dir(const struct plugin_config *config, uid_t uid, gid_t gid);
+
+int cache_lookup(const struct plugin_config *config, uid_t uid, const char *digest, char **path);
+
+int cache_temp_path(const struct plugin_config *config, uid_t uid, const char *digest,
+		    uint32_t jobid, uint32_t stepid, char **path);
+
+int cache_profile_path(const struct plugin_config *config, uid_t uid, const char *digest, char **path);
+
+int cache_publish(const struct plugin_config *config, uid_t uid, const char *digest,
+		  const char *temp_path, char **path);
+
+int cache_rootfs_lookup(const struct plugin_config *config, uid_t uid, const char *digest, char **path);
+
+int cache_rootfs_publish(const struct plugin_config *config, uid_t uid, const char *digest,
+			 const char *temp_path, char **path);
+
+int cache_ref_add(const struct plugin_config *config, uid_t uid, uint32_t jobid, const char *digest);
+
+int cache_ref_release(const struct plugin_config *config, uid_t uid, uint32_t jobid);
+
+int cache_gc(const struct plugin_config *config);
+
+#endif /* CACHE_H_ */
@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "sha256.h"
+
+/*
+ * Content-defined chunk store, shared by all the files of a directory:
+ *   <dir>/chunks/<xx>/<sha256>   chunk files, named after the SHA-256 of their content
+ *   <dir>/<name>.chunks          manifest of a file, one "<sha256> <size>" line per chunk, in order
+ *
+ * Chunk boundaries are selected with a gear rolling hash over the content, not at fixed offsets:
+ * when a new version of an image only changes a few files, most of the chunks of its squashfs file
+ * are already in the store and only the new ones take space.
+ *
+ * Callers serialize chunk_store(), chunk_assemble() and chunk_sweep() on the same directory.
+ */
+
+#define CHUNK_MANIFEST_HEADER "pyxis-chunks 1"
+
+#define CHUNK_MIN_SIZE (512 * 1024)
+#define CHUNK_MAX_SIZE (8 * 1024 * 1024)
+/* The top bits of the gear hash depend on the last 64 bytes, chunks average 1 MiB above the minimum. */
+#define CHUNK_MASK (((1ULL << 20) - 1) << 44)
+#define CHUNK_WINDOW 64
+
+/* Hexadecimal SHA-256. */
+#define CHUNK_HEX_SIZE 64
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+/* Must never change, or the chunks of existing manifests would not be reused. */
+#define CHUNK_GEAR_SEED 0x7079786973ULL
+
+static uint64_t gear[256];
+
+static void chunk_gear_init(void)
+{
+	uint64_t x = CHUNK_GEAR_SEED;
+	uint64_t z;
+
+	if (gear[0] != 0)
+		return;
+
+	/* splitmix64 */
+	for (int i = 0; i < 256; ++i) {
+		z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+/* Returns the size of the next chunk, the buffer holds CHUNK_MAX_SIZE bytes unless it's the end of the file. */
+static size_t chunk_cut(const uint8_t *p, size_t len)
+{
+	uint64_t h = 0;
+
+	if (len <= CHUNK_MIN_SIZE)
+		return (len);
+
+	for (size_t i = CHUNK_MIN_SIZE - CHUNK_WINDOW; i < len; ++i) {
+		h = (h << 1) + gear[p[i]];
+		if (i >= CHUNK_MIN_SIZE && (h & CHUNK_MASK) == 0)
+			return (i + 1);
+	}
+
+	return (len);
+}
+
+static void chunk_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char (*hex)[CHUNK_HEX_SIZE + 1])
+{
+	for (int i = 0; i < SHA256_DIGEST_SIZE; ++i)
+		snprintf(*hex + 2 * i, 3, "%02x", digest[i]);
+}
+
+static int chunk_dir_open(int dir_fd, bool create)
+{
+	int ret;
+
+	if (create) {
+		ret = mkdirat(dir_fd, "chunks", 0700);
+		if (ret < 0 && errno != EEXIST)
+			return (-1);
+	}
+
+	return openat(dir_fd, "chunks", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+static int write_all(int fd, const uint8_t *p, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return (-1);
+		p += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+/* Returns 1 if the chunk was added to the store, 0 if it was already there, -1 on error. */
+static int chunk_write(int chunks_fd, const uint8_t *p, size_t len, char (*hex)[CHUNK_HEX_SIZE + 1])
+{
+	int ret;
+	int fd;
+	struct sha256_ctx ctx;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char subdir[3];
+	char path[CHUNK_HEX_SIZE + 4];
+	char temp[CHUNK_HEX_SIZE + 9];
+	struct stat st;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, p, len);
+	sha256_final(&ctx, digest);
+	chunk_hex(digest, hex);
+
+	snprintf(subdir, sizeof(subdir), "%.2s", *hex);
+	snprintf(path, sizeof(path), "%s/%s", subdir, *hex);
+	snprintf(temp, sizeof(temp), "%s/.%s.tmp", subdir, *hex);
+
+	ret = fstatat(chunks_fd, path, &st, AT_SYMLINK_NOFOLLOW);
+	if (ret == 0 && S_ISREG(st.st_mode) && st.st_size == len)
+		return (0);
+
+	ret = mkdirat(chunks_fd, subdir, 0700);
+	if (ret < 0 && errno != EEXIST)
+		return (-1);
+
+	fd = openat(chunks_fd, temp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return (-1);
+
+	ret = write_all(fd, p, len);
+	if (close(fd) < 0 || ret < 0)
+		goto fail;
+
+	ret = renameat(chunks_fd, temp, chunks_fd, path);
+	if (ret < 0)
+		goto fail;
+
+	return (1);
+
+fail:
+	unlinkat(chunks_fd, temp, 0);
+	return (-1);
+}
+
+/* Split the content of fd into chunks, add the missing ones to the store and write the manifest. */
+int chunk_store(int dir_fd, int fd, const char *manifest, struct chunk_stats *stats)
+{
+	int ret;
+	int chunks_fd = -1;
+	int manifest_fd;
+	FILE *fp = NULL;
+	char temp[NAME_MAX + 1];
+	char hex[CHUNK_HEX_SIZE + 1];
+	uint8_t *buf = NULL;
+	size_t off = 0, len = 0, cut;
+	ssize_t n;
+	bool eof = false;
+	int rv = -1;
+
+	memset(stats, 0, sizeof(*stats));
+	chunk_gear_init();
+
+	ret = snprintf(temp, sizeof(temp), ".%s.tmp", manifest);
+	if (ret < 0 || ret >= sizeof(temp))
+		return (-1);
+
+	chunks_fd = chunk_dir_open(dir_fd, true);
+	if (chunks_fd < 0) {
+		slurm_error("pyxis: chunks: couldn't open chunk directory: %s", strerror(errno));
+		goto fail;
+	}
+
+	/* Twice the maximum chunk size, the content is only moved back to the start once per chunk. */
+	buf = malloc(2 * CHUNK_MAX_SIZE);
+	if (buf == NULL)
+		goto fail;
+
+	manifest_fd = openat(dir_fd, temp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (manifest_fd < 0) {
+		slurm_error("pyxis: chunks: couldn't open %s: %s", temp, strerror(errno));
+		goto fail;
+	}
+
+	fp = fdopen(manifest_fd, "w");
+	if (fp == NULL) {
+		close(manifest_fd);
+		goto fail;
+	}
+
+	fprintf(fp, "%s\n", CHUNK_MANIFEST_HEADER);
+
+	for (;;) {
+		if (!eof && len < CHUNK_MAX_SIZE && off + CHUNK_MAX_SIZE > 2 * CHUNK_MAX_SIZE) {
+			memmove(buf, buf + off, len);
+			off = 0;
+		}
+
+		while (!eof && len < CHUNK_MAX_SIZE) {
+			n = read(fd, buf + off + len, CHUNK_MAX_SIZE - len);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0) {
+				slurm_error("pyxis: chunks: couldn't read: %s", strerror(errno));
+				goto fail;
+			}
+			if (n == 0)
+				eof = true;
+			len += n;
+		}
+
+		if (len == 0)
+			break;
+
+		cut = chunk_cut(buf + off, len);
+
+		ret = chunk_write(chunks_fd, buf + off, cut, &hex);
+		if (ret < 0) {
+			slurm_error("pyxis: chunks: couldn't write chunk %s: %s", hex, strerror(errno));
+			goto fail;
+		}
+
+		stats->chunks += 1;
+		if (ret == 1) {
+			stats->new_chunks += 1;
+			stats->new_bytes += cut;
+		}
+
+		fprintf(fp, "%s %zu\n", hex, cut);
+
+		off += cut;
+		len -= cut;
+	}
+
+	ret = ferror(fp);
+	if (fclose(fp) != 0 || ret != 0) {
+		fp = NULL;
+		slurm_error("pyxis: chunks: couldn't write %s", temp);
+		goto fail;
+	}
+	fp = NULL;
+
+	ret = renameat(dir_fd, temp, dir_fd, manifest);
+	if (ret < 0) {
+		slurm_error("pyxis: chunks: couldn't rename %s: %s", temp, strerror(errno));
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	if (fp != NULL)
+		fclose(fp);
+	if (rv < 0)
+		unlinkat(dir_fd, temp, 0);
+	free(buf);
+	xclose(chunks_fd);
+
+	return (rv);
+}
+
+static FILE *chunk_manifest_open(int dir_fd, const char *manifest)
+{
+	int fd;
+	FILE *fp;
+	char *line;
+
+	/* Non-blocking, as root this might not be a regular file until open_user_file() checks it. */
+	fd = open_user_file(dir_fd, manifest, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		return (NULL);
+
+	fp = fdopen(fd, "r");
+	if (fp == NULL) {
+		close(fd);
+		return (NULL);
+	}
+
+	line = get_line_from_file(fp);
+	if (line == NULL || strcmp(line, CHUNK_MANIFEST_HEADER) != 0) {
+		free(line);
+		fclose(fp);
+		errno = EINVAL;
+		return (NULL);
+	}
+	free(line);
+
+	return (fp);
+}
+
+static int chunk_manifest_parse(const char *line, char (*hex)[CHUNK_HEX_SIZE + 1], uint64_t *size)
+{
+	int n = 0;
+
+	if (sscanf(line, "%" XSTR(CHUNK_HEX_SIZE) "[0-9a-f] %" SCNu64 "%n", *hex, size, &n) != 2 ||
+	    strlen(*hex) != CHUNK_HEX_SIZE || line[n] != '\0')
+		return (-1);
+
+	return (0);
+}
+
+/* Write the file described by a manifest to fd. */
+int chunk_assemble(int dir_fd, const char *manifest, int fd)
+{
+	int ret;
+	int chunks_fd = -1;
+	int chunk_fd = -1;
+	FILE *fp = NULL;
+	char *line = NULL;
+	char hex[CHUNK_HEX_SIZE + 1];
+	char path[CHUNK_HEX_SIZE + 4];
+	uint64_t size;
+	struct stat st;
+	uint8_t *buf = NULL;
+	ssize_t n;
+	int rv = -1;
+
+	fp = chunk_manifest_open(dir_fd, manifest);
+	if (fp == NULL) {
+		slurm_error("pyxis: chunks: couldn't open %s: %s", manifest, strerror(errno));
+		goto fail;
+	}
+
+	chunks_fd = chunk_dir_open(dir_fd, false);
+	if (chunks_fd < 0) {
+		slurm_error("pyxis: chunks: couldn't open chunk directory: %s", strerror(errno));
+		goto fail;
+	}
+
+	buf = malloc(CHUNK_MAX_SIZE);
+	if (buf == NULL)
+		goto fail;
+
+	while ((line = get_line_from_file(fp)) != NULL) {
+		ret = chunk_manifest_parse(line, &hex, &size);
+		if (ret < 0) {
+			slurm_error("pyxis: chunks: invalid line in %s: %s", manifest, line);
+			goto fail;
+		}
+
+		snprintf(path, sizeof(path), "%.2s/%s", hex, hex);
+		chunk_fd = openat(chunks_fd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (chunk_fd < 0 || fstat(chunk_fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size != size) {
+			slurm_error("pyxis: chunks: chunk %s of %s is missing or truncated", hex, manifest);
+			goto fail;
+		}
+
+		while (size > 0) {
+			n = read(chunk_fd, buf, size < CHUNK_MAX_SIZE ? size : CHUNK_MAX_SIZE);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0 || write_all(fd, buf, n) < 0) {
+				slurm_error("pyxis: chunks: couldn't copy chunk %s: %s", hex, n == 0 ? "short read" : strerror(errno));
+				goto fail;
+			}
+			size -= n;
+		}
+
+		close(chunk_fd);
+		chunk_fd = -1;
+		free(line);
+	}
+	line = NULL;
+
+	if (ferror(fp)) {
+		slurm_error("pyxis: chunks: couldn't read %s", manifest);
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	free(line);
+	free(buf);
+	xclose(chunk_fd);
+	xclose(chunks_fd);
+	if (fp != NULL)
+		fclose(fp);
+
+	return (rv);
+}
+
+static int chunk_hex_cmp(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+/* Append the chunks of all the manifests of the directory, invalid manifests are removed. */
+static int chunk_sweep_mark(int dir_fd, char (**hashes)[CHUNK_HEX_SIZE + 1], size_t *len)
+{
+	int fd;
+	DIR *dirp;
+	struct dirent *d;
+	size_t name_len;
+	FILE *fp;
+	char *line;
+	char hex[CHUNK_HEX_SIZE + 1];
+	uint64_t size;
+	char (*p)[CHUNK_HEX_SIZE + 1];
+	size_t alloc = *len;
+	int rv = 0;
+
+	fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	dirp = fdopendir(fd);
+	if (dirp == NULL) {
+		close(fd);
+		return (-1);
+	}
+
+	while (rv == 0 && (d = readdir(dirp)) != NULL) {
+		name_len = strlen(d->d_name);
+		if (d->d_name[0] == '.' || name_len <= strlen(CHUNK_MANIFEST_SUFFIX) ||
+		    strcmp(d->d_name + name_len - strlen(CHUNK_MANIFEST_SUFFIX), CHUNK_MANIFEST_SUFFIX) != 0)
+			continue;
+
+		fp = chunk_manifest_open(dir_fd, d->d_name);
+		if (fp == NULL) {
+			if (errno == ENOENT)
+				continue;
+			if (errno != EINVAL && errno != EPERM) {
+				rv = -1;
+				break;
+			}
+			slurm_info("pyxis: chunks: removing invalid manifest %s", d->d_name);
+			unlinkat(dir_fd, d->d_name, 0);
+			continue;
+		}
+
+		while ((line = get_line_from_file(fp)) != NULL) {
+			if (chunk_manifest_parse(line, &hex, &size) == 0) {
+				if (*len == alloc) {
+					alloc = alloc ? 2 * alloc : 1024;
+					p = realloc(*hashes, sizeof(*p) * alloc);
+					if (p == NULL) {
+						free(line);
+						rv = -1;
+						break;
+					}
+					*hashes = p;
+				}
+				memcpy((*hashes)[(*len)++], hex, sizeof(hex));
+			}
+			free(line);
+		}
+
+		/* Never remove chunks because a manifest couldn't be read entirely. */
+		if (ferror(fp))
+			rv = -1;
+		fclose(fp);
+	}
+
+	closedir(dirp);
+
+	return (rv);
+}
+
+/*
+ * Remove the chunks that are not referenced by any manifest, and leftover temporary files.
+ * Sets *freed to the size of the removed chunks and *used to the size of the remaining ones.
+ */
+int chunk_sweep(int dir_fd, uint64_t *freed, uint64_t *used)
+{
+	int ret;
+	int chunks_fd;
+	int fd;
+	DIR *dirp = NULL, *subdirp;
+	struct dirent *d, *e;
+	struct stat st;
+	char (*hashes)[CHUNK_HEX_SIZE + 1] = NULL;
+	size_t len = 0;
+	int rv = -1;
+
+	*freed = 0;
+	*used = 0;
+
+	chunks_fd = chunk_dir_open(dir_fd, false);
+	if (chunks_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	dirp = fdopendir(chunks_fd);
+	if (dirp == NULL) {
+		close(chunks_fd);
+		return (-1);
+	}
+
+	ret = chunk_sweep_mark(dir_fd, &hashes, &len);
+	if (ret < 0) {
+		slurm_error("pyxis: chunks: couldn't read manifests, not removing any chunk");
+		goto fail;
+	}
+
+	qsort(hashes, len, sizeof(*hashes), chunk_hex_cmp);
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+
+		fd = openat(dirfd(dirp), d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		subdirp = fdopendir(fd);
+		if (subdirp == NULL) {
+			close(fd);
+			continue;
+		}
+
+		while ((e = readdir(subdirp)) != NULL) {
+			if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+				continue;
+
+			if (fstatat(dirfd(subdirp), e->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 || S_ISDIR(st.st_mode))
+				continue;
+
+			if (e->d_name[0] != '.' && bsearch(e->d_name, hashes, len, sizeof(*hashes), chunk_hex_cmp) != NULL) {
+				*used += st.st_size;
+				continue;
+			}
+
+			if (unlinkat(dirfd(subdirp), e->d_name, 0) == 0)
+				*freed += st.st_size;
+		}
+
+		closedir(subdirp);
+	}
+
+	rv = 0;
+
+fail:
+	free(hashes);
+	closedir(dirp);
+
+	return (rv);
+}
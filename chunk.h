@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef CHUNK_H_
+#define CHUNK_H_
+
+#include <stdint.h>
+
+#define CHUNK_MANIFEST_SUFFIX ".chunks"
+
+struct chunk_stats {
+	uint64_t chunks;
+	uint64_t new_chunks;
+	uint64_t new_bytes;
+};
+
+int chunk_store(int dir_fd, int fd, const char *manifest, struct chunk_stats *stats);
+
+int chunk_assemble(int dir_fd, const char *manifest, int fd);
+
+int chunk_sweep(int dir_fd, uint64_t *freed, uint64_t *used);
+
+#endif /* CHUNK_H_ */
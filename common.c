@@ -6,9 +6,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
 
@@ -230,6 +234,45 @@ static void sigterm_handler(int sig)
 	got_sigterm = 1;
 }
 
+/*
+ * Send a signal to the process group of a child started with child_new_process_group(), so that
+ * the processes it spawned (e.g. curl, pigz, mksquashfs for enroot import) are signaled too.
+ */
+static void child_kill(pid_t pid, int sig)
+{
+	if (kill(-pid, sig) < 0 && errno == ESRCH)
+		kill(pid, sig);
+}
+
+/* Wait for the child to exit for at most timeout seconds, returns 0 if it's still running. */
+static pid_t child_wait_timeout(pid_t pid, int *status, unsigned int timeout)
+{
+	struct timespec delay = { .tv_sec = 0, .tv_nsec = 100 * 1000000L };
+	pid_t ret;
+
+	for (unsigned int i = 0; i < timeout * 10; ++i) {
+		ret = waitpid(pid, status, WNOHANG);
+		if (ret != 0 && !(ret < 0 && errno == EINTR))
+			return (ret);
+		nanosleep(&delay, NULL);
+	}
+
+	return (0);
+}
+
+/*
+ * Move a child to its own process group, from the child itself (pid 0) and from the parent after
+ * fork(): the parent might signal the group before the child had a chance to create it. From the
+ * parent, the child might already have exec'd (EACCES) or exited (ESRCH).
+ */
+int child_new_process_group(pid_t pid)
+{
+	if (setpgid(pid, pid) < 0 && (pid == 0 || (errno != EACCES && errno != ESRCH)))
+		return (-1);
+
+	return (0);
+}
+
 int child_wait_for_pid(pid_t pid)
 {
 	struct sigaction sa = { 0 }, old_sa;
@@ -252,10 +295,49 @@ int child_wait_for_pid(pid_t pid)
 
 	if (ret < 0 && got_sigterm) {
 		slurm_error("pyxis: received SIGTERM, forwarding to child %d", pid);
-		kill(pid, SIGTERM);
+		child_kill(pid, SIGTERM);
+
+		ret = child_wait_timeout(pid, &status, CHILD_KILL_TIMEOUT);
+		if (ret == 0) {
+			slurm_error("pyxis: child %d still running after %d seconds, killing it", pid, CHILD_KILL_TIMEOUT);
+			child_kill(pid, SIGKILL);
+			do {
+				ret = waitpid(pid, &status, 0);
+			} while (ret < 0 && errno == EINTR);
+		}
+
+		/* Processes of the group might have outlived the child, the group ID is not reused until they exit. */
+		kill(-pid, SIGKILL);
+	}
+
+	if (ret < 0)
+		return (-1);
+
+	return (status);
+}
+
+/*
+ * Like child_wait_for_pid(), but kill the process group of the child if it doesn't exit within
+ * timeout seconds. Returns -1 with errno set to ETIMEDOUT in that case.
+ */
+int child_wait_for_pid_timeout(pid_t pid, unsigned int timeout)
+{
+	int status;
+	pid_t ret;
+
+	if (timeout == 0)
+		return child_wait_for_pid(pid);
+
+	ret = child_wait_timeout(pid, &status, timeout);
+	if (ret == 0) {
+		child_kill(pid, SIGKILL);
 		do {
 			ret = waitpid(pid, &status, 0);
 		} while (ret < 0 && errno == EINTR);
+		kill(-pid, SIGKILL);
+
+		errno = ETIMEDOUT;
+		return (-1);
 	}
 
 	if (ret < 0)
@@ -264,9 +346,12 @@ int child_wait_for_pid(pid_t pid)
 	return (status);
 }
 
-int close_extra_fds(void)
+static int close_fd_range(unsigned int first, unsigned int last)
 {
-	if (syscall(__NR_close_range, (unsigned int)(STDERR_FILENO + 1), ~0U, 0) == 0)
+	if (first > last)
+		return (0);
+
+	if (syscall(__NR_close_range, first, last, 0) == 0)
 		return (0);
 
 	if (errno == ENOSYS)
@@ -274,3 +359,199 @@ int close_extra_fds(void)
 
 	return (-1);
 }
+
+int close_extra_fds(void)
+{
+	return close_fd_range(STDERR_FILENO + 1, ~0U);
+}
+
+/* Like close_extra_fds(), but keep one fd open, e.g. a close-on-exec pipe to the parent. */
+int close_extra_fds_except(int fd)
+{
+	if (fd <= STDERR_FILENO)
+		return close_extra_fds();
+
+	if (close_fd_range(STDERR_FILENO + 1, fd - 1) < 0)
+		return (-1);
+
+	return close_fd_range(fd + 1, ~0U);
+}
+
+/* Boot time, reference files older than that were left by jobs that didn't run their epilog. */
+time_t boot_time(void)
+{
+	FILE *fp;
+	char *line;
+	long long btime = 0;
+
+	fp = fopen("/proc/stat", "re");
+	if (fp == NULL)
+		return (0);
+
+	while ((line = get_line_from_file(fp)) != NULL) {
+		sscanf(line, "btime %lld", &btime);
+		free(line);
+	}
+
+	fclose(fp);
+
+	return (btime);
+}
+
+/* 64-bit FNV-1a, used to derive short file names from arbitrary strings. */
+uint64_t hash_string(const char *s)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (const unsigned char *c = (const unsigned char *)s; *c != '\0'; ++c) {
+		hash ^= *c;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return (hash);
+}
+
+/*
+ * Open a file in a directory owned by a user. As root, the content of the directory is controlled
+ * by the user: only open regular files owned by the user, without following links, and give new
+ * files to the user so that they remain usable without privileges.
+ */
+int open_user_file(int dir_fd, const char *name, int flags)
+{
+	int fd = -1;
+	bool created = false;
+	struct stat dir_st, st;
+
+	if (geteuid() != 0)
+		return openat(dir_fd, name, flags | O_NOFOLLOW | O_CLOEXEC, 0600);
+
+	if (fstat(dir_fd, &dir_st) < 0)
+		return (-1);
+
+	if (flags & O_CREAT) {
+		fd = openat(dir_fd, name, flags | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+		if (fd >= 0)
+			created = true;
+		else if (errno != EEXIST || (flags & O_EXCL))
+			return (-1);
+	}
+	if (fd < 0)
+		fd = openat(dir_fd, name, (flags & ~O_CREAT) | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	if (created) {
+		if (fchown(fd, dir_st.st_uid, dir_st.st_gid) < 0)
+			goto fail;
+	} else {
+		if (fstat(fd, &st) < 0)
+			goto fail;
+		if (!S_ISREG(st.st_mode) || st.st_uid != dir_st.st_uid || st.st_nlink != 1) {
+			errno = EPERM;
+			goto fail;
+		}
+	}
+
+	return (fd);
+
+fail:
+	close(fd);
+	return (-1);
+}
+
+/* As root, create a directory owned by the user. Returns 0 if the directory already exists. */
+int create_user_dir(const char *path, uid_t uid, gid_t gid)
+{
+	int ret;
+
+	ret = mkdir(path, 0700);
+	if (ret < 0 && errno != EEXIST) {
+		slurm_error("pyxis: couldn't mkdir %s: %s", path, strerror(errno));
+		return (-1);
+	}
+	if (ret < 0 && errno == EEXIST)
+		return (0);
+
+	ret = chown(path, uid, gid);
+	if (ret < 0) {
+		slurm_error("pyxis: couldn't chown %s: %s", path, strerror(errno));
+		rmdir(path);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Remove a file or a directory tree, without following symlinks or descending into a filesystem
+ * mounted in the tree. The tree might come from a container image: without privileges, directories
+ * are made accessible before their content is removed.
+ */
+int remove_tree(int dir_fd, const char *name)
+{
+	int ret;
+	int fd;
+	DIR *dirp;
+	struct dirent *d;
+	struct stat parent_st, st, fd_st;
+	int rv = 0;
+
+	ret = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW);
+	if (ret < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	if (!S_ISDIR(st.st_mode)) {
+		ret = unlinkat(dir_fd, name, 0);
+		return (ret < 0 && errno != ENOENT ? -1 : 0);
+	}
+
+	if (fstat(dir_fd, &parent_st) < 0)
+		return (-1);
+
+	if (st.st_dev != parent_st.st_dev) {
+		errno = EBUSY;
+		return (-1);
+	}
+
+	if (geteuid() != 0 && (st.st_mode & S_IRWXU) != S_IRWXU) {
+		ret = fchmodat(dir_fd, name, (st.st_mode & 07777) | S_IRWXU, 0);
+		if (ret < 0)
+			return (-1);
+	}
+
+	fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	/* The directory might have been replaced since it was checked. */
+	if (fstat(fd, &fd_st) < 0 || fd_st.st_dev != st.st_dev || fd_st.st_ino != st.st_ino) {
+		close(fd);
+		errno = EBUSY;
+		return (-1);
+	}
+
+	dirp = fdopendir(fd);
+	if (dirp == NULL) {
+		close(fd);
+		return (-1);
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+			continue;
+
+		if (remove_tree(dirfd(dirp), d->d_name) < 0)
+			rv = -1;
+	}
+
+	closedir(dirp);
+
+	if (rv < 0)
+		return (-1);
+
+	ret = unlinkat(dir_fd, name, AT_REMOVEDIR);
+	if (ret < 0 && errno != ENOENT)
+		return (-1);
+
+	return (0);
+}
@@ -4,10 +4,19 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/syscall.h>
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
+/*
+ * Grace period between SIGTERM and SIGKILL when a child is interrupted, in seconds. Slurm kills the
+ * whole step KillWait seconds after SIGTERM (30 by default), the grace period must stay below it for
+ * pyxis to kill the process group of the child itself. See "Cancelled job steps" in README.md.
+ */
+#define CHILD_KILL_TIMEOUT 10
+
 static inline void xclose(int fd)
 {
 	if (fd < 0)
@@ -22,6 +31,10 @@ int xasprintf(char **strp, const char *fmt, ...);
 # define SLURM_BATCH_SCRIPT (0xfffffffb)
 #endif
 
+#if !defined(SLURM_PENDING_STEP)
+# define SLURM_PENDING_STEP (0xfffffffd)
+#endif
+
 #if !defined(MFD_CLOEXEC)
 # define MFD_CLOEXEC 0x0001U
 #endif /* !defined(MFD_CLOEXEC) */
@@ -82,8 +95,24 @@ void memfd_print_log(int *log_fd, bool error, const char *tag);
 
 char *fstab_escape(const char *s);
 
+int child_new_process_group(pid_t pid);
+
 int child_wait_for_pid(pid_t pid);
 
+int child_wait_for_pid_timeout(pid_t pid, unsigned int timeout);
+
 int close_extra_fds(void);
 
+int close_extra_fds_except(int fd);
+
+time_t boot_time(void);
+
+uint64_t hash_string(const char *s);
+
+int open_user_file(int dir_fd, const char *name, int flags);
+
+int create_user_dir(const char *path, uid_t uid, gid_t gid);
+
+int remove_tree(int dir_fd, const char *name);
+
 #endif /* COMMON_H_ */
@@ -1,8 +1,11 @@
 /*
- * Copyright (c) 2020-2025, NVIDIA CORPORATION. All rights reserved.
+ * Copyright (c) 2020-2026, NVIDIA CORPORATION. All rights reserved.
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <slurm/spank.h>
@@ -20,6 +23,83 @@ int parse_bool(const char *s)
 	return (-1);
 }
 
+int parse_unsigned(const char *s, unsigned int *value)
+{
+	unsigned long n;
+	char *end;
+
+	if (*s == '\0' || *s == '-')
+		return (-1);
+
+	errno = 0;
+	n = strtoul(s, &end, 10);
+	if (errno != 0 || *end != '\0' || n > UINT_MAX)
+		return (-1);
+
+	*value = n;
+
+	return (0);
+}
+
+/* Parse a size in bytes, with an optional binary suffix (K, M, G or T). */
+int parse_size(const char *s, uint64_t *size)
+{
+	unsigned long long n;
+	char *end;
+	unsigned int shift = 0;
+
+	if (*s == '\0' || *s == '-')
+		return (-1);
+
+	errno = 0;
+	n = strtoull(s, &end, 10);
+	if (errno != 0 || end == s)
+		return (-1);
+
+	switch (*end) {
+	case '\0':
+		break;
+	case 'K': case 'k':
+		shift = 10;
+		break;
+	case 'M': case 'm':
+		shift = 20;
+		break;
+	case 'G': case 'g':
+		shift = 30;
+		break;
+	case 'T': case 't':
+		shift = 40;
+		break;
+	default:
+		return (-1);
+	}
+
+	if (*end != '\0' && end[1] != '\0')
+		return (-1);
+
+	if (shift > 0 && n > (UINT64_MAX >> shift))
+		return (-1);
+
+	*size = (uint64_t)n << shift;
+
+	return (0);
+}
+
+/* Colon-separated list of absolute paths. */
+static bool path_list_valid(const char *list)
+{
+	if (list[0] != '/')
+		return (false);
+
+	for (const char *p = strchr(list, ':'); p != NULL; p = strchr(p + 1, ':')) {
+		if (p[1] != '/')
+			return (false);
+	}
+
+	return (true);
+}
+
 int pyxis_config_parse(struct plugin_config *config, int ac, char **av)
 {
 	int ret;
@@ -36,9 +116,32 @@ int pyxis_config_parse(struct plugin_config *config, int ac, char **av)
 	config->execute_entrypoint = false;
 	config->container_scope = SCOPE_GLOBAL;
 	config->sbatch_support = true;
-	config->use_enroot_load = false;
+	config->use_enroot_load = ENROOT_LOAD_NEVER;
 	config->importer_path[0] = '\0';
 	config->use_squashfuse = false;
+	config->cache_path[0] = '\0';
+	config->cache_max_size = 0;
+	config->importer_single_flight = false;
+	config->digest_ttl = 0;
+	config->prolog_prefetch = false;
+	config->pin_digest = false;
+	config->importer_protocol = 1;
+	config->staging_path[0] = '\0';
+	config->staging_timeout = 3600;
+	config->max_concurrent_imports = 0;
+	config->scratch_path[0] = '\0';
+	config->scratch_min_free = 0;
+	config->cache_high_watermark = 0;
+	config->cache_low_watermark = 0;
+	config->cache_chunks = false;
+	config->submit_check = false;
+	config->submit_check_timeout = 30;
+	config->use_overlay = false;
+	config->shared_squashfuse = false;
+	config->kernel_squashfs = false;
+	config->job_rootfs = false;
+	config->squashfs_prewarm = 0;
+	config->squashfs_profile = 0;
 
 	for (int i = 0; i < ac; ++i) {
 		if (strncmp("runtime_path=", av[i], 13) == 0) {
@@ -76,12 +179,17 @@ int pyxis_config_parse(struct plugin_config *config, int ac, char **av)
 			config->sbatch_support = ret;
 		} else if (strncmp("use_enroot_load=", av[i], 16) == 0) {
 			optarg = av[i] + 16;
-			ret = parse_bool(optarg);
-			if (ret < 0) {
-				slurm_error("pyxis: use_enroot_load: invalid value: %s", optarg);
-				return (-1);
+			/* "auto" only uses enroot load when the image doesn't go through the cache or staging. */
+			if (strcmp(optarg, "auto") == 0) {
+				config->use_enroot_load = ENROOT_LOAD_AUTO;
+			} else {
+				ret = parse_bool(optarg);
+				if (ret < 0) {
+					slurm_error("pyxis: use_enroot_load: invalid value: %s", optarg);
+					return (-1);
+				}
+				config->use_enroot_load = ret ? ENROOT_LOAD_ALWAYS : ENROOT_LOAD_NEVER;
 			}
-			config->use_enroot_load = ret;
 		} else if (strncmp("importer=", av[i], 9) == 0) {
 			optarg = av[i] + 9;
 			ret = snprintf(config->importer_path, sizeof(config->importer_path), "%s", optarg);
@@ -89,6 +197,10 @@ int pyxis_config_parse(struct plugin_config *config, int ac, char **av)
 				slurm_error("pyxis: importer: path too long: %s", optarg);
 				return (-1);
 			}
+			if (strncmp(optarg, "unix:", 5) == 0 && optarg[5] != '/') {
+				slurm_error("pyxis: importer: socket path must be absolute: %s", optarg);
+				return (-1);
+			}
 		} else if (strncmp("use_squashfuse=", av[i], 15) == 0) {
 			optarg = av[i] + 15;
 			ret = parse_bool(optarg);
@@ -97,11 +209,220 @@ int pyxis_config_parse(struct plugin_config *config, int ac, char **av)
 				return (-1);
 			}
 			config->use_squashfuse = ret;
+		} else if (strncmp("cache_path=", av[i], 11) == 0) {
+			optarg = av[i] + 11;
+			ret = snprintf(config->cache_path, sizeof(config->cache_path), "%s", optarg);
+			if (ret < 0 || ret >= sizeof(config->cache_path)) {
+				slurm_error("pyxis: cache_path: path too long: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("cache_max_size=", av[i], 15) == 0) {
+			optarg = av[i] + 15;
+			ret = parse_size(optarg, &config->cache_max_size);
+			if (ret < 0) {
+				slurm_error("pyxis: cache_max_size: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("importer_single_flight=", av[i], 23) == 0) {
+			optarg = av[i] + 23;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: importer_single_flight: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->importer_single_flight = ret;
+		} else if (strncmp("digest_ttl=", av[i], 11) == 0) {
+			optarg = av[i] + 11;
+			ret = parse_unsigned(optarg, &config->digest_ttl);
+			if (ret < 0) {
+				slurm_error("pyxis: digest_ttl: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("prolog_prefetch=", av[i], 16) == 0) {
+			optarg = av[i] + 16;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: prolog_prefetch: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->prolog_prefetch = ret;
+		} else if (strncmp("pin_digest=", av[i], 11) == 0) {
+			optarg = av[i] + 11;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: pin_digest: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->pin_digest = ret;
+		} else if (strncmp("importer_protocol=", av[i], 18) == 0) {
+			optarg = av[i] + 18;
+			ret = parse_unsigned(optarg, &config->importer_protocol);
+			if (ret < 0 || config->importer_protocol < 1 || config->importer_protocol > 2) {
+				slurm_error("pyxis: importer_protocol: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("staging_path=", av[i], 13) == 0) {
+			optarg = av[i] + 13;
+			ret = snprintf(config->staging_path, sizeof(config->staging_path), "%s", optarg);
+			if (ret < 0 || ret >= sizeof(config->staging_path)) {
+				slurm_error("pyxis: staging_path: path too long: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("staging_timeout=", av[i], 16) == 0) {
+			optarg = av[i] + 16;
+			ret = parse_unsigned(optarg, &config->staging_timeout);
+			if (ret < 0) {
+				slurm_error("pyxis: staging_timeout: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("max_concurrent_imports=", av[i], 23) == 0) {
+			optarg = av[i] + 23;
+			ret = parse_unsigned(optarg, &config->max_concurrent_imports);
+			if (ret < 0) {
+				slurm_error("pyxis: max_concurrent_imports: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("scratch_path=", av[i], 13) == 0) {
+			optarg = av[i] + 13;
+			if (!path_list_valid(optarg)) {
+				slurm_error("pyxis: scratch_path: directories must be absolute paths: %s", optarg);
+				return (-1);
+			}
+			ret = snprintf(config->scratch_path, sizeof(config->scratch_path), "%s", optarg);
+			if (ret < 0 || ret >= sizeof(config->scratch_path)) {
+				slurm_error("pyxis: scratch_path: path too long: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("scratch_min_free=", av[i], 17) == 0) {
+			optarg = av[i] + 17;
+			ret = parse_size(optarg, &config->scratch_min_free);
+			if (ret < 0) {
+				slurm_error("pyxis: scratch_min_free: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("cache_high_watermark=", av[i], 21) == 0) {
+			optarg = av[i] + 21;
+			ret = parse_unsigned(optarg, &config->cache_high_watermark);
+			if (ret < 0 || config->cache_high_watermark > 100) {
+				slurm_error("pyxis: cache_high_watermark: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("cache_low_watermark=", av[i], 20) == 0) {
+			optarg = av[i] + 20;
+			ret = parse_unsigned(optarg, &config->cache_low_watermark);
+			if (ret < 0 || config->cache_low_watermark > 100) {
+				slurm_error("pyxis: cache_low_watermark: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("cache_chunks=", av[i], 13) == 0) {
+			optarg = av[i] + 13;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: cache_chunks: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->cache_chunks = ret;
+		} else if (strncmp("submit_check=", av[i], 13) == 0) {
+			optarg = av[i] + 13;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: submit_check: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->submit_check = ret;
+		} else if (strncmp("submit_check_timeout=", av[i], 21) == 0) {
+			optarg = av[i] + 21;
+			ret = parse_unsigned(optarg, &config->submit_check_timeout);
+			if (ret < 0) {
+				slurm_error("pyxis: submit_check_timeout: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("use_overlay=", av[i], 12) == 0) {
+			optarg = av[i] + 12;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: use_overlay: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->use_overlay = ret;
+		} else if (strncmp("shared_squashfuse=", av[i], 18) == 0) {
+			optarg = av[i] + 18;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: shared_squashfuse: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->shared_squashfuse = ret;
+		} else if (strncmp("kernel_squashfs=", av[i], 16) == 0) {
+			optarg = av[i] + 16;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: kernel_squashfs: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->kernel_squashfs = ret;
+		} else if (strncmp("job_rootfs=", av[i], 11) == 0) {
+			optarg = av[i] + 11;
+			ret = parse_bool(optarg);
+			if (ret < 0) {
+				slurm_error("pyxis: job_rootfs: invalid value: %s", optarg);
+				return (-1);
+			}
+			config->job_rootfs = ret;
+		} else if (strncmp("squashfs_prewarm=", av[i], 17) == 0) {
+			optarg = av[i] + 17;
+			ret = parse_size(optarg, &config->squashfs_prewarm);
+			if (ret < 0) {
+				slurm_error("pyxis: squashfs_prewarm: invalid value: %s", optarg);
+				return (-1);
+			}
+		} else if (strncmp("squashfs_profile=", av[i], 17) == 0) {
+			optarg = av[i] + 17;
+			ret = parse_unsigned(optarg, &config->squashfs_profile);
+			if (ret < 0) {
+				slurm_error("pyxis: squashfs_profile: invalid value: %s", optarg);
+				return (-1);
+			}
 		} else {
 			slurm_error("pyxis: unknown configuration option: %s", av[i]);
 			return (-1);
 		}
 	}
 
+	if (config->use_overlay && config->cache_path[0] == '\0') {
+		slurm_error("pyxis: use_overlay requires cache_path");
+		return (-1);
+	}
+
+	if (config->shared_squashfuse && (config->cache_path[0] == '\0' || !config->use_squashfuse || !config->prolog_prefetch)) {
+		slurm_error("pyxis: shared_squashfuse requires cache_path, use_squashfuse and prolog_prefetch");
+		return (-1);
+	}
+
+	/* Only images outside of the cache, cached images already share their root filesystem. */
+	if (config->job_rootfs && !config->use_overlay) {
+		slurm_error("pyxis: job_rootfs requires use_overlay");
+		return (-1);
+	}
+
+	if (config->kernel_squashfs && (config->cache_path[0] == '\0' || !config->prolog_prefetch)) {
+		slurm_error("pyxis: kernel_squashfs requires cache_path and prolog_prefetch");
+		return (-1);
+	}
+
+	if (config->prolog_prefetch && config->cache_path[0] == '\0') {
+		slurm_error("pyxis: prolog_prefetch requires cache_path");
+		return (-1);
+	}
+
+	/* Without a low watermark, free 10% of the filesystem when going above the high watermark. */
+	if (config->cache_high_watermark > 0 && config->cache_low_watermark == 0)
+		config->cache_low_watermark = config->cache_high_watermark > 10 ? config->cache_high_watermark - 10 : 0;
+
+	if (config->cache_low_watermark > config->cache_high_watermark) {
+		slurm_error("pyxis: cache_low_watermark must be lower than cache_high_watermark");
+		return (-1);
+	}
+
 	return (0);
 }
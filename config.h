@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020-2025, NVIDIA CORPORATION. All rights reserved.
+ * Copyright (c) 2020-2026, NVIDIA CORPORATION. All rights reserved.
  */
 
 #ifndef CONFIG_H_
@@ -7,24 +7,58 @@
 
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 enum container_scope {
 	SCOPE_JOB,
 	SCOPE_GLOBAL,
 };
 
+enum enroot_load {
+	ENROOT_LOAD_NEVER,
+	ENROOT_LOAD_ALWAYS,
+	ENROOT_LOAD_AUTO,
+};
+
 struct plugin_config {
 	char runtime_path[PATH_MAX];
 	bool execute_entrypoint;
 	enum container_scope container_scope;
 	bool sbatch_support;
-	bool use_enroot_load;
+	enum enroot_load use_enroot_load;
 	char importer_path[PATH_MAX];
 	bool use_squashfuse;
+	char cache_path[PATH_MAX];
+	uint64_t cache_max_size;
+	bool importer_single_flight;
+	unsigned int digest_ttl;
+	bool prolog_prefetch;
+	bool pin_digest;
+	unsigned int importer_protocol;
+	char staging_path[PATH_MAX];
+	unsigned int staging_timeout;
+	unsigned int max_concurrent_imports;
+	char scratch_path[PATH_MAX];
+	uint64_t scratch_min_free;
+	unsigned int cache_high_watermark;
+	unsigned int cache_low_watermark;
+	bool cache_chunks;
+	bool submit_check;
+	unsigned int submit_check_timeout;
+	bool use_overlay;
+	bool shared_squashfuse;
+	bool kernel_squashfs;
+	bool job_rootfs;
+	uint64_t squashfs_prewarm;
+	unsigned int squashfs_profile;
 };
 
 int pyxis_config_parse(struct plugin_config *config, int ac, char **av);
 
 int parse_bool(const char *s);
 
+int parse_size(const char *s, uint64_t *size);
+
+int parse_unsigned(const char *s, unsigned int *value);
+
 #endif /* CONFIG_H_ */
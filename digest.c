@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "digest.h"
+#include "common.h"
+#include "lock.h"
+
+/*
+ * Node-local map of image URIs to digests, one file per user: <runtime_path>/<uid>/digests
+ * Each line is: <resolution time> <digest> <URI>
+ *
+ * The map is read and updated with the credentials of the user, in the per-user runtime directory.
+ *
+ * Registry credentials are per-user, so the same URI might resolve differently for two users.
+ */
+
+bool digest_valid(const char *digest)
+{
+	size_t len;
+
+	len = strlen(digest);
+	if (len == 0 || len > DIGEST_MAX)
+		return (false);
+
+	/* The digest is used as a file name, it must be of the form "algorithm:hex". */
+	if (digest[0] == '.' || strchr(digest, ':') == NULL)
+		return (false);
+
+	return (strspn(digest, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789:_.-") == len);
+}
+
+/*
+ * Name of a directory derived from a digest. The directories are used as lower directories of
+ * fuse-overlayfs, where ':' separates directories.
+ */
+int digest_dir_name(const char *digest, char (*name)[NAME_MAX + 1])
+{
+	int ret;
+	char *p;
+
+	if (!digest_valid(digest))
+		return (-1);
+
+	ret = snprintf(*name, sizeof(*name), "%s", digest);
+	if (ret < 0 || ret >= sizeof(*name))
+		return (-1);
+
+	while ((p = strchr(*name, ':')) != NULL)
+		*p = '_';
+
+	return (0);
+}
+
+/* If the URI is already pinned to a digest (IMAGE@DIGEST), return a copy of the digest. */
+char *digest_from_uri(const char *uri)
+{
+	const char *p;
+
+	p = strrchr(uri, '@');
+	if (p == NULL || strchr(p, '#') != NULL || strchr(p, '/') != NULL)
+		return (NULL);
+
+	if (!digest_valid(p + 1))
+		return (NULL);
+
+	return (strdup(p + 1));
+}
+
+/* Pin the URI to the given digest, in case the tag is moved while we are importing. */
+int digest_pin_uri(const char *uri, const char *digest, char **pinned)
+{
+	int ret;
+	size_t len, digest_len;
+
+	len = strlen(uri);
+	digest_len = strlen(digest);
+	if (len > digest_len && uri[len - digest_len - 1] == '@' && strcmp(uri + len - digest_len, digest) == 0)
+		ret = xasprintf(pinned, "%s", uri);
+	else
+		ret = xasprintf(pinned, "%s@%s", uri, digest);
+	if (ret < 0)
+		return (-1);
+
+	return (0);
+}
+
+static int digest_cache_path(const struct plugin_config *config, uid_t uid, char (*path)[PATH_MAX])
+{
+	int ret;
+
+	ret = snprintf(*path, sizeof(*path), "%s/%u/digests", config->runtime_path, uid);
+	if (ret < 0 || ret >= sizeof(*path))
+		return (-1);
+
+	return (0);
+}
+
+/* Parse a line of the map file, returns true if it is an entry for the given URI. */
+static bool digest_cache_parse(char *line, const char *uri, time_t *resolved, char **digest)
+{
+	char *saveptr = NULL;
+	char *time_str, *digest_str, *uri_str;
+	long long n;
+
+	time_str = strtok_r(line, " ", &saveptr);
+	digest_str = strtok_r(NULL, " ", &saveptr);
+	uri_str = strtok_r(NULL, "", &saveptr);
+	if (time_str == NULL || digest_str == NULL || uri_str == NULL)
+		return (false);
+
+	if (strcmp(uri_str, uri) != 0 || !digest_valid(digest_str))
+		return (false);
+
+	errno = 0;
+	n = strtoll(time_str, NULL, 10);
+	if (errno != 0)
+		return (false);
+
+	*resolved = n;
+	*digest = digest_str;
+
+	return (true);
+}
+
+/*
+ * Returns -1 if an error occurs.
+ * Returns 0 if the URI is not in the map.
+ * Returns 1 and sets *digest if the URI is in the map, *stale is set if the entry is older than digest_ttl.
+ */
+int digest_cache_lookup(const struct plugin_config *config, uid_t uid, const char *uri, char **digest, bool *stale)
+{
+	int ret;
+	char path[PATH_MAX];
+	FILE *fp;
+	char *line;
+	char *p;
+	time_t resolved;
+	int rv = 0;
+
+	*digest = NULL;
+	*stale = false;
+
+	ret = digest_cache_path(config, uid, &path);
+	if (ret < 0)
+		return (-1);
+
+	fp = fopen(path, "re");
+	if (fp == NULL) {
+		if (errno == ENOENT)
+			return (0);
+		slurm_error("pyxis: couldn't open %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	while (rv == 0 && (line = get_line_from_file(fp)) != NULL) {
+		if (digest_cache_parse(line, uri, &resolved, &p)) {
+			*digest = strdup(p);
+			if (*digest == NULL)
+				rv = -1;
+			else
+				rv = 1;
+			*stale = (time(NULL) - resolved) >= (time_t)config->digest_ttl;
+		}
+		free(line);
+	}
+
+	fclose(fp);
+
+	return (rv);
+}
+
+int digest_cache_update(const struct plugin_config *config, uid_t uid, const char *uri, const char *digest)
+{
+	int ret;
+	int lock_fd = -1;
+	int fd = -1;
+	pid_t owner;
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	FILE *in = NULL;
+	FILE *out = NULL;
+	char *line, *copy;
+	char *p;
+	time_t resolved;
+	int rv = -1;
+
+	if (!digest_valid(digest) || strchr(uri, '\n') != NULL)
+		return (-1);
+
+	ret = digest_cache_path(config, uid, &path);
+	if (ret < 0)
+		return (-1);
+
+	ret = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if (ret < 0 || ret >= sizeof(tmp_path))
+		return (-1);
+
+	lock_fd = lock_acquire(config, "digests", uid, "", &owner);
+	if (lock_fd < 0)
+		return (-1);
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto fail;
+
+	out = fdopen(fd, "w");
+	if (out == NULL)
+		goto fail;
+	fd = -1;
+
+	/* Copy all the other entries, then append the new one. */
+	in = fopen(path, "re");
+	if (in == NULL && errno != ENOENT)
+		goto fail;
+
+	while (in != NULL && (line = get_line_from_file(in)) != NULL) {
+		copy = strdup(line);
+		if (copy == NULL) {
+			free(line);
+			goto fail;
+		}
+
+		if (!digest_cache_parse(copy, uri, &resolved, &p))
+			fprintf(out, "%s\n", line);
+
+		free(copy);
+		free(line);
+	}
+
+	fprintf(out, "%lld %s %s\n", (long long)time(NULL), digest, uri);
+
+	ret = ferror(out);
+	if (fclose(out) != 0 || ret != 0) {
+		out = NULL;
+		goto fail;
+	}
+	out = NULL;
+
+	ret = rename(tmp_path, path);
+	if (ret < 0)
+		goto fail;
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		slurm_error("pyxis: couldn't update %s: %s", path, strerror(errno));
+		unlink(tmp_path);
+	}
+	if (in != NULL)
+		fclose(in);
+	if (out != NULL)
+		fclose(out);
+	xclose(fd);
+	lock_release(lock_fd);
+
+	return (rv);
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef DIGEST_H_
+#define DIGEST_H_
+
+#include <limits.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+#define DIGEST_MAX 127
+
+bool digest_valid(const char *digest);
+
+int digest_dir_name(const char *digest, char (*name)[NAME_MAX + 1]);
+
+char *digest_from_uri(const char *uri);
+
+int digest_pin_uri(const char *uri, const char *digest, char **pinned);
+
+int digest_cache_lookup(const struct plugin_config *config, uid_t uid, const char *uri, char **digest, bool *stale);
+
+int digest_cache_update(const struct plugin_config *config, uid_t uid, const char *uri, const char *digest);
+
+#endif /* DIGEST_H_ */
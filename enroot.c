@@ -16,64 +16,117 @@
 #include "enroot.h"
 #include "common.h"
 
-pid_t enroot_exec(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
-		  int log_fd, child_cb callback, char *const argv[])
+/* Exit code of the child if enroot couldn't be executed, like a shell for a missing command. */
+#define ENROOT_EXEC_FAILURE 127
+
+/*
+ * In the child, report errno to the parent before exiting. enroot, or a hook that it runs, can exit
+ * with ENROOT_EXEC_FAILURE too: only the pipe tells that the command was never executed.
+ */
+static void __attribute__((noreturn)) enroot_exec_fail(int err_fd)
+{
+	int err = errno;
+	ssize_t n;
+
+	/* The parent reports a short write as a command that ran and failed. */
+	n = write(err_fd, &err, sizeof(err));
+	(void)n;
+
+	_exit(ENROOT_EXEC_FAILURE);
+}
+
+/*
+ * Returns the pid of the child once the command is executed.
+ * Returns -1 with errno set if the command couldn't be executed, the child is already waited for.
+ */
+static pid_t enroot_exec_fds(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
+			     int stdout_fd, int stderr_fd, child_cb callback, char *const argv[])
 {
 	int ret;
 	int null_fd = -1;
-	int target_fd = -1;
 	int oom_score_fd = -1;
+	int err_fds[2] = { -1, -1 };
+	int err_fd;
+	int err;
+	ssize_t n;
 	pid_t pid;
 	char *argv_str;
 
 	argv_str = join_strings(argv, " ");
 	if (argv_str != NULL) {
-		slurm_verbose("pyxis: running enroot command: \"%s\"", argv_str);
+		slurm_verbose("pyxis: running %s command: \"%s\"", argv[0], argv_str);
 		free(argv_str);
 	}
 
+	/* Closed by a successful execvpe(), the child writes errno to it otherwise. */
+	if (pipe2(err_fds, O_CLOEXEC) < 0) {
+		slurm_error("pyxis: could not create pipe: %s", strerror(errno));
+		return (-1);
+	}
+
 	pid = fork();
 	if (pid < 0) {
 		slurm_error("pyxis: fork error: %s", strerror(errno));
+		close(err_fds[0]);
+		close(err_fds[1]);
 		return (-1);
 	}
 
 	if (pid == 0) {
+		close(err_fds[0]);
+		err_fd = err_fds[1];
+
+		/* Out of the standard fd range (0-2) too, see below. */
+		if (err_fd <= 2) {
+			err_fd = fcntl(err_fd, F_DUPFD_CLOEXEC, 3);
+			if (err_fd < 0)
+				_exit(ENROOT_EXEC_FAILURE);
+			close(err_fds[1]);
+		}
+
+		/* Let the parent signal all the processes spawned by enroot when the step is cancelled. */
+		if (child_new_process_group(0) < 0)
+			enroot_exec_fail(err_fd);
+
 		/*
-		 * Move log_fd out of the standard fd range (0-2) if needed.
+		 * Move the output fds out of the standard fd range (0-2) if needed.
 		 * In some contexts (e.g. SPANK epilog), fd 0 is not open,
 		 * so memfd_create can return fd 0. Without this, the dup2
-		 * to STDIN_FILENO below would clobber log_fd.
+		 * to STDIN_FILENO below would clobber the output fds.
 		 */
-		if (log_fd >= 0 && log_fd <= 2) {
-			int new_fd = fcntl(log_fd, F_DUPFD_CLOEXEC, 3);
+		if (stdout_fd >= 0 && stdout_fd <= 2) {
+			int new_fd = fcntl(stdout_fd, F_DUPFD_CLOEXEC, 3);
 			if (new_fd < 0)
-				_exit(EXIT_FAILURE);
-			close(log_fd);
-			log_fd = new_fd;
+				enroot_exec_fail(err_fd);
+			if (stderr_fd == stdout_fd)
+				stderr_fd = new_fd;
+			close(stdout_fd);
+			stdout_fd = new_fd;
+		}
+		if (stderr_fd != stdout_fd && stderr_fd >= 0 && stderr_fd <= 2) {
+			int new_fd = fcntl(stderr_fd, F_DUPFD_CLOEXEC, 3);
+			if (new_fd < 0)
+				enroot_exec_fail(err_fd);
+			close(stderr_fd);
+			stderr_fd = new_fd;
 		}
 
 		null_fd = open("/dev/null", O_RDWR);
 		if (null_fd < 0)
-			_exit(EXIT_FAILURE);
+			enroot_exec_fail(err_fd);
 
 		ret = dup2(null_fd, STDIN_FILENO);
 		if (ret < 0)
-			_exit(EXIT_FAILURE);
-
-		/* Redirect stdout/stderr to the log file or /dev/null */
-		if (log_fd >= 0)
-			target_fd = log_fd;
-		else
-			target_fd = null_fd;
+			enroot_exec_fail(err_fd);
 
-		ret = dup2(target_fd, STDOUT_FILENO);
+		/* Redirect stdout/stderr to the given files or /dev/null */
+		ret = dup2(stdout_fd >= 0 ? stdout_fd : null_fd, STDOUT_FILENO);
 		if (ret < 0)
-			_exit(EXIT_FAILURE);
+			enroot_exec_fail(err_fd);
 
-		ret = dup2(target_fd, STDERR_FILENO);
+		ret = dup2(stderr_fd >= 0 ? stderr_fd : null_fd, STDERR_FILENO);
 		if (ret < 0)
-			_exit(EXIT_FAILURE);
+			enroot_exec_fail(err_fd);
 
 		/*
 		 * Attempt to set oom_score_adj to 0, as it's often set to -1000 (OOM killing
@@ -85,42 +138,69 @@ pid_t enroot_exec(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
 			close(oom_score_fd);
 		}
 
-		if (close_extra_fds() < 0)
-			_exit(EXIT_FAILURE);
+		if (close_extra_fds_except(err_fd) < 0)
+			enroot_exec_fail(err_fd);
 
 		if (geteuid() == 0) {
 			ret = setgroups(ngids, gids);
 			if (ret < 0)
-				_exit(EXIT_FAILURE);
+				enroot_exec_fail(err_fd);
 		}
 
 		ret = setregid(gid, gid);
 		if (ret < 0)
-			_exit(EXIT_FAILURE);
+			enroot_exec_fail(err_fd);
 
 		ret = setreuid(uid, uid);
 		if (ret < 0)
-			_exit(EXIT_FAILURE);
+			enroot_exec_fail(err_fd);
 
 		if (callback != NULL) {
 			ret = callback();
 			if (ret < 0)
-				_exit(EXIT_FAILURE);
+				enroot_exec_fail(err_fd);
 		}
 
-		execvpe("enroot", argv, environ);
+		/* Usually "enroot", or one of the FUSE helpers that enroot also relies on. */
+		execvpe(argv[0], argv, environ);
 
-		_exit(EXIT_FAILURE);
+		enroot_exec_fail(err_fd);
+	}
+
+	(void)child_new_process_group(pid);
+
+	close(err_fds[1]);
+	do {
+		n = read(err_fds[0], &err, sizeof(err));
+	} while (n < 0 && errno == EINTR);
+	close(err_fds[0]);
+
+	if (n == sizeof(err)) {
+		slurm_error("pyxis: couldn't execute %s: %s", argv[0], strerror(err));
+		while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+		errno = err;
+		return (-1);
 	}
 
 	return (pid);
 }
 
-static int child_wait(pid_t pid)
+pid_t enroot_exec(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
+		  int log_fd, child_cb callback, char *const argv[])
+{
+	return enroot_exec_fds(uid, gid, ngids, gids, log_fd, log_fd, callback, argv);
+}
+
+static int child_wait(pid_t pid, unsigned int timeout)
 {
 	int status;
 
-	status = child_wait_for_pid(pid);
+	status = child_wait_for_pid_timeout(pid, timeout);
+	if (status < 0 && errno == ETIMEDOUT) {
+		slurm_error("pyxis: child %d killed after %u seconds", pid, timeout);
+		errno = ETIMEDOUT;
+		return (-1);
+	}
 	if (status < 0) {
 		slurm_error("pyxis: could not wait for child %d: %s", pid, strerror(errno));
 		return (-1);
@@ -128,11 +208,14 @@ static int child_wait(pid_t pid)
 
 	if (WIFSIGNALED(status)) {
 		slurm_error("pyxis: child %d terminated with signal %d", pid, WTERMSIG(status));
+		errno = EINTR;
 		return (-1);
 	}
 
+	/* The command ran and failed, enroot_exec_fds() reports the commands that couldn't be executed. */
 	if (WIFEXITED(status) && (status = WEXITSTATUS(status)) != 0) {
 		slurm_error("pyxis: child %d failed with error code: %d", pid, status);
+		errno = 0;
 		return (-1);
 	}
 
@@ -149,7 +232,7 @@ int enroot_exec_wait(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
 	if (child < 0)
 		return (-1);
 
-	ret = child_wait(child);
+	ret = child_wait(child, 0);
 	if (ret < 0)
 		return (-1);
 
@@ -194,3 +277,110 @@ fail:
 
 	return (fp);
 }
+
+/*
+ * With a timeout, the command is killed after timeout seconds and errno is set to ETIMEDOUT. If the
+ * command ran and exited with an error, errno is set to 0.
+ */
+int enroot_exec_read_line_timeout(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
+				  child_cb callback, char *const argv[], unsigned int timeout, char **line)
+{
+	int ret;
+	int log_fd = -1;
+	int out_fd = -1;
+	pid_t child;
+	FILE *fp = NULL;
+	int err = EINVAL;
+	int rv = -1;
+
+	*line = NULL;
+
+	log_fd = pyxis_memfd_create("enroot-log", MFD_CLOEXEC);
+	if (log_fd < 0) {
+		slurm_error("pyxis: couldn't create in-memory log file: %s", strerror(errno));
+		goto fail;
+	}
+
+	out_fd = pyxis_memfd_create("enroot-output", MFD_CLOEXEC);
+	if (out_fd < 0) {
+		slurm_error("pyxis: couldn't create in-memory output file: %s", strerror(errno));
+		goto fail;
+	}
+
+	child = enroot_exec_fds(uid, gid, ngids, gids, out_fd, log_fd, callback, argv);
+	if (child < 0) {
+		err = ENOEXEC;
+		goto fail;
+	}
+
+	ret = child_wait(child, timeout);
+	if (ret < 0) {
+		err = errno;
+		slurm_error("pyxis: couldn't execute enroot command");
+		memfd_print_log(&log_fd, true, "enroot");
+		goto fail;
+	}
+
+	ret = lseek(out_fd, 0, SEEK_SET);
+	if (ret < 0) {
+		slurm_error("pyxis: couldn't rewind output file: %s", strerror(errno));
+		goto fail;
+	}
+
+	fp = fdopen(out_fd, "r");
+	if (fp == NULL) {
+		slurm_error("pyxis: couldn't open in-memory output file: %s", strerror(errno));
+		goto fail;
+	}
+	out_fd = -1;
+
+	*line = get_line_from_file(fp);
+	if (*line == NULL || **line == '\0') {
+		slurm_error("pyxis: enroot command did not produce any output");
+		memfd_print_log(&log_fd, true, "enroot");
+		free(*line);
+		*line = NULL;
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	if (fp != NULL)
+		fclose(fp);
+	xclose(out_fd);
+	xclose(log_fd);
+
+	/* See child_wait(), EINVAL if the command didn't print anything. */
+	if (rv < 0)
+		errno = err;
+
+	return (rv);
+}
+
+int enroot_exec_read_line(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
+			  child_cb callback, char *const argv[], char **line)
+{
+	return enroot_exec_read_line_timeout(uid, gid, ngids, gids, callback, argv, 0, line);
+}
+
+/* Convert the argument of --container-image to an enroot URI. */
+int enroot_image_uri(const char *image, char **uri)
+{
+	int ret;
+
+	if (strncmp("docker://", image, sizeof("docker://") - 1) == 0 ||
+	    strncmp("dockerd://", image, sizeof("dockerd://") - 1) == 0) {
+		*uri = strdup(image);
+		if (*uri == NULL)
+			return (-1);
+		return (0);
+	}
+
+	/* Assume `image` is an enroot URI for a docker image. */
+	ret = xasprintf(uri, "docker://%s", image);
+	if (ret < 0)
+		return (-1);
+
+	return (0);
+}
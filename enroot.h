@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ * Copyright (c) 2020-2026, NVIDIA CORPORATION. All rights reserved.
  */
 
 #ifndef ENROOT_H_
@@ -20,4 +20,12 @@ int enroot_exec_wait(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
 FILE *enroot_exec_output(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
 			 child_cb callback, char *const argv[]);
 
+int enroot_exec_read_line(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
+			  child_cb callback, char *const argv[], char **line);
+
+int enroot_exec_read_line_timeout(uid_t uid, gid_t gid, int ngids, const gid_t *gids,
+				  child_cb callback, char *const argv[], unsigned int timeout, char **line);
+
+int enroot_image_uri(const char *image, char **uri);
+
 #endif /* ENROOT_H_ */
@@ -2,12 +2,16 @@
  * Copyright (c) 2025-2026, NVIDIA CORPORATION. All rights reserved.
  */
 
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,7 +47,119 @@ static int importer_child_wait(pid_t pid, int *log_fd, const char *cmd)
 	return (0);
 }
 
-static pid_t importer_exec(const char *importer_path, uid_t uid, gid_t gid,
+/* Environment variables forwarded to the importer daemon, the rest of the job environment is not sent. */
+static const char *importer_socket_env[] = {
+	"SLURM_JOB_ID",
+	"SLURM_STEP_ID",
+	"PYXIS_VERSION",
+	"PYXIS_IMAGE_DIGEST",
+	NULL
+};
+
+bool importer_is_socket(const char *importer_path)
+{
+	return (strncmp(importer_path, IMPORTER_SOCKET_PREFIX, sizeof(IMPORTER_SOCKET_PREFIX) - 1) == 0);
+}
+
+/*
+ * Send a request to the importer daemon and translate the response to the output of an importer
+ * executable: the result on stdout and the log on stderr.
+ * Runs in the forked child, after dropping privileges, so the daemon gets the job credentials
+ * with SO_PEERCRED.
+ */
+static int importer_socket_request(const char *socket_path, unsigned int protocol, char *const argv[])
+{
+	int ret;
+	int fd = -1;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	const char *value;
+	FILE *fp = NULL;
+	char *line = NULL;
+	int rv = -1;
+
+	/* Report a daemon closing the connection early as an error, not as a signal. */
+	signal(SIGPIPE, SIG_IGN);
+
+	ret = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+	if (ret < 0 || ret >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "importer socket path too long: %s\n", socket_path);
+		goto fail;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "couldn't create socket: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+	if (ret < 0) {
+		fprintf(stderr, "couldn't connect to importer daemon at %s: %s\n", socket_path, strerror(errno));
+		goto fail;
+	}
+
+	dprintf(fd, "pyxis-importer %u\n", protocol);
+	for (int i = 0; importer_socket_env[i] != NULL; ++i) {
+		value = getenv(importer_socket_env[i]);
+		if (value != NULL && strchr(value, '\n') == NULL)
+			dprintf(fd, "env %s=%s\n", importer_socket_env[i], value);
+	}
+	if (argv[2] != NULL)
+		ret = dprintf(fd, "%s %s\n", argv[1], argv[2]);
+	else
+		ret = dprintf(fd, "%s\n", argv[1]);
+	if (ret < 0 || shutdown(fd, SHUT_WR) < 0) {
+		fprintf(stderr, "couldn't send request to importer daemon: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	fp = fdopen(fd, "r");
+	if (fp == NULL)
+		goto fail;
+	fd = -1;
+
+	while ((line = get_line_from_file(fp)) != NULL) {
+		if (strncmp(line, "log ", 4) == 0) {
+			fprintf(stderr, "%s\n", line + 4);
+		} else if (protocol >= 2 && strncmp(line, "progress ", 9) == 0) {
+			printf("%s\n", line);
+			fflush(stdout);
+		} else if (protocol >= 2 && strncmp(line, "result ", 7) == 0) {
+			printf("%s\n", line);
+			rv = 0;
+			break;
+		} else if (strcmp(line, "ok") == 0 || strncmp(line, "ok ", 3) == 0) {
+			if (line[2] != '\0')
+				printf("%s\n", line + 3);
+			rv = 0;
+			break;
+		} else if (strncmp(line, "error ", 6) == 0) {
+			fprintf(stderr, "%s\n", line + 6);
+			break;
+		} else {
+			fprintf(stderr, "invalid response from importer daemon: %s\n", line);
+			break;
+		}
+
+		free(line);
+		line = NULL;
+	}
+
+	if (line == NULL && rv < 0)
+		fprintf(stderr, "importer daemon closed the connection\n");
+
+fail:
+	free(line);
+	if (fp != NULL)
+		fclose(fp);
+	xclose(fd);
+	fflush(stdout);
+	fflush(stderr);
+
+	return (rv);
+}
+
+static pid_t importer_exec(const char *importer_path, unsigned int protocol, uid_t uid, gid_t gid,
 			   int ngids, const gid_t *gids,
 			   int stdout_fd, int stderr_fd, child_cb callback, char *const argv[])
 {
@@ -66,6 +182,10 @@ static pid_t importer_exec(const char *importer_path, uid_t uid, gid_t gid,
 	}
 
 	if (pid == 0) {
+		/* Let the parent signal all the processes spawned by importer when the step is cancelled. */
+		if (child_new_process_group(0) < 0)
+			_exit(EXIT_FAILURE);
+
 		/*
 		 * Move fds out of the standard range (0-2) if needed.
 		 */
@@ -131,17 +251,106 @@ static pid_t importer_exec(const char *importer_path, uid_t uid, gid_t gid,
 				_exit(EXIT_FAILURE);
 		}
 
+		if (protocol >= 2) {
+			char buf[16];
+
+			snprintf(buf, sizeof(buf), "%u", protocol);
+			ret = setenv("PYXIS_IMPORTER_PROTOCOL", buf, 1);
+			if (ret < 0)
+				_exit(EXIT_FAILURE);
+		}
+
+		if (importer_is_socket(importer_path)) {
+			ret = importer_socket_request(importer_path + sizeof(IMPORTER_SOCKET_PREFIX) - 1, protocol, argv);
+			_exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+
 		execve(importer_path, argv, environ);
 		_exit(EXIT_FAILURE);
 	}
 
+	(void)child_new_process_group(pid);
+
 	return (pid);
 }
 
+/* Decode the "%XX" sequences of a record value in place, e.g. "%20" for a space. */
+static void importer_record_decode(char *value)
+{
+	char *out = value;
+	unsigned int c;
+
+	while (*value != '\0') {
+		if (value[0] == '%' && isxdigit((unsigned char)value[1]) && isxdigit((unsigned char)value[2]) &&
+		    sscanf(value + 1, "%2x", &c) == 1) {
+			*out++ = c;
+			value += 3;
+		} else {
+			*out++ = *value++;
+		}
+	}
+	*out = '\0';
+}
+
+/* Returns a decoded copy of the value of key in a "key=value key=value ..." record. */
+static char *importer_record_value(const char *record, const char *key)
+{
+	size_t key_len = strlen(key);
+	const char *p = record;
+	char *value;
+
+	while (*p != '\0') {
+		p += strspn(p, " ");
+		if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+			value = strndup(p + key_len + 1, strcspn(p + key_len + 1, " "));
+			if (value != NULL)
+				importer_record_decode(value);
+			return (value);
+		}
+		p += strcspn(p, " ");
+	}
+
+	return (NULL);
+}
+
+/*
+ * Protocol v2: the importer writes "progress" records while it runs, and a final "result" record
+ * with the squashfs path and metadata. Returns the squashfs path, and the result record in *result.
+ */
+static char *importer_read_records(FILE *fp, char **result)
+{
+	char *line;
+	char *record = NULL;
+	char *path = NULL;
+
+	/* Read until EOF, the importer must not block on a full pipe. */
+	while ((line = get_line_from_file(fp)) != NULL) {
+		if (strncmp(line, "progress ", 9) == 0) {
+			slurm_verbose("pyxis: importer progress: %s", line + 9);
+		} else if (strncmp(line, "result ", 7) == 0) {
+			free(record);
+			record = strdup(line + 7);
+		} else {
+			slurm_info("pyxis: ignoring invalid importer record: %s", line);
+		}
+		free(line);
+	}
+
+	if (record == NULL)
+		return (NULL);
 
-int importer_exec_get(const char *importer_path, uid_t uid, gid_t gid,
+	path = importer_record_value(record, "path");
+	if (path == NULL || result == NULL)
+		free(record);
+	else
+		*result = record;
+
+	return (path);
+}
+
+int importer_exec_get(const char *importer_path, unsigned int protocol, uid_t uid, gid_t gid,
 		      int ngids, const gid_t *gids,
-		      child_cb callback, const char *image_uri, char **squashfs_path)
+		      child_cb callback, const char *image_uri, char **squashfs_path, char **result)
 {
 	char *argv[4];
 	int log_fd = -1;
@@ -150,6 +359,9 @@ int importer_exec_get(const char *importer_path, uid_t uid, gid_t gid,
 	FILE *pipe_file = NULL;
 	char *line = NULL;
 
+	if (result != NULL)
+		*result = NULL;
+
 	log_fd = pyxis_memfd_create("importer-log", MFD_CLOEXEC);
 	if (log_fd < 0) {
 		slurm_error("pyxis: couldn't create in-memory log file: %s", strerror(errno));
@@ -168,7 +380,7 @@ int importer_exec_get(const char *importer_path, uid_t uid, gid_t gid,
 	argv[2] = (char *)image_uri;
 	argv[3] = NULL;
 
-	child = importer_exec(importer_path, uid, gid, ngids, gids, pipe_fds[1], log_fd, callback, argv);
+	child = importer_exec(importer_path, protocol, uid, gid, ngids, gids, pipe_fds[1], log_fd, callback, argv);
 	xclose(pipe_fds[1]);  /* Close write end in parent */
 
 	if (child < 0) {
@@ -187,23 +399,21 @@ int importer_exec_get(const char *importer_path, uid_t uid, gid_t gid,
 	}
 
 	/* Read the squashfs path from stdout */
-	line = get_line_from_file(pipe_file);
+	if (protocol >= 2)
+		line = importer_read_records(pipe_file, result);
+	else
+		line = get_line_from_file(pipe_file);
 	fclose(pipe_file);  /* This also closes pipe_fds[0] */
 
 	/* Wait for child to complete */
-	if (importer_child_wait(child, &log_fd, "get") < 0) {
-		free(line);
-		xclose(log_fd);
-		return (-1);
-	}
+	if (importer_child_wait(child, &log_fd, "get") < 0)
+		goto fail;
 
 	/* Validate we got a path */
 	if (line == NULL || strlen(line) == 0) {
 		slurm_error("pyxis: importer did not return a squashfs path");
 		memfd_print_log(&log_fd, true, "importer");
-		free(line);
-		xclose(log_fd);
-		return (-1);
+		goto fail;
 	}
 
 	/* Return the path */
@@ -214,9 +424,19 @@ int importer_exec_get(const char *importer_path, uid_t uid, gid_t gid,
 	xclose(log_fd);
 
 	return (0);
+
+fail:
+	if (result != NULL) {
+		free(*result);
+		*result = NULL;
+	}
+	free(line);
+	xclose(log_fd);
+
+	return (-1);
 }
 
-int importer_exec_release(const char *importer_path, uid_t uid, gid_t gid,
+int importer_exec_release(const char *importer_path, unsigned int protocol, uid_t uid, gid_t gid,
 			  int ngids, const gid_t *gids,
 			  child_cb callback)
 {
@@ -235,7 +455,7 @@ int importer_exec_release(const char *importer_path, uid_t uid, gid_t gid,
 	argv[1] = "release";
 	argv[2] = NULL;
 
-	child = importer_exec(importer_path, uid, gid, ngids, gids, log_fd, log_fd, callback, argv);
+	child = importer_exec(importer_path, protocol, uid, gid, ngids, gids, log_fd, log_fd, callback, argv);
 	if (child < 0) {
 		xclose(log_fd);
 		return (-1);
@@ -7,13 +7,19 @@
 
 #include <stdbool.h>
 
+/* importer=unix:PATH connects to an importer daemon instead of running an executable. */
+#define IMPORTER_SOCKET_PREFIX "unix:"
+#define IMPORTER_PROTOCOL_MAX 2
+
 typedef int (*child_cb)(void);
 
-int importer_exec_get(const char *importer_path, uid_t uid, gid_t gid,
+bool importer_is_socket(const char *importer_path);
+
+int importer_exec_get(const char *importer_path, unsigned int protocol, uid_t uid, gid_t gid,
 		      int ngids, const gid_t *gids,
-		      child_cb callback, const char *image_uri, char **squashfs_path);
+		      child_cb callback, const char *image_uri, char **squashfs_path, char **result);
 
-int importer_exec_release(const char *importer_path, uid_t uid, gid_t gid,
+int importer_exec_release(const char *importer_path, unsigned int protocol, uid_t uid, gid_t gid,
 			  int ngids, const gid_t *gids,
 			  child_cb callback);
 
@@ -10,6 +10,24 @@ readonly squashfs_temp_path="${cache_dir}/${SLURM_JOB_ID}.${SLURM_STEP_ID}.sqsh"
 # Since it's not an ephemeral squashfs file, we can use compression.
 export ENROOT_SQUASH_OPTIONS="-comp zstd -Xcompression-level 3 -b 1M"
 
+# Protocol v2: write progress records on stdout.
+function progress() {
+    if [ "${PYXIS_IMPORTER_PROTOCOL:-1}" -ge 2 ]; then
+        echo "progress $*"
+    fi
+}
+
+# Protocol v2: percent-encode a record value, it can't contain spaces.
+function encode() {
+    local value="${1//%/%25}"
+    value="${value// /%20}"
+    printf '%s' "${value//$'\n'/%0A}"
+}
+
+function now_ms() {
+    date +%s%3N
+}
+
 case "${cmd}" in
     get)
         if [ $# -ne 2 ]; then
@@ -21,7 +39,12 @@ case "${cmd}" in
 
         mkdir -p -m 700 "${cache_dir}"
 
-        readonly digest=$(enroot digest "${image_uri}")
+        readonly start_ms=$(now_ms)
+        cache_hit=1
+        import_ms=0
+
+        progress phase=digest
+        readonly digest=${PYXIS_IMAGE_DIGEST:-$(enroot digest "${image_uri}")}
         if [ -z "${digest}" ]; then
             echo "error: could not retrieve digest for image: ${image_uri}" >&2
             exit 1
@@ -29,6 +52,9 @@ case "${cmd}" in
         readonly squashfs_path="${cache_dir}/${digest}.sqsh"
 
         if [ ! -e "${squashfs_path}" ]; then
+            cache_hit=0
+            progress phase=import
+            import_start_ms=$(now_ms)
             if [[ "${image_uri}" == *"@${digest}" ]]; then
                 # URI already has the digest in it.
                 enroot import --output "${squashfs_temp_path}" "${image_uri}" >&2
@@ -42,11 +68,19 @@ case "${cmd}" in
                 setfattr -n user.image_uri -v "${image_uri}" "${squashfs_temp_path}"
             fi
 
+            progress phase=import bytes=$(stat -c %s "${squashfs_temp_path}")
+
             mv -n "${squashfs_temp_path}" "${squashfs_path}"
+            import_ms=$(( $(now_ms) - import_start_ms ))
         fi
 
         # Output the squashfs path on stdout for pyxis to read
-        echo "${squashfs_path}"
+        if [ "${PYXIS_IMPORTER_PROTOCOL:-1}" -ge 2 ]; then
+            echo "result path=$(encode "${squashfs_path}") digest=${digest} size=$(stat -c %s "${squashfs_path}")" \
+                 "cache_hit=${cache_hit} import_ms=${import_ms} total_ms=$(( $(now_ms) - start_ms ))"
+        else
+            echo "${squashfs_path}"
+        fi
         ;;
     release)
         if [ $# -ne 1 ]; then
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+#
+# Reference implementation of an importer daemon for pyxis (importer=unix:PATH).
+#
+# The daemon caches imported images by digest, per user, and deduplicates concurrent imports of the
+# same image. With --stand-in DIR, images are served from pre-built squashfs files instead of a
+# registry, which is useful to test the protocol.
+
+import argparse
+import grp
+import os
+import pwd
+import re
+import socket
+import socketserver
+import struct
+import subprocess
+import sys
+import threading
+import time
+import urllib.parse
+
+PROTOCOL_VERSIONS = (1, 2)
+
+
+class RequestError(Exception):
+    pass
+
+
+class Importer:
+    def __init__(self, cache_dir, stand_in=None):
+        self.cache_dir = cache_dir
+        self.stand_in = stand_in
+        self.lock = threading.Lock()
+        self.in_flight = {}
+        self.refs = {}
+
+    def user_dir(self, uid, gid):
+        path = os.path.join(self.cache_dir, str(uid))
+        try:
+            os.mkdir(path, 0o700)
+            if os.geteuid() == 0:
+                os.chown(path, uid, gid)
+        except FileExistsError:
+            pass
+        return path
+
+    def run_as(self, uid, gid, argv, log):
+        user = pwd.getpwuid(uid)
+        env = {
+            "PATH": "/usr/local/bin:/usr/bin:/bin",
+            "HOME": user.pw_dir,
+            "USER": user.pw_name,
+        }
+        kwargs = {}
+        if os.geteuid() == 0:
+            groups = [g.gr_gid for g in grp.getgrall() if user.pw_name in g.gr_mem]
+            kwargs = {"user": uid, "group": gid, "extra_groups": groups}
+
+        proc = subprocess.run(argv, env=env, stdin=subprocess.DEVNULL, capture_output=True, text=True, **kwargs)
+        for line in proc.stderr.splitlines():
+            log(line)
+        if proc.returncode != 0:
+            raise RequestError("command failed with exit code {}: {}".format(proc.returncode, " ".join(argv)))
+        return proc.stdout.strip()
+
+    def fetch(self, uid, gid, uri, env, log, progress):
+        """Returns the squashfs path and the metadata of the result record (protocol v2)."""
+        start = time.monotonic()
+        result = {}
+
+        if self.stand_in is not None:
+            # docker://ubuntu:24.04 -> ubuntu+24.04.sqsh, the naming used by "enroot import".
+            name = re.sub(r"^docker://", "", uri).replace("/", "+").replace(":", "+") + ".sqsh"
+            path = os.path.join(self.stand_in, name)
+            if not os.path.isfile(path):
+                raise RequestError("image not found in stand-in directory: {}".format(path))
+            result["cache_hit"] = 1
+            return path, result
+
+        progress(phase="digest")
+        digest = env.get("PYXIS_IMAGE_DIGEST") or self.run_as(uid, gid, ["enroot", "digest", uri], log)
+        if not re.fullmatch(r"[A-Za-z0-9_.-]+:[A-Za-z0-9_.-]+", digest):
+            raise RequestError("invalid digest for image {}: {}".format(uri, digest))
+        result["digest"] = digest
+        result["digest_ms"] = int((time.monotonic() - start) * 1000)
+
+        user_dir = self.user_dir(uid, gid)
+        path = os.path.join(user_dir, digest + ".sqsh")
+        if os.path.isfile(path):
+            log("using cached image {}".format(path))
+            result["cache_hit"] = 1
+            return path, result
+
+        temp_path = os.path.join(user_dir, ".{}.{}.tmp".format(digest, threading.get_ident()))
+        pinned = uri if uri.endswith("@" + digest) else uri + "@" + digest
+        try:
+            # "enroot import" fetches, unpacks and creates the squashfs file in a single command.
+            progress(phase="import")
+            import_start = time.monotonic()
+            self.run_as(uid, gid, ["enroot", "import", "--output", temp_path, pinned], log)
+            progress(phase="import", bytes=os.path.getsize(temp_path))
+            result["import_ms"] = int((time.monotonic() - import_start) * 1000)
+            os.rename(temp_path, path)
+        finally:
+            if os.path.exists(temp_path):
+                os.unlink(temp_path)
+        result["cache_hit"] = 0
+        return path, result
+
+    def get(self, uid, gid, uri, env, log, progress):
+        if os.geteuid() != 0 and uid != os.geteuid():
+            raise RequestError("daemon is not running as root, it can only serve its own user")
+
+        key = (uid, uri)
+        with self.lock:
+            event = self.in_flight.get(key)
+            leader = event is None
+            if leader:
+                event = self.in_flight[key] = threading.Event()
+
+        start = time.monotonic()
+        if not leader:
+            log("waiting for a concurrent import of {}".format(uri))
+            progress(phase="wait")
+            event.wait()
+
+        try:
+            path, result = self.fetch(uid, gid, uri, env, log, progress)
+        finally:
+            if leader:
+                with self.lock:
+                    del self.in_flight[key]
+                event.set()
+
+        with self.lock:
+            self.refs[(uid, env.get("SLURM_JOB_ID"), env.get("SLURM_STEP_ID"))] = path
+
+        result["size"] = os.stat(path).st_size
+        result["total_ms"] = int((time.monotonic() - start) * 1000)
+        return path, result
+
+    def release(self, uid, env):
+        # Cached images outlive the job, only drop the reference. Must be idempotent.
+        with self.lock:
+            self.refs.pop((uid, env.get("SLURM_JOB_ID"), env.get("SLURM_STEP_ID")), None)
+
+
+class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        creds = self.request.getsockopt(socket.SOL_SOCKET, socket.SO_PEERCRED, struct.calcsize("3i"))
+        pid, uid, gid = struct.unpack("3i", creds)
+
+        def send(line):
+            self.wfile.write((line + "\n").encode())
+            self.wfile.flush()
+
+        def log(message):
+            send("log " + message)
+
+        def record(kind, **fields):
+            # Protocol v2: values are percent-encoded, they can't contain spaces.
+            send(" ".join([kind] + ["{}={}".format(k, urllib.parse.quote(str(v), safe="/:@+,")) for k, v in fields.items()]))
+
+        def progress(**fields):
+            if version >= 2:
+                record("progress", **fields)
+
+        env = {}
+        version = 1
+        try:
+            header = self.rfile.readline().decode().split()
+            if len(header) != 2 or header[0] != "pyxis-importer" or int(header[1]) not in PROTOCOL_VERSIONS:
+                raise RequestError("unsupported protocol: {}".format(" ".join(header)))
+            version = int(header[1])
+
+            for raw in self.rfile:
+                line = raw.decode().rstrip("\n")
+                if line.startswith("env "):
+                    name, _, value = line[4:].partition("=")
+                    env[name] = value
+                    continue
+
+                args = line.split()
+                if len(args) == 2 and args[0] == "get":
+                    path, result = self.server.importer.get(uid, gid, args[1], env, log, progress)
+                    if version >= 2:
+                        record("result", path=path, **result)
+                    else:
+                        send("ok " + path)
+                elif len(args) == 1 and args[0] == "release":
+                    self.server.importer.release(uid, env)
+                    send("ok")
+                else:
+                    raise RequestError("invalid request: {}".format(line))
+                return
+
+            raise RequestError("missing request")
+        except Exception as e:
+            print("pid {} uid {}: {}".format(pid, uid, e), file=sys.stderr)
+            send("error {}".format(e))
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="pyxis importer daemon")
+    parser.add_argument("--socket", default="/run/pyxis/importer.sock", help="path of the Unix socket")
+    parser.add_argument("--cache-dir", default="/var/cache/pyxis-importer", help="directory for cached images")
+    parser.add_argument("--stand-in", metavar="DIR", help="serve pre-built squashfs files from DIR, without a registry")
+    args = parser.parse_args()
+
+    os.makedirs(args.cache_dir, mode=0o755, exist_ok=True)
+    if os.path.exists(args.socket):
+        os.unlink(args.socket)
+
+    with Server(args.socket, Handler) as server:
+        # Users connect directly, the daemon identifies them with SO_PEERCRED.
+        os.chmod(args.socket, 0o666)
+        server.importer = Importer(args.cache_dir, args.stand_in)
+        server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "lock.h"
+#include "common.h"
+
+/*
+ * Node-wide locks, stored in a directory per user: <runtime_path>/locks/<uid>/<type>.<hash>.lock
+ *
+ * Locks are taken by job steps with the credentials of the user, and by the job prolog as root.
+ * The per-user directories are created by root and owned by the user.
+ *
+ * We rely on flock(2): the lock is released by the kernel when its holder exits, even if it
+ * was killed, so a waiter automatically takes over from a dead holder. The PID of the current
+ * holder is written to the file, for diagnostics only.
+ */
+
+int lock_create_dir(const struct plugin_config *config)
+{
+	int ret;
+	char path[PATH_MAX];
+
+	ret = snprintf(path, sizeof(path), "%s/locks", config->runtime_path);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	ret = mkdir(path, 0755);
+	if (ret < 0 && errno != EEXIST) {
+		slurm_error("pyxis: couldn't mkdir %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* As root, create the lock directory of a user. */
+int lock_create_user_dir(const struct plugin_config *config, uid_t uid, gid_t gid)
+{
+	int ret;
+	char path[PATH_MAX];
+
+	ret = lock_create_dir(config);
+	if (ret < 0)
+		return (-1);
+
+	ret = snprintf(path, sizeof(path), "%s/locks/%u", config->runtime_path, uid);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	return create_user_dir(path, uid, gid);
+}
+
+static pid_t lock_read_owner(int fd)
+{
+	char buf[16] = { 0 };
+	ssize_t n;
+	long pid;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return (0);
+
+	pid = strtol(buf, NULL, 10);
+	if (pid <= 0 || pid != (pid_t)pid)
+		return (0);
+
+	return ((pid_t)pid);
+}
+
+static int lock_open(const struct plugin_config *config, const char *type, uid_t uid, const char *key,
+		     char (*path)[PATH_MAX])
+{
+	int ret;
+	int dir_fd;
+	int fd;
+	char name[NAME_MAX + 1];
+
+	ret = snprintf(*path, sizeof(*path), "%s/locks/%u", config->runtime_path, uid);
+	if (ret < 0 || ret >= sizeof(*path))
+		return (-1);
+
+	dir_fd = open(*path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dir_fd < 0) {
+		slurm_error("pyxis: couldn't open lock directory %s: %s", *path, strerror(errno));
+		return (-1);
+	}
+
+	ret = snprintf(name, sizeof(name), "%s.%016" PRIx64 ".lock", type, hash_string(key));
+	if (ret < 0 || ret >= sizeof(name))
+		goto fail;
+
+	ret = snprintf(*path, sizeof(*path), "%s/locks/%u/%s", config->runtime_path, uid, name);
+	if (ret < 0 || ret >= sizeof(*path))
+		goto fail;
+
+	fd = open_user_file(dir_fd, name, O_RDWR | O_CREAT);
+	if (fd < 0) {
+		slurm_error("pyxis: couldn't open lock file %s: %s", *path, strerror(errno));
+		goto fail;
+	}
+
+	close(dir_fd);
+
+	return (fd);
+
+fail:
+	close(dir_fd);
+	return (-1);
+}
+
+/* Record the PID of the calling process as the owner of the lock, for diagnostics only. */
+void lock_set_owner(int fd)
+{
+	int ret;
+	char buf[16];
+
+	ret = snprintf(buf, sizeof(buf), "%d\n", getpid());
+	if (ftruncate(fd, 0) < 0 || pwrite(fd, buf, ret, 0) != ret)
+		slurm_info("pyxis: couldn't record lock owner: %s", strerror(errno));
+}
+
+/*
+ * Block until the lock identified by (type, uid, key) is acquired, returns the lock fd.
+ * If the lock was held by another process, *owner is set to its PID (or -1 if unknown), otherwise to 0.
+ */
+int lock_acquire(const struct plugin_config *config, const char *type, uid_t uid, const char *key, pid_t *owner)
+{
+	int ret;
+	int fd = -1;
+	char path[PATH_MAX];
+
+	*owner = 0;
+
+	fd = lock_open(config, type, uid, key, &path);
+	if (fd < 0)
+		return (-1);
+
+	ret = flock(fd, LOCK_EX | LOCK_NB);
+	if (ret < 0 && errno == EWOULDBLOCK) {
+		*owner = lock_read_owner(fd);
+		if (*owner == 0)
+			*owner = -1;
+
+		do {
+			ret = flock(fd, LOCK_EX);
+		} while (ret < 0 && errno == EINTR);
+	}
+
+	if (ret < 0) {
+		slurm_error("pyxis: couldn't lock %s: %s", path, strerror(errno));
+		close(fd);
+		return (-1);
+	}
+
+	lock_set_owner(fd);
+
+	return (fd);
+}
+
+static int lock_try(const struct plugin_config *config, const char *type, uid_t uid, const char *key, int *fd,
+		    int operation)
+{
+	int ret;
+	char path[PATH_MAX];
+
+	*fd = lock_open(config, type, uid, key, &path);
+	if (*fd < 0)
+		return (-1);
+
+	ret = flock(*fd, operation | LOCK_NB);
+	if (ret < 0) {
+		if (errno == EWOULDBLOCK)
+			ret = 0;
+		else
+			slurm_error("pyxis: couldn't lock %s: %s", path, strerror(errno));
+		close(*fd);
+		*fd = -1;
+		return (ret);
+	}
+
+	return (1);
+}
+
+/*
+ * Acquire the lock identified by (type, uid, key) without blocking.
+ * Returns 1 and sets *fd if the lock was acquired, 0 if it is held by another process, -1 on error.
+ */
+int lock_try_acquire(const struct plugin_config *config, const char *type, uid_t uid, const char *key, int *fd)
+{
+	int ret;
+
+	ret = lock_try(config, type, uid, key, fd, LOCK_EX);
+	if (ret == 1)
+		lock_set_owner(*fd);
+
+	return (ret);
+}
+
+/*
+ * Like lock_try_acquire(), but other processes can hold the lock in shared mode at the same time.
+ * The owner is not recorded, release the lock with close(2).
+ */
+int lock_try_acquire_shared(const struct plugin_config *config, const char *type, uid_t uid, const char *key, int *fd)
+{
+	return lock_try(config, type, uid, key, fd, LOCK_SH);
+}
+
+void lock_release(int fd)
+{
+	if (fd < 0)
+		return;
+
+	if (ftruncate(fd, 0) < 0)
+		slurm_info("pyxis: couldn't clear lock owner: %s", strerror(errno));
+
+	/* Closing the last reference to the file descriptor releases the lock. */
+	close(fd);
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef LOCK_H_
+#define LOCK_H_
+
+#include <sys/types.h>
+
+#include "config.h"
+
+int lock_create_dir(const struct plugin_config *config);
+
+int lock_create_user_dir(const struct plugin_config *config, uid_t uid, gid_t gid);
+
+int lock_acquire(const struct plugin_config *config, const char *type, uid_t uid, const char *key, pid_t *owner);
+
+int lock_try_acquire(const struct plugin_config *config, const char *type, uid_t uid, const char *key, int *fd);
+
+int lock_try_acquire_shared(const struct plugin_config *config, const char *type, uid_t uid, const char *key, int *fd);
+
+void lock_set_owner(int fd);
+
+void lock_release(int fd);
+
+#endif /* LOCK_H_ */
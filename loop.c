@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/loop.h>
+
+#include <slurm/spank.h>
+
+#include "loop.h"
+#include "common.h"
+
+/* Another process can take the free loop device before us. */
+#define LOOP_ATTEMPTS 8
+
+/*
+ * As root, mount a squashfs file with the kernel driver, through a loop device. Reads are served
+ * from the page cache, and decompressed by the kernel (in parallel, depending on its
+ * configuration), without a FUSE daemon.
+ *
+ * The loop device is released by the kernel when the filesystem is unmounted (LO_FLAGS_AUTOCLEAR).
+ * The file and the mount point are passed as file descriptors, opened without following symlinks by
+ * the caller: they are in directories owned by the user.
+ */
+
+static int loop_configure(int loop_fd, int file_fd)
+{
+	int ret;
+	struct loop_info64 info = { 0 };
+
+#ifdef LOOP_CONFIGURE
+	struct loop_config config = { 0 };
+
+	config.fd = file_fd;
+	config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
+
+	ret = ioctl(loop_fd, LOOP_CONFIGURE, &config);
+	if (ret == 0 || (errno != EINVAL && errno != ENOTTY))
+		return (ret);
+#endif
+
+	/* Before Linux 5.8, the device is read-only because the file is. */
+	ret = ioctl(loop_fd, LOOP_SET_FD, file_fd);
+	if (ret < 0)
+		return (-1);
+
+	info.lo_flags = LO_FLAGS_AUTOCLEAR;
+	ret = ioctl(loop_fd, LOOP_SET_STATUS64, &info);
+	if (ret < 0) {
+		ioctl(loop_fd, LOOP_CLR_FD, 0);
+		return (-1);
+	}
+
+	return (0);
+}
+
+int loop_mount_squashfs(int file_fd, int target_fd)
+{
+	int ret;
+	int ctl_fd;
+	int loop_fd = -1;
+	int n;
+	char dev[32];
+	char target[PATH_MAX];
+	int rv = -1;
+
+	ctl_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+	if (ctl_fd < 0) {
+		slurm_error("pyxis: loop: couldn't open /dev/loop-control: %s", strerror(errno));
+		return (-1);
+	}
+
+	for (int i = 0; i < LOOP_ATTEMPTS; ++i) {
+		n = ioctl(ctl_fd, LOOP_CTL_GET_FREE);
+		if (n < 0) {
+			slurm_error("pyxis: loop: couldn't get a free loop device: %s", strerror(errno));
+			goto fail;
+		}
+
+		snprintf(dev, sizeof(dev), "/dev/loop%d", n);
+
+		loop_fd = open(dev, O_RDONLY | O_CLOEXEC);
+		if (loop_fd < 0) {
+			slurm_error("pyxis: loop: couldn't open %s: %s", dev, strerror(errno));
+			goto fail;
+		}
+
+		ret = loop_configure(loop_fd, file_fd);
+		if (ret == 0)
+			break;
+
+		close(loop_fd);
+		loop_fd = -1;
+
+		if (errno != EBUSY) {
+			slurm_error("pyxis: loop: couldn't configure %s: %s", dev, strerror(errno));
+			goto fail;
+		}
+	}
+
+	if (loop_fd < 0) {
+		slurm_error("pyxis: loop: no free loop device after %d attempts", LOOP_ATTEMPTS);
+		goto fail;
+	}
+
+	/* Resolve the mount point through the file descriptor, a symlink can't redirect the mount. */
+	snprintf(target, sizeof(target), "/proc/self/fd/%d", target_fd);
+
+	ret = mount(dev, target, "squashfs", MS_RDONLY | MS_NOSUID | MS_NODEV, NULL);
+	if (ret < 0) {
+		slurm_error("pyxis: loop: couldn't mount %s: %s", dev, strerror(errno));
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	/* With LO_FLAGS_AUTOCLEAR, the device is released on the last close if it isn't mounted. */
+	xclose(loop_fd);
+	close(ctl_fd);
+
+	return (rv);
+}
@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef LOOP_H_
+#define LOOP_H_
+
+int loop_mount_squashfs(int file_fd, int target_fd);
+
+#endif /* LOOP_H_ */
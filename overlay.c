@@ -0,0 +1,787 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "overlay.h"
+#include "cache.h"
+#include "common.h"
+#include "digest.h"
+#include "loop.h"
+
+#ifndef UMOUNT_NOFOLLOW
+# define UMOUNT_NOFOLLOW 0x00000008
+#endif
+
+/*
+ * With use_overlay, the image is extracted once per node and per user into the image cache (see
+ * cache_rootfs_publish), and the temporary container of a step is a fuse-overlayfs mount with this
+ * read-only root filesystem as the lower directory:
+ *   <cache_path>/<uid>/overlay/<jobid>.<stepid>/upper/        writable layer of the container
+ *   <cache_path>/<uid>/overlay/<jobid>.<stepid>/work/         work directory of fuse-overlayfs
+ *   <cache_path>/<uid>/overlay/<jobid>.<stepid>/data/<name>/  merged view, in ENROOT_DATA_PATH
+ *   <cache_path>/<uid>/overlay/<jobid>.<stepid>/lower/        squashfuse mount private to the step
+ *
+ * The step directory is the ENROOT_DATA_PATH of the step, so that "enroot start" and "enroot export"
+ * find the merged view under the usual container name. It is also where a missing root filesystem
+ * is extracted with "enroot create", on the same filesystem as the cache, before being published.
+ *
+ * With shared_squashfuse, the lower directory is a squashfuse mount of the squashfs file instead,
+ * shared by all the jobs of the user (see shared_mount.c), or private to the step.
+ *
+ * With job_rootfs, images that are not in the cache (squashfs files, staged images and images of
+ * the importer) are extracted once per job instead of once per step:
+ *   <cache_path>/<uid>/overlay/<jobid>.rootfs/<file>/  extracted squashfs file, lower directory of
+ *                                                     the temporary containers of the job
+ * The squashfs file is identified by its inode, size and modification time. The job epilog removes
+ * these root filesystems with the directories of the steps.
+ *
+ * A named container keeps its upper directory across steps, it is only the image and its changes:
+ *   <cache_path>/<uid>/containers/<name>/upper/  writable layer of the container
+ *   <cache_path>/<uid>/containers/<name>/work/   work directory of fuse-overlayfs
+ *   <cache_path>/<uid>/containers/<name>/image   digest of the image, protected from cache_gc()
+ * Each step mounts it in its own directory, like a temporary container. Two steps can't mount the
+ * same upper directory, the container is locked by the step that uses it. A clone of a named container
+ * is a copy of its upper directory on the same image, the source is locked shared during the copy.
+ *
+ * The container filesystem is mounted and unmounted with the credentials of the user. The job
+ * epilog detaches the mounts left by steps that were killed, and removes their directories.
+ */
+
+bool overlay_enabled(const struct plugin_config *config)
+{
+	return (config->use_overlay && cache_enabled(config));
+}
+
+bool overlay_job_rootfs_enabled(const struct plugin_config *config)
+{
+	return (config->job_rootfs && overlay_enabled(config));
+}
+
+int overlay_path(const struct plugin_config *config, uid_t uid, uint32_t jobid, uint32_t stepid, char **path)
+{
+	int ret;
+
+	ret = xasprintf(path, "%s/%u/overlay/%u.%u", config->cache_path, uid, jobid, stepid);
+	if (ret < 0 || ret >= PATH_MAX) {
+		free(*path);
+		*path = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int overlay_mkdir(const char *path, const char *name)
+{
+	int ret;
+	char buf[PATH_MAX];
+
+	ret = snprintf(buf, sizeof(buf), "%s%s", path, name);
+	if (ret < 0 || ret >= sizeof(buf))
+		return (-1);
+
+	ret = mkdir(buf, 0700);
+	if (ret < 0 && errno != EEXIST) {
+		slurm_error("pyxis: overlay: couldn't mkdir %s: %s", buf, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Without privileges, create the directories of the step, in the cache directory of the user. */
+int overlay_prepare(const char *path)
+{
+	char parent[PATH_MAX];
+	char *p;
+	int ret;
+
+	ret = snprintf(parent, sizeof(parent), "%s", path);
+	if (ret < 0 || ret >= sizeof(parent))
+		return (-1);
+
+	p = strrchr(parent, '/');
+	if (p == NULL)
+		return (-1);
+	*p = '\0';
+
+	if (overlay_mkdir(parent, "") < 0 || overlay_mkdir(path, "") < 0 || overlay_mkdir(path, "/upper") < 0 ||
+	    overlay_mkdir(path, "/work") < 0 || overlay_mkdir(path, "/data") < 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Without a shared mount of the image, mount the squashfs file on the lower directory of the step.
+ * The squashfuse process is one of the processes of the step, it can't outlive it.
+ */
+int overlay_mount_squashfs(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+			   const char *path, const char *squashfs_path, char **lower)
+{
+	int ret;
+	int rv = -1;
+
+	ret = xasprintf(lower, "%s/lower", path);
+	if (ret < 0)
+		return (-1);
+
+	ret = mkdir(*lower, 0755);
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't mkdir %s: %s", *lower, strerror(errno));
+		goto fail;
+	}
+
+	ret = enroot_exec_wait(uid, gid, ngids, gids, log_fd, callback,
+			       (char *const[]){ "squashfuse", (char *)squashfs_path, *lower, NULL });
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't mount %s", squashfs_path);
+		rmdir(*lower);
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		free(*lower);
+		*lower = NULL;
+	}
+
+	return (rv);
+}
+
+/* As root, in a privileged step, mount the squashfs file on the lower directory with the kernel driver. */
+int overlay_mount_loop(const char *path, const char *squashfs_path, char **lower)
+{
+	int ret;
+	int file_fd = -1;
+	int target_fd = -1;
+	int rv = -1;
+
+	ret = xasprintf(lower, "%s/lower", path);
+	if (ret < 0)
+		return (-1);
+
+	ret = mkdir(*lower, 0755);
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't mkdir %s: %s", *lower, strerror(errno));
+		goto fail;
+	}
+
+	file_fd = open(squashfs_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (file_fd < 0) {
+		slurm_error("pyxis: overlay: couldn't open %s: %s", squashfs_path, strerror(errno));
+		goto fail;
+	}
+
+	target_fd = open(*lower, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (target_fd < 0)
+		goto fail;
+
+	ret = loop_mount_squashfs(file_fd, target_fd);
+	if (ret < 0)
+		goto fail;
+
+	rv = 0;
+
+fail:
+	xclose(target_fd);
+	xclose(file_fd);
+	if (rv < 0) {
+		if (*lower != NULL)
+			rmdir(*lower);
+		free(*lower);
+		*lower = NULL;
+	}
+
+	return (rv);
+}
+
+/* The upper directory is the one of the step, or the one of a named container. */
+int overlay_mount(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+		  const char *path, const char *upper, const char *name, const char *lower)
+{
+	int ret;
+	char target[PATH_MAX];
+	char *options = NULL;
+	int rv = -1;
+
+	ret = snprintf(target, sizeof(target), "%s/data/%s", path, name);
+	if (ret < 0 || ret >= sizeof(target))
+		return (-1);
+
+	ret = mkdir(target, 0755);
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't mkdir %s: %s", target, strerror(errno));
+		return (-1);
+	}
+
+	ret = xasprintf(&options, "lowerdir=%s,upperdir=%s/upper,workdir=%s/work", lower, upper, upper);
+	if (ret < 0)
+		goto fail;
+
+	ret = enroot_exec_wait(uid, gid, ngids, gids, log_fd, callback,
+			       (char *const[]){ "fuse-overlayfs", "-o", options, target, NULL });
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't mount %s", target);
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	if (rv < 0)
+		rmdir(target);
+	free(options);
+
+	return (rv);
+}
+
+/* Returns 1 if a filesystem is mounted on target, 0 if not, -1 on error. */
+int overlay_fuse_mounted(const char *target)
+{
+	int ret;
+	char parent[PATH_MAX];
+	char *p;
+	struct stat parent_st, st;
+
+	ret = snprintf(parent, sizeof(parent), "%s", target);
+	if (ret < 0 || ret >= sizeof(parent))
+		return (-1);
+
+	p = strrchr(parent, '/');
+	if (p == NULL)
+		return (-1);
+	*p = '\0';
+
+	ret = lstat(target, &st);
+	if (ret < 0 && errno == ENOENT)
+		return (0);
+	/* The FUSE daemon is gone, but the filesystem is still mounted. */
+	if (ret < 0 && errno == ENOTCONN)
+		return (1);
+	if (ret < 0)
+		return (-1);
+
+	if (lstat(parent, &parent_st) < 0)
+		return (-1);
+
+	return (st.st_dev != parent_st.st_dev);
+}
+
+/* Unmount a FUSE filesystem mounted with the credentials of the user, if it is mounted. */
+int overlay_fuse_unmount(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+			 const char *target)
+{
+	int ret;
+
+	ret = overlay_fuse_mounted(target);
+	if (ret <= 0)
+		return (ret);
+
+	/* Processes left in the container might still use the filesystem, detach it. */
+	ret = enroot_exec_wait(uid, gid, ngids, gids, log_fd, callback,
+			       (char *const[]){ "fusermount3", "-u", "-z", (char *)target, NULL });
+	if (ret < 0)
+		ret = enroot_exec_wait(uid, gid, ngids, gids, log_fd, callback,
+				       (char *const[]){ "fusermount", "-u", "-z", (char *)target, NULL });
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't unmount %s", target);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* As root, detach a filesystem mounted by the user, the user controls the directories. */
+static int overlay_detach(int dir_fd, const char *name)
+{
+	int ret;
+	char target[PATH_MAX];
+
+	ret = snprintf(target, sizeof(target), "/proc/self/fd/%d/%s", dir_fd, name);
+	if (ret < 0 || ret >= sizeof(target))
+		return (-1);
+
+	return umount2(target, MNT_DETACH | UMOUNT_NOFOLLOW);
+}
+
+static int overlay_unmount_lower(const char *path)
+{
+	int ret;
+	int dir_fd;
+
+	dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dir_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	ret = overlay_detach(dir_fd, "lower");
+	if (ret < 0 && (errno == EINVAL || errno == ENOENT))
+		ret = 0;
+	if (ret < 0)
+		slurm_error("pyxis: overlay: couldn't unmount %s/lower: %s", path, strerror(errno));
+
+	close(dir_fd);
+
+	return (ret);
+}
+
+/*
+ * Unmount the container filesystem of the step, and then its lower directory if it is a mount
+ * private to the step. The step might have failed before they were mounted.
+ */
+int overlay_unmount(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+		    const char *path, const char *name)
+{
+	int ret;
+	char target[PATH_MAX];
+
+	ret = snprintf(target, sizeof(target), "%s/data/%s", path, name);
+	if (ret < 0 || ret >= sizeof(target))
+		return (-1);
+
+	ret = overlay_fuse_unmount(uid, gid, ngids, gids, log_fd, callback, target);
+	if (ret < 0)
+		return (-1);
+
+	/* A privileged step mounts its lower directory with the kernel driver, root can detach both kinds. */
+	if (geteuid() == 0)
+		return overlay_unmount_lower(path);
+
+	ret = snprintf(target, sizeof(target), "%s/lower", path);
+	if (ret < 0 || ret >= sizeof(target))
+		return (-1);
+
+	return overlay_fuse_unmount(uid, gid, ngids, gids, log_fd, callback, target);
+}
+
+static int overlay_dir_open(const struct plugin_config *config, uid_t uid, const char *subdir)
+{
+	int ret;
+	int dir_fd;
+	int fd;
+	char path[PATH_MAX];
+
+	ret = snprintf(path, sizeof(path), "%s/%u", config->cache_path, uid);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dir_fd < 0)
+		return (-1);
+
+	/* The directory belongs to the user, don't follow a symlink planted in its place. */
+	fd = openat(dir_fd, subdir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	close(dir_fd);
+
+	return (fd);
+}
+
+int overlay_job_rootfs_path(const struct plugin_config *config, uid_t uid, uint32_t jobid, const char *squashfs_path,
+			    char **path)
+{
+	int ret;
+	struct stat st;
+
+	*path = NULL;
+
+	ret = stat(squashfs_path, &st);
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't stat %s: %s", squashfs_path, strerror(errno));
+		return (-1);
+	}
+
+	ret = xasprintf(path, "%s/%u/overlay/%u.rootfs/%jx-%jx-%jx-%jx.%09ld", config->cache_path, uid, jobid,
+			(uintmax_t)st.st_dev, (uintmax_t)st.st_ino, (uintmax_t)st.st_size,
+			(uintmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+	if (ret < 0 || ret >= PATH_MAX) {
+		free(*path);
+		*path = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Returns -1 if an error occurs.
+ * Returns 0 if the squashfs file was not extracted for the job yet.
+ * Returns 1 if the root filesystem is in the job directory.
+ */
+int overlay_job_rootfs_lookup(const char *path)
+{
+	int ret;
+	struct stat st;
+
+	ret = lstat(path, &st);
+	if (ret == 0 && S_ISDIR(st.st_mode))
+		return (1);
+
+	if (ret < 0 && errno != ENOENT) {
+		slurm_error("pyxis: overlay: couldn't stat %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Move a root filesystem extracted in the data directory of a step to the job directory. */
+int overlay_job_rootfs_publish(const char *temp_path, const char *path)
+{
+	int ret;
+	char parent[PATH_MAX];
+	char *p;
+
+	ret = snprintf(parent, sizeof(parent), "%s", path);
+	if (ret < 0 || ret >= sizeof(parent))
+		return (-1);
+
+	p = strrchr(parent, '/');
+	if (p == NULL)
+		return (-1);
+	*p = '\0';
+
+	if (overlay_mkdir(parent, "") < 0)
+		return (-1);
+
+	ret = rename(temp_path, path);
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't rename %s: %s", temp_path, strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Remove the directories of a step, once its container filesystem is unmounted. */
+int overlay_remove(const struct plugin_config *config, uid_t uid, uint32_t jobid, uint32_t stepid)
+{
+	int ret;
+	int dir_fd;
+	char name[32];
+
+	dir_fd = overlay_dir_open(config, uid, "overlay");
+	if (dir_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	snprintf(name, sizeof(name), "%u.%u", jobid, stepid);
+	ret = remove_tree(dir_fd, name);
+	if (ret < 0)
+		slurm_info("pyxis: overlay: couldn't remove %s: %s", name, strerror(errno));
+
+	close(dir_fd);
+
+	return (ret);
+}
+
+static bool overlay_match_job(const char *name, uint32_t jobid)
+{
+	uint32_t id;
+	int n = 0;
+
+	if (sscanf(name, "%u.%*u%n", &id, &n) != 1)
+		return (false);
+
+	return (strlen(name) == n && id == jobid);
+}
+
+/* As root, detach the container filesystems mounted in the directory of a step, and its lower directory. */
+static void overlay_detach_all(int step_fd)
+{
+	int data_fd;
+	DIR *dirp;
+	struct dirent *d;
+
+	data_fd = openat(step_fd, "data", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	dirp = data_fd >= 0 ? fdopendir(data_fd) : NULL;
+	if (dirp == NULL) {
+		xclose(data_fd);
+		(void)overlay_detach(step_fd, "lower");
+		return;
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+			continue;
+
+		if (overlay_detach(dirfd(dirp), d->d_name) == 0)
+			slurm_verbose("pyxis: overlay: detached leftover container filesystem %s", d->d_name);
+	}
+
+	closedir(dirp);
+
+	(void)overlay_detach(step_fd, "lower");
+}
+
+/*
+ * As root, from the job epilog, unmount and remove the container filesystems left by the steps of
+ * the job, e.g. when a step was killed before its last task exited.
+ */
+int overlay_cleanup(const struct plugin_config *config, uid_t uid, uint32_t jobid)
+{
+	int ret;
+	int dir_fd;
+	int step_fd;
+	DIR *dirp;
+	struct dirent *d;
+	char name[32];
+	int rv = 0;
+
+	/* Not only with use_overlay, shared_squashfuse mounts the containers of the steps too. */
+	if (!cache_enabled(config))
+		return (0);
+
+	dir_fd = overlay_dir_open(config, uid, "overlay");
+	if (dir_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	dirp = fdopendir(dir_fd);
+	if (dirp == NULL) {
+		close(dir_fd);
+		return (-1);
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (!overlay_match_job(d->d_name, jobid))
+			continue;
+
+		step_fd = openat(dirfd(dirp), d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (step_fd >= 0) {
+			overlay_detach_all(step_fd);
+			close(step_fd);
+		}
+
+		slurm_verbose("pyxis: overlay: removing leftover container filesystem of step %s", d->d_name);
+		ret = remove_tree(dirfd(dirp), d->d_name);
+		if (ret < 0) {
+			slurm_error("pyxis: overlay: couldn't remove %s: %s", d->d_name, strerror(errno));
+			rv = -1;
+		}
+	}
+
+	snprintf(name, sizeof(name), "%u.rootfs", jobid);
+	ret = remove_tree(dirfd(dirp), name);
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't remove %s: %s", name, strerror(errno));
+		rv = -1;
+	}
+
+	closedir(dirp);
+
+	return (rv);
+}
+
+int overlay_container_path(const struct plugin_config *config, uid_t uid, const char *name, char **path)
+{
+	int ret;
+
+	if (strchr(name, '/') != NULL || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return (-1);
+
+	ret = xasprintf(path, "%s/%u/containers/%s", config->cache_path, uid, name);
+	if (ret < 0 || ret >= PATH_MAX) {
+		free(*path);
+		*path = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Returns 1 and the digest of its image if the named container exists, 0 if it doesn't, -1 on error. */
+int overlay_container_lookup(const char *path, char **digest)
+{
+	int ret;
+	FILE *fp;
+	char image[PATH_MAX];
+
+	*digest = NULL;
+
+	ret = snprintf(image, sizeof(image), "%s/image", path);
+	if (ret < 0 || ret >= sizeof(image))
+		return (-1);
+
+	fp = fopen(image, "re");
+	if (fp == NULL)
+		return (errno == ENOENT ? 0 : -1);
+
+	*digest = get_line_from_file(fp);
+	fclose(fp);
+
+	if (*digest == NULL || !digest_valid(*digest)) {
+		slurm_error("pyxis: overlay: invalid image digest in %s", image);
+		free(*digest);
+		*digest = NULL;
+		return (-1);
+	}
+
+	return (1);
+}
+
+static int overlay_container_mkdirs(const char *path)
+{
+	int ret;
+	char parent[PATH_MAX];
+	char *p;
+
+	ret = snprintf(parent, sizeof(parent), "%s", path);
+	if (ret < 0 || ret >= sizeof(parent))
+		return (-1);
+
+	p = strrchr(parent, '/');
+	if (p == NULL)
+		return (-1);
+	*p = '\0';
+
+	if (overlay_mkdir(parent, "") < 0 || overlay_mkdir(path, "") < 0 || overlay_mkdir(path, "/work") < 0)
+		return (-1);
+
+	return (0);
+}
+
+/* The container exists once the digest of its image is recorded, an interrupted creation is started over. */
+static int overlay_container_record(const char *path, const char *digest)
+{
+	int ret;
+	FILE *fp;
+	char image[PATH_MAX];
+	char temp[PATH_MAX];
+
+	ret = snprintf(image, sizeof(image), "%s/image", path);
+	if (ret < 0 || ret >= sizeof(image))
+		return (-1);
+
+	ret = snprintf(temp, sizeof(temp), "%s/image.tmp", path);
+	if (ret < 0 || ret >= sizeof(temp))
+		return (-1);
+
+	fp = fopen(temp, "we");
+	if (fp == NULL) {
+		slurm_error("pyxis: overlay: couldn't create %s: %s", temp, strerror(errno));
+		return (-1);
+	}
+
+	ret = fprintf(fp, "%s\n", digest);
+	if (fclose(fp) != 0 || ret < 0 || rename(temp, image) < 0) {
+		slurm_error("pyxis: overlay: couldn't write %s: %s", image, strerror(errno));
+		unlink(temp);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Without privileges, create the directories of a named container. */
+int overlay_container_create(const char *path, const char *digest)
+{
+	if (overlay_container_mkdirs(path) < 0 || overlay_mkdir(path, "/upper") < 0)
+		return (-1);
+
+	return overlay_container_record(path, digest);
+}
+
+/*
+ * Without privileges, create a named container from the image and the changes of another one. Only
+ * the upper directory is copied, with reflinks when the filesystem supports them: the files are
+ * then shared until one of the containers modifies them.
+ */
+int overlay_container_clone(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+			    const char *source, const char *path, const char *digest)
+{
+	int ret;
+	char source_upper[PATH_MAX];
+	char upper[PATH_MAX];
+
+	ret = snprintf(source_upper, sizeof(source_upper), "%s/upper", source);
+	if (ret < 0 || ret >= sizeof(source_upper))
+		return (-1);
+
+	ret = snprintf(upper, sizeof(upper), "%s/upper", path);
+	if (ret < 0 || ret >= sizeof(upper))
+		return (-1);
+
+	if (overlay_container_mkdirs(path) < 0)
+		return (-1);
+
+	/* An interrupted clone is started over. */
+	ret = enroot_exec_wait(uid, gid, ngids, gids, log_fd, callback,
+			       (char *const[]){ "rm", "-rf", "--", upper, NULL });
+	if (ret < 0)
+		return (-1);
+
+	/* The whiteouts and the extended attributes of fuse-overlayfs are files and xattrs, cp keeps them. */
+	ret = enroot_exec_wait(uid, gid, ngids, gids, log_fd, callback,
+			       (char *const[]){ "cp", "-a", "--reflink=auto", "-T", source_upper, upper, NULL });
+	if (ret < 0) {
+		slurm_error("pyxis: overlay: couldn't copy %s", source_upper);
+		return (-1);
+	}
+
+	return overlay_container_record(path, digest);
+}
+
+static bool overlay_container_match_job(const char *name, uint32_t jobid)
+{
+	char prefix[32];
+
+	snprintf(prefix, sizeof(prefix), "pyxis_%u_", jobid);
+
+	return (strncmp(name, prefix, strlen(prefix)) == 0);
+}
+
+/* As root, from the job epilog, remove the named containers of a job with container_scope=job. */
+int overlay_container_cleanup(const struct plugin_config *config, uid_t uid, uint32_t jobid)
+{
+	int ret;
+	int dir_fd;
+	DIR *dirp;
+	struct dirent *d;
+	int rv = 0;
+
+	if (!cache_enabled(config))
+		return (0);
+
+	dir_fd = overlay_dir_open(config, uid, "containers");
+	if (dir_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	dirp = fdopendir(dir_fd);
+	if (dirp == NULL) {
+		close(dir_fd);
+		return (-1);
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (!overlay_container_match_job(d->d_name, jobid))
+			continue;
+
+		slurm_verbose("pyxis: overlay: removing container %s", d->d_name);
+		ret = remove_tree(dirfd(dirp), d->d_name);
+		if (ret < 0) {
+			slurm_error("pyxis: overlay: couldn't remove %s: %s", d->d_name, strerror(errno));
+			rv = -1;
+		}
+	}
+
+	closedir(dirp);
+
+	return (rv);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef OVERLAY_H_
+#define OVERLAY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "enroot.h"
+
+bool overlay_enabled(const struct plugin_config *config);
+
+bool overlay_job_rootfs_enabled(const struct plugin_config *config);
+
+int overlay_path(const struct plugin_config *config, uid_t uid, uint32_t jobid, uint32_t stepid, char **path);
+
+int overlay_prepare(const char *path);
+
+int overlay_mount_squashfs(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+			   const char *path, const char *squashfs_path, char **lower);
+
+int overlay_mount_loop(const char *path, const char *squashfs_path, char **lower);
+
+int overlay_mount(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+		  const char *path, const char *upper, const char *name, const char *lower);
+
+int overlay_fuse_mounted(const char *target);
+
+int overlay_fuse_unmount(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+			 const char *target);
+
+int overlay_unmount(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+		    const char *path, const char *name);
+
+int overlay_job_rootfs_path(const struct plugin_config *config, uid_t uid, uint32_t jobid, const char *squashfs_path,
+			    char **path);
+
+int overlay_job_rootfs_lookup(const char *path);
+
+int overlay_job_rootfs_publish(const char *temp_path, const char *path);
+
+int overlay_remove(const struct plugin_config *config, uid_t uid, uint32_t jobid, uint32_t stepid);
+
+int overlay_cleanup(const struct plugin_config *config, uid_t uid, uint32_t jobid);
+
+int overlay_container_path(const struct plugin_config *config, uid_t uid, const char *name, char **path);
+
+int overlay_container_lookup(const char *path, char **digest);
+
+int overlay_container_create(const char *path, const char *digest);
+
+int overlay_container_clone(uid_t uid, gid_t gid, int ngids, const gid_t *gids, int log_fd, child_cb callback,
+			    const char *source, const char *path, const char *digest);
+
+int overlay_container_cleanup(const struct plugin_config *config, uid_t uid, uint32_t jobid);
+
+#endif /* OVERLAY_H_ */
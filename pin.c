@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "pin.h"
+#include "digest.h"
+#include "enroot.h"
+
+/*
+ * With pin_digest=1, srun/sbatch/salloc resolve the digest of the image once, and export the pinned
+ * reference (docker://IMAGE@DIGEST) in the job environment as PYXIS_IMAGE_PIN. All the nodes and all
+ * the steps of the job then use the same digest, without querying the registry again.
+ *
+ * With submit_check=1, the image is also validated before the job is submitted: a typo in the image
+ * name or missing registry credentials fail srun/sbatch/salloc instead of the job, after it waited
+ * in the queue. The lookup is bounded by submit_check_timeout.
+ */
+
+/* Returns the digest if pin is the pinned reference of enroot_uri. */
+char *pin_lookup(const char *pin, const char *enroot_uri)
+{
+	size_t len;
+
+	len = strlen(enroot_uri);
+	if (strncmp(pin, enroot_uri, len) != 0 || pin[len] != '@')
+		return (NULL);
+
+	if (!digest_valid(pin + len + 1))
+		return (NULL);
+
+	return (strdup(pin + len + 1));
+}
+
+bool pin_enabled(const struct plugin_config *config)
+{
+	/* The digest resolved by the submit check is reused by the steps. */
+	return (config->pin_digest || config->submit_check);
+}
+
+/*
+ * With submit_check, warn if a squashfs file given by an absolute path is not readable from the
+ * submit host. The path is only resolved on the compute nodes: it might be node-local, or on a
+ * filesystem that is not mounted here, so the submission is never rejected.
+ */
+static void pin_check_squashfs(const struct plugin_config *config, const char *image)
+{
+	struct stat st;
+
+	if (!config->submit_check || image[0] != '/')
+		return;
+
+	if (stat(image, &st) < 0 || access(image, R_OK) < 0)
+		slurm_error("pyxis: couldn't check container image %s on this host: %s, continuing", image, strerror(errno));
+	else if (!S_ISREG(st.st_mode))
+		slurm_error("pyxis: container image %s is not a squashfs file on this host, continuing", image);
+}
+
+/*
+ * Runs in the local and allocator contexts, with the credentials of the user, before the job is
+ * submitted. Sets *pinned to the pinned reference of the image, or NULL if the image was not pinned.
+ * Returns -1 if submit_check is enabled and the image doesn't exist.
+ */
+int pin_image(const struct plugin_config *config, const char *image, char **pinned)
+{
+	int ret;
+	char *enroot_uri = NULL;
+	char *digest = NULL;
+	const char *pin;
+	int rv = -1;
+
+	*pinned = NULL;
+
+	if (!pin_enabled(config) || image == NULL)
+		return (0);
+
+	if (strspn(image, "./") > 0) {
+		pin_check_squashfs(config, image);
+		return (0);
+	}
+
+	/* Images from the local Docker daemon don't have a registry digest, and are only on the compute nodes. */
+	if (strncmp("dockerd://", image, sizeof("dockerd://") - 1) == 0)
+		return (0);
+
+	ret = enroot_image_uri(image, &enroot_uri);
+	if (ret < 0)
+		goto fail;
+
+	/* Already pinned by the user, the digest still needs to exist with submit_check. */
+	digest = digest_from_uri(enroot_uri);
+	if (digest != NULL && !config->submit_check) {
+		rv = 0;
+		goto fail;
+	}
+	free(digest);
+	digest = NULL;
+
+	/* Already pinned (and checked) for this job, e.g. srun inside an sbatch allocation. */
+	pin = getenv(PIN_ENV_VAR);
+	if (pin != NULL) {
+		digest = pin_lookup(pin, enroot_uri);
+		if (digest != NULL) {
+			*pinned = strdup(pin);
+			rv = (*pinned == NULL) ? -1 : 0;
+			goto fail;
+		}
+	}
+
+	ret = enroot_exec_read_line_timeout(getuid(), getgid(), 0, NULL, NULL,
+					    (char *const[]){ "enroot", "digest", enroot_uri, NULL },
+					    config->submit_check ? config->submit_check_timeout : 0, &digest);
+	if (ret < 0 && errno == ETIMEDOUT) {
+		/* A slow registry is not a missing image, let the nodes resolve it. */
+		slurm_error("pyxis: couldn't check image %s within %u seconds, continuing", image, config->submit_check_timeout);
+		rv = 0;
+		goto fail;
+	}
+	/* Only "enroot digest" failing is a missing image, not enroot missing or failing to run here. */
+	if (ret < 0 && errno != 0 && config->submit_check) {
+		slurm_error("pyxis: couldn't check image %s on this host, continuing", image);
+		rv = 0;
+		goto fail;
+	}
+	if (ret < 0 || !digest_valid(digest)) {
+		if (config->submit_check && ret < 0) {
+			slurm_error("pyxis: container image %s not found, or not accessible with your registry credentials", image);
+			goto fail;
+		}
+		slurm_error("pyxis: couldn't pin image %s to a digest, each node will resolve it", image);
+		rv = 0;
+		goto fail;
+	}
+
+	ret = digest_pin_uri(enroot_uri, digest, pinned);
+	if (ret < 0)
+		goto fail;
+
+	if (setenv(PIN_ENV_VAR, *pinned, 1) < 0)
+		goto fail;
+
+	slurm_verbose("pyxis: pinned image %s to %s", image, *pinned);
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		free(*pinned);
+		*pinned = NULL;
+	}
+	free(digest);
+	free(enroot_uri);
+
+	return (rv);
+}
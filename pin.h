@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef PIN_H_
+#define PIN_H_
+
+#include <stdbool.h>
+
+#include "config.h"
+
+#define PIN_ENV_VAR "PYXIS_IMAGE_PIN"
+
+bool pin_enabled(const struct plugin_config *config);
+
+int pin_image(const struct plugin_config *config, const char *image, char **pinned);
+
+char *pin_lookup(const char *pin, const char *enroot_uri);
+
+#endif /* PIN_H_ */
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "prefetch.h"
+#include "admission.h"
+#include "cache.h"
+#include "common.h"
+#include "digest.h"
+#include "enroot.h"
+#include "lock.h"
+#include "shared_mount.h"
+
+/*
+ * Images are prefetched into the node-local cache from the job prolog, ahead of the first job step.
+ * The prefetch runs in the background with the credentials of the user (the caller drops privileges
+ * after creating the per-user directories), and holds the same import
+ * lock as the job steps: a step that starts while the image is being fetched waits for the prefetch
+ * and then gets a cache hit.
+ *
+ * The same code backs the pyxis-prefetch command, to fill the cache of a node ahead of time.
+ *
+ * Imports take a slot of the node admission queue (max_concurrent_imports) like job steps, the
+ * queue file is opened by the caller while it still runs as root.
+ */
+
+bool prefetch_supported(const struct plugin_config *config)
+{
+	/* Only the builtin import path can fill the cache. */
+	return (cache_enabled(config) && config->importer_path[0] == '\0' &&
+		config->use_enroot_load != ENROOT_LOAD_ALWAYS);
+}
+
+bool prefetch_enabled(const struct plugin_config *config)
+{
+	return (config->prolog_prefetch && prefetch_supported(config));
+}
+
+/*
+ * Switch the whole process to the credentials of the user, like a job step, and fix the
+ * environment: enroot needs the home directory of the user for registry credentials.
+ */
+int prefetch_become_user(uid_t uid, gid_t gid)
+{
+	int ret;
+	struct passwd *pw;
+
+	ret = setenv("PATH", "/usr/local/bin:/usr/bin:/bin", 0);
+	if (ret < 0)
+		return (-1);
+
+	pw = getpwuid(uid);
+	if (pw == NULL)
+		return (-1);
+
+	ret = setenv("HOME", pw->pw_dir, 1);
+	if (ret < 0)
+		return (-1);
+
+	ret = setenv("USER", pw->pw_name, 1);
+	if (ret < 0)
+		return (-1);
+
+	if (geteuid() != 0)
+		return (getuid() == uid ? 0 : -1);
+
+	ret = initgroups(pw->pw_name, gid);
+	if (ret < 0)
+		return (-1);
+
+	ret = setregid(gid, gid);
+	if (ret < 0)
+		return (-1);
+
+	ret = setreuid(uid, uid);
+	if (ret < 0)
+		return (-1);
+
+	return (0);
+}
+
+static int prefetch_digest(const struct plugin_config *config, uid_t uid, gid_t gid, const char *enroot_uri, char **digest)
+{
+	int ret;
+	bool stale;
+
+	*digest = digest_from_uri(enroot_uri);
+	if (*digest != NULL)
+		return (0);
+
+	if (config->digest_ttl > 0) {
+		ret = digest_cache_lookup(config, uid, enroot_uri, digest, &stale);
+		if (ret == 1 && !stale)
+			return (0);
+		free(*digest);
+		*digest = NULL;
+	}
+
+	ret = enroot_exec_read_line(uid, gid, 0, NULL, NULL,
+				    (char *const[]){ "enroot", "digest", (char *)enroot_uri, NULL }, digest);
+	if (ret < 0)
+		return (-1);
+
+	if (!digest_valid(*digest)) {
+		slurm_error("pyxis: prefetch: invalid digest for image %s: %s", enroot_uri, *digest);
+		free(*digest);
+		*digest = NULL;
+		return (-1);
+	}
+
+	if (config->digest_ttl > 0)
+		(void)digest_cache_update(config, uid, enroot_uri, *digest);
+
+	return (0);
+}
+
+/*
+ * Import an image into the cache of the user. With a job ID, the job references the entry before it
+ * is looked up, so that cache_gc() can't evict it in between; pyxis-prefetch passes 0.
+ * admission_fd is the node admission queue, or -1 if imports are not limited.
+ */
+int prefetch_import(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid, int admission_fd,
+		    const char *enroot_uri, struct prefetch_result *result)
+{
+	int ret;
+	unsigned int position;
+	int lock_fd = -1;
+	int log_fd = -1;
+	pid_t owner;
+	char *digest = NULL;
+	char *digest_uri = NULL;
+	char *temp_path = NULL;
+	char *path = NULL;
+	struct stat st;
+	int rv = -1;
+
+	memset(result, 0, sizeof(*result));
+
+	ret = prefetch_digest(config, uid, gid, enroot_uri, &digest);
+	if (ret < 0) {
+		slurm_error("pyxis: prefetch: couldn't get digest for image: %s", enroot_uri);
+		goto fail;
+	}
+	snprintf(result->digest, sizeof(result->digest), "%s", digest);
+
+	if (jobid != 0)
+		(void)cache_ref_add(config, uid, jobid, digest);
+
+	lock_fd = lock_acquire(config, "import", uid, digest, &owner);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = cache_lookup(config, uid, digest, &path);
+	if (ret < 0)
+		goto fail;
+
+	if (ret == 1) {
+		slurm_verbose("pyxis: prefetch: image %s is already cached", enroot_uri);
+		result->cached = true;
+		goto done;
+	}
+
+	ret = digest_pin_uri(enroot_uri, digest, &digest_uri);
+	if (ret < 0)
+		goto fail;
+
+	ret = cache_temp_path(config, uid, digest, jobid, SLURM_PENDING_STEP, &temp_path);
+	if (ret < 0)
+		goto fail;
+
+	log_fd = pyxis_memfd_create("enroot-log", MFD_CLOEXEC);
+	if (log_fd < 0) {
+		slurm_error("pyxis: prefetch: couldn't create in-memory log file: %s", strerror(errno));
+		goto fail;
+	}
+
+	if (admission_fd >= 0) {
+		ret = admission_acquire(config, admission_fd, &position);
+		if (ret < 0)
+			goto fail;
+		if (position > 0)
+			slurm_verbose("pyxis: prefetch: waited in the node admission queue (position %u)", position);
+	}
+
+	ret = enroot_exec_wait(uid, gid, 0, NULL, log_fd, NULL,
+			       (char *const[]){ "enroot", "import", "--output", temp_path, digest_uri, NULL });
+
+	if (admission_fd >= 0)
+		admission_release(admission_fd);
+
+	if (ret < 0) {
+		slurm_error("pyxis: prefetch: failed to import image: %s", enroot_uri);
+		memfd_print_log(&log_fd, true, "enroot");
+		goto fail;
+	}
+
+	ret = cache_publish(config, uid, digest, temp_path, &path);
+	if (ret < 0)
+		goto fail;
+
+	slurm_info("pyxis: prefetch: imported image %s for job %u", enroot_uri, jobid);
+
+done:
+	if (stat(path, &st) == 0)
+		result->size = st.st_size;
+
+	rv = 0;
+
+fail:
+	if (temp_path != NULL)
+		unlink(temp_path);
+	xclose(log_fd);
+	lock_release(lock_fd);
+	free(path);
+	free(temp_path);
+	free(digest_uri);
+	free(digest);
+
+	return (rv);
+}
+
+static int prefetch_image(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid,
+			  int admission_fd, const char *enroot_uri, struct prefetch_result *result)
+{
+	int ret;
+
+	/* The job is about to use the image, it is protected from cache_gc() until the end of the job. */
+	ret = prefetch_import(config, uid, gid, jobid, admission_fd, enroot_uri, result);
+	if (ret < 0)
+		return (-1);
+
+	/* Mount the image for the steps of the job, the mount must outlive them. */
+	(void)shared_mount_acquire(config, uid, gid, jobid, result->digest);
+
+	return (0);
+}
+
+/*
+ * With kernel_squashfs, the image is imported by a child process with the credentials of the user,
+ * and then mounted as root.
+ */
+static int prefetch_image_mount(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid,
+				int admission_fd, const char *enroot_uri)
+{
+	int ret;
+	int fds[2];
+	pid_t pid;
+	int status;
+	ssize_t n;
+	struct prefetch_result result;
+
+	ret = pipe2(fds, O_CLOEXEC);
+	if (ret < 0)
+		return (-1);
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return (-1);
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+
+		if (prefetch_become_user(uid, gid) < 0)
+			_exit(EXIT_FAILURE);
+
+		if (prefetch_image(config, uid, gid, jobid, admission_fd, enroot_uri, &result) < 0)
+			_exit(EXIT_FAILURE);
+
+		n = write(fds[1], result.digest, strlen(result.digest));
+		_exit(n < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+
+	memset(&result, 0, sizeof(result));
+	do {
+		n = read(fds[0], result.digest, sizeof(result.digest) - 1);
+	} while (n < 0 && errno == EINTR);
+	close(fds[0]);
+
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+	if (n <= 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !digest_valid(result.digest))
+		return (-1);
+
+	return shared_mount_acquire(config, uid, gid, jobid, result.digest);
+}
+
+/*
+ * The prefetch process of a job runs in its own session, its PID is recorded in
+ * <runtime_path>/locks/prefetch.<jobid>, which is only accessible by root. The prefetch process
+ * inherits the file descriptor and keeps the file locked until it exits: the epilog only signals
+ * the process group while the lock is held, the PID can't have been reused.
+ */
+static int prefetch_track_open(const struct plugin_config *config, uint32_t jobid, int flags,
+			       char (*path)[PATH_MAX])
+{
+	int ret;
+
+	ret = snprintf(*path, sizeof(*path), "%s/locks/prefetch.%u", config->runtime_path, jobid);
+	if (ret < 0 || ret >= sizeof(*path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	return open(*path, O_RDWR | O_NOFOLLOW | O_CLOEXEC | flags, 0600);
+}
+
+/* From the job prolog, as root: create and lock the tracking file, before forking the prefetch process. */
+int prefetch_track(const struct plugin_config *config, uint32_t jobid)
+{
+	int fd;
+	char path[PATH_MAX];
+
+	fd = prefetch_track_open(config, jobid, O_CREAT, &path);
+	if (fd < 0) {
+		slurm_error("pyxis: prolog: couldn't open %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0 || ftruncate(fd, 0) < 0) {
+		slurm_error("pyxis: prolog: couldn't lock %s: %s", path, strerror(errno));
+		close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+void prefetch_track_set(int fd, pid_t pid)
+{
+	int ret;
+	char buf[16];
+
+	ret = snprintf(buf, sizeof(buf), "%d\n", pid);
+	if (pwrite(fd, buf, ret, 0) != ret)
+		slurm_error("pyxis: prolog: couldn't record the prefetch process: %s", strerror(errno));
+}
+
+/* From the job epilog, as root: kill the prefetch process of the job if it is still running, and wait for it. */
+int prefetch_cancel(const struct plugin_config *config, uint32_t jobid)
+{
+	int ret;
+	int fd;
+	char path[PATH_MAX];
+	char buf[16] = { 0 };
+	long pid;
+	int rv = -1;
+
+	fd = prefetch_track_open(config, jobid, 0, &path);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return (0);
+		slurm_error("pyxis: epilog: couldn't open %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	ret = flock(fd, LOCK_EX | LOCK_NB);
+	if (ret < 0) {
+		if (errno != EWOULDBLOCK) {
+			slurm_error("pyxis: epilog: couldn't lock %s: %s", path, strerror(errno));
+			goto fail;
+		}
+
+		pid = (pread(fd, buf, sizeof(buf) - 1, 0) > 0) ? strtol(buf, NULL, 10) : 0;
+		if (pid <= 0 || pid != (pid_t)pid) {
+			slurm_error("pyxis: epilog: unknown prefetch process for job %u", jobid);
+			goto fail;
+		}
+
+		slurm_info("pyxis: epilog: killing the image prefetch of job %u", jobid);
+
+		/* The prefetch process might not have created its own session yet. */
+		if (kill(-pid, SIGKILL) < 0 && errno == ESRCH)
+			(void)kill(pid, SIGKILL);
+
+		do {
+			ret = flock(fd, LOCK_EX);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0)
+			goto fail;
+	}
+
+	if (unlink(path) < 0)
+		goto fail;
+
+	rv = 0;
+
+fail:
+	close(fd);
+
+	return (rv);
+}
+
+/* From the job prolog, as root: prefetch the image of the job, and mount it for its steps. */
+int prefetch_job(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid, const char *enroot_uri)
+{
+	int ret;
+	int admission_fd = -1;
+	struct prefetch_result result;
+	int rv = -1;
+
+	if (admission_enabled(config)) {
+		admission_fd = admission_open(config);
+		if (admission_fd < 0)
+			return (-1);
+	}
+
+	if (shared_mount_kernel(config)) {
+		rv = prefetch_image_mount(config, uid, gid, jobid, admission_fd, enroot_uri);
+		goto fail;
+	}
+
+	ret = prefetch_become_user(uid, gid);
+	if (ret < 0) {
+		slurm_error("pyxis: prolog: couldn't prepare the prefetch process");
+		goto fail;
+	}
+
+	rv = prefetch_image(config, uid, gid, jobid, admission_fd, enroot_uri, &result);
+
+fail:
+	xclose(admission_fd);
+
+	return (rv);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "digest.h"
+
+struct prefetch_result {
+	char digest[DIGEST_MAX + 1];
+	bool cached;
+	uint64_t size;
+};
+
+bool prefetch_supported(const struct plugin_config *config);
+
+bool prefetch_enabled(const struct plugin_config *config);
+
+int prefetch_become_user(uid_t uid, gid_t gid);
+
+int prefetch_import(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid, int admission_fd,
+		    const char *enroot_uri, struct prefetch_result *result);
+
+int prefetch_track(const struct plugin_config *config, uint32_t jobid);
+
+void prefetch_track_set(int fd, pid_t pid);
+
+int prefetch_cancel(const struct plugin_config *config, uint32_t jobid);
+
+int prefetch_job(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid, const char *enroot_uri);
+
+#endif /* PREFETCH_H_ */
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "prewarm.h"
+#include "common.h"
+
+/*
+ * With direct squashfuse, the first reads of the container go through FUSE to the squashfs file,
+ * which might be on a network filesystem. With squashfs_prewarm, a background process asks the
+ * kernel to read the file ahead into the page cache while the container starts.
+ *
+ * The metadata of a squashfs file (inode, directory, fragment, export, id and xattr tables) is
+ * stored after the data blocks, from the start of the inode table to the end of the filesystem.
+ * Every path lookup needs it, so it is read first. The data blocks follow from the start of the
+ * file, until squashfs_prewarm bytes were requested in total.
+ *
+ * With squashfs_profile, the first start of a cached image records instead which pages of its
+ * squashfs file were read during the first squashfs_profile seconds of the step: the pages that
+ * mincore(2) reports in the page cache after that delay, but not when the container started. The
+ * profile is a text file next to the squashfs file, in the cache of the user:
+ *   pyxis-profile 1 <size of the squashfs file>
+ *   <offset> <length>
+ *   ...
+ * Later starts of the image request all the ranges of the profile at once, before the tasks of the
+ * step start and before squashfs_prewarm. The step waits at most PREWARM_PROFILE_TIMEOUT seconds for
+ * the requests, the reads themselves complete in the background.
+ *
+ * Everything runs with the credentials of the job. mincore(2) only reports the page cache of files
+ * that the caller can write, the squashfs files of the cache belong to the user.
+ */
+
+#define SQUASHFS_MAGIC 0x73717368
+
+#define PREWARM_PROFILE_HEADER "pyxis-profile 1"
+
+#define PREWARM_CHUNK_SIZE (8 << 20)
+
+struct squashfs_super_block {
+	uint32_t magic;
+	uint32_t inode_count;
+	uint32_t mod_time;
+	uint32_t block_size;
+	uint32_t fragment_count;
+	uint16_t compressor;
+	uint16_t block_log;
+	uint16_t flags;
+	uint16_t id_count;
+	uint16_t version_major;
+	uint16_t version_minor;
+	uint64_t root_inode;
+	uint64_t bytes_used;
+	uint64_t id_table_start;
+	uint64_t xattr_id_table_start;
+	uint64_t inode_table_start;
+	uint64_t directory_table_start;
+	uint64_t fragment_table_start;
+	uint64_t export_table_start;
+} __attribute__((packed));
+
+bool prewarm_enabled(const struct plugin_config *config)
+{
+	return (config->squashfs_prewarm > 0);
+}
+
+bool prewarm_profile_enabled(const struct plugin_config *config)
+{
+	return (config->squashfs_profile > 0);
+}
+
+/*
+ * The squashfs file and its profile can come from the user: don't follow a link, don't block on a
+ * FIFO and only read regular files.
+ */
+static int prewarm_open(const char *path)
+{
+	int fd;
+	struct stat st;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	if (!S_ISREG(st.st_mode)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	return (fd);
+
+fail:
+	close(fd);
+	return (-1);
+}
+
+/* Start reading [start, start + len) in the page cache, in chunks so that it doesn't block for long. */
+static int prewarm_range(int fd, uint64_t start, uint64_t len)
+{
+	int ret;
+	uint64_t chunk;
+
+	while (len > 0) {
+		chunk = len < PREWARM_CHUNK_SIZE ? len : PREWARM_CHUNK_SIZE;
+
+		ret = posix_fadvise(fd, start, chunk, POSIX_FADV_WILLNEED);
+		if (ret != 0) {
+			errno = ret;
+			return (-1);
+		}
+
+		start += chunk;
+		len -= chunk;
+	}
+
+	return (0);
+}
+
+/* Read up to limit bytes of a squashfs file ahead, its metadata first. */
+int prewarm_squashfs(const char *path, uint64_t limit)
+{
+	int ret;
+	int fd;
+	ssize_t n;
+	struct stat st;
+	struct squashfs_super_block sb;
+	uint64_t metadata_start, metadata_end, len;
+	uint64_t total = 0;
+	int rv = -1;
+
+	fd = prewarm_open(path);
+	if (fd < 0) {
+		slurm_info("pyxis: prewarm: couldn't open %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	/* Without a valid superblock, the whole file is data. */
+	metadata_start = metadata_end = st.st_size;
+
+	n = pread(fd, &sb, sizeof(sb), 0);
+	if (n == sizeof(sb) && le32toh(sb.magic) == SQUASHFS_MAGIC &&
+	    le64toh(sb.inode_table_start) < le64toh(sb.bytes_used) && le64toh(sb.bytes_used) <= st.st_size) {
+		metadata_start = le64toh(sb.inode_table_start);
+		metadata_end = le64toh(sb.bytes_used);
+	}
+
+	len = metadata_end - metadata_start;
+	if (len > limit)
+		len = limit;
+
+	ret = prewarm_range(fd, metadata_start, len);
+	if (ret < 0)
+		goto fail;
+	total += len;
+
+	len = metadata_start;
+	if (len > limit - total)
+		len = limit - total;
+
+	ret = prewarm_range(fd, 0, len);
+	if (ret < 0)
+		goto fail;
+	total += len;
+
+	slurm_verbose("pyxis: prewarm: requested %" PRIu64 " bytes of %s", total, path);
+
+	rv = 0;
+
+fail:
+	if (rv < 0)
+		slurm_info("pyxis: prewarm: couldn't read %s ahead: %s", path, strerror(errno));
+	close(fd);
+
+	return (rv);
+}
+
+/* Returns the page cache residency of the file, one byte per page. */
+static unsigned char *prewarm_residency(int fd, size_t size)
+{
+	int ret;
+	void *addr;
+	unsigned char *vec;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	vec = malloc((size + page_size - 1) / page_size);
+	if (vec == NULL)
+		return (NULL);
+
+	addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		free(vec);
+		return (NULL);
+	}
+
+	ret = mincore(addr, size, vec);
+	munmap(addr, size);
+	if (ret < 0) {
+		free(vec);
+		return (NULL);
+	}
+
+	return (vec);
+}
+
+/* Write the ranges of pages that were read during the delay, returns the number of ranges. */
+static ssize_t prewarm_profile_write(FILE *fp, const unsigned char *before, const unsigned char *after, size_t size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t pages = (size + page_size - 1) / page_size;
+	size_t start;
+	ssize_t ranges = 0;
+
+	if (fprintf(fp, "%s %zu\n", PREWARM_PROFILE_HEADER, size) < 0)
+		return (-1);
+
+	for (size_t i = 0; i < pages; ++i) {
+		if (!(after[i] & 1) || (before[i] & 1))
+			continue;
+
+		start = i;
+		while (i + 1 < pages && (after[i + 1] & 1) && !(before[i + 1] & 1))
+			++i;
+
+		if (fprintf(fp, "%zu %zu\n", start * page_size, (i + 1 - start) * page_size) < 0)
+			return (-1);
+		ranges += 1;
+	}
+
+	return (ranges);
+}
+
+/* Record the pages of the squashfs file read during the next seconds, see above. */
+int prewarm_profile_record(const char *path, const char *profile_path, unsigned int seconds)
+{
+	int ret;
+	int fd;
+	int temp_fd = -1;
+	FILE *fp = NULL;
+	struct stat st;
+	unsigned char *before = NULL;
+	unsigned char *after = NULL;
+	char *temp_path = NULL;
+	unsigned int left = seconds;
+	ssize_t ranges;
+	int rv = -1;
+
+	fd = prewarm_open(path);
+	if (fd < 0) {
+		slurm_info("pyxis: prewarm: couldn't open %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0)
+		goto fail;
+
+	before = prewarm_residency(fd, st.st_size);
+	if (before == NULL)
+		goto fail;
+
+	while (left > 0)
+		left = sleep(left);
+
+	after = prewarm_residency(fd, st.st_size);
+	if (after == NULL)
+		goto fail;
+
+	ret = xasprintf(&temp_path, "%s.%d.tmp", profile_path, getpid());
+	if (ret < 0)
+		goto fail;
+
+	temp_fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (temp_fd < 0)
+		goto fail;
+
+	fp = fdopen(temp_fd, "w");
+	if (fp == NULL)
+		goto fail;
+	temp_fd = -1;
+
+	ranges = prewarm_profile_write(fp, before, after, st.st_size);
+	ret = fclose(fp);
+	fp = NULL;
+	if (ranges < 0 || ret != 0)
+		goto fail;
+
+	/* Nothing was read from the file, e.g. it was already in the page cache: try again next time. */
+	if (ranges == 0) {
+		slurm_verbose("pyxis: prewarm: no pages of %s were read, not recording a profile", path);
+		unlink(temp_path);
+		rv = 0;
+		goto fail;
+	}
+
+	ret = rename(temp_path, profile_path);
+	if (ret < 0)
+		goto fail;
+
+	slurm_verbose("pyxis: prewarm: recorded %zd ranges of %s in %s", ranges, path, profile_path);
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		slurm_info("pyxis: prewarm: couldn't record the profile of %s: %s", path, strerror(errno));
+		if (temp_path != NULL)
+			unlink(temp_path);
+	}
+	if (fp != NULL)
+		fclose(fp);
+	xclose(temp_fd);
+	free(temp_path);
+	free(after);
+	free(before);
+	close(fd);
+
+	return (rv);
+}
+
+/*
+ * Returns -1 if an error occurs.
+ * Returns 0 if the image has no profile yet.
+ * Returns 1 once all the ranges of the profile were requested.
+ */
+int prewarm_profile_load(const char *path, const char *profile_path)
+{
+	int ret;
+	int fd;
+	int profile_fd;
+	FILE *fp = NULL;
+	struct stat st;
+	char line[64];
+	uint64_t size, offset, len;
+	uint64_t total = 0;
+	size_t ranges = 0;
+	int rv = -1;
+
+	fd = prewarm_open(path);
+	if (fd < 0) {
+		slurm_info("pyxis: prewarm: couldn't open %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	profile_fd = prewarm_open(profile_path);
+	if (profile_fd < 0) {
+		if (errno == ENOENT)
+			rv = 0;
+		goto fail;
+	}
+
+	fp = fdopen(profile_fd, "r");
+	if (fp == NULL) {
+		close(profile_fd);
+		goto fail;
+	}
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	/* A profile of another file is ignored, and recorded again. */
+	if (fgets(line, sizeof(line), fp) == NULL ||
+	    sscanf(line, PREWARM_PROFILE_HEADER " %" SCNu64, &size) != 1 || size != st.st_size) {
+		slurm_info("pyxis: prewarm: ignoring invalid profile %s", profile_path);
+		rv = 0;
+		goto fail;
+	}
+
+	while (fscanf(fp, "%" SCNu64 " %" SCNu64, &offset, &len) == 2) {
+		if (offset > size || len > size - offset)
+			break;
+
+		ret = prewarm_range(fd, offset, len);
+		if (ret < 0)
+			goto fail;
+
+		total += len;
+		ranges += 1;
+	}
+
+	slurm_verbose("pyxis: prewarm: requested %zu ranges (%" PRIu64 " bytes) of the profile of %s",
+		      ranges, total, path);
+
+	rv = 1;
+
+fail:
+	if (rv < 0)
+		slurm_info("pyxis: prewarm: couldn't load the profile of %s: %s", path, strerror(errno));
+	if (fp != NULL)
+		fclose(fp);
+	close(fd);
+
+	return (rv);
+}
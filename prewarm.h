@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef PREWARM_H_
+#define PREWARM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/* Seconds the step waits for the ranges of a profile to be requested. */
+#define PREWARM_PROFILE_TIMEOUT 5
+
+bool prewarm_enabled(const struct plugin_config *config);
+
+bool prewarm_profile_enabled(const struct plugin_config *config);
+
+int prewarm_squashfs(const char *path, uint64_t limit);
+
+int prewarm_profile_record(const char *path, const char *profile_path, unsigned int seconds);
+
+int prewarm_profile_load(const char *path, const char *profile_path);
+
+#endif /* PREWARM_H_ */
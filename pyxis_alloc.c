@@ -9,8 +9,10 @@
 #include "pyxis_alloc.h"
 #include "args.h"
 #include "config.h"
+#include "pin.h"
 
 struct plugin_context {
+	struct plugin_config config;
 	struct plugin_args *args;
 };
 
@@ -21,15 +23,14 @@ static struct plugin_context context = {
 int pyxis_alloc_init(spank_t sp, int ac, char **av)
 {
 	int ret;
-	struct plugin_config config;
 
-	ret = pyxis_config_parse(&config, ac, av);
+	ret = pyxis_config_parse(&context.config, ac, av);
 	if (ret < 0) {
 		slurm_error("pyxis: failed to parse configuration");
 		return (-1);
 	}
 
-	if (!config.sbatch_support)
+	if (!context.config.sbatch_support)
 		return (0);
 
 	context.args = pyxis_args_register(sp);
@@ -43,12 +44,27 @@ int pyxis_alloc_init(spank_t sp, int ac, char **av)
 
 int pyxis_alloc_post_opt(spank_t sp, int ac, char **av)
 {
+	int ret;
+	char *pinned = NULL;
+
 	/* Check environment variables for default values after command-line processing */
 	pyxis_args_check_environment_variables(sp);
 
 	/* Calling pyxis_args_enabled() for arguments validation */
 	pyxis_args_enabled();
 
+	/* Resolve the image digest once for the whole job, and check that the image exists. */
+	if (context.args != NULL) {
+		ret = pin_image(&context.config, context.args->image, &pinned);
+		if (ret < 0)
+			return (-1);
+	}
+
+	/* Expose the image to the job prolog, for prefetching. */
+	pyxis_args_export_image(sp, pinned);
+
+	free(pinned);
+
 	return (0);
 }
 
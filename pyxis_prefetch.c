@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+/*
+ * pyxis-prefetch: import a list of container images into the node-local image cache, with the
+ * same code and the same cache layout as the job prolog, e.g. before a large reservation.
+ */
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "admission.h"
+#include "cache.h"
+#include "common.h"
+#include "config.h"
+#include "enroot.h"
+#include "lock.h"
+#include "prefetch.h"
+
+#define PREFETCH_DEFAULT_JOBS 4
+
+struct prefetch_report {
+	int status;
+	bool cached;
+	uint64_t size;
+};
+
+struct prefetch_slot {
+	pid_t pid;
+	int fd;
+	int admission_fd;
+	const char *image;
+	struct timespec start;
+};
+
+static bool verbose = false;
+
+/* The shared code logs through Slurm, which is not there outside of the plugin. Errors are always printed. */
+static void prefetch_vlog(const char *level, const char *fmt, va_list ap)
+{
+	char buf[4096];
+
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	if (level != NULL)
+		fprintf(stderr, "%s: %s\n", level, buf);
+	else
+		fprintf(stderr, "%s\n", buf);
+}
+
+void slurm_error(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	prefetch_vlog("error", fmt, ap);
+	va_end(ap);
+}
+
+void slurm_info(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+
+	va_start(ap, fmt);
+	prefetch_vlog(NULL, fmt, ap);
+	va_end(ap);
+}
+
+void slurm_verbose(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+
+	va_start(ap, fmt);
+	prefetch_vlog(NULL, fmt, ap);
+	va_end(ap);
+}
+
+void slurm_spank_log(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	prefetch_vlog(NULL, fmt, ap);
+	va_end(ap);
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp,
+		"Usage: pyxis-prefetch [-c FILE] [-o OPTION]... [-j JOBS] [-u USER] [-v] [LIST]\n"
+		"\n"
+		"Import the container images of LIST (or standard input), one per line, into the node-local\n"
+		"image cache of pyxis. Images use the syntax of --container-image.\n"
+		"\n"
+		"  -c FILE    read the pyxis options from a plugstack.conf file\n"
+		"  -o OPTION  pyxis option, as in plugstack.conf (e.g. cache_path=/var/cache/pyxis)\n"
+		"  -j JOBS    number of concurrent imports (default: %d)\n"
+		"  -u USER    import into the cache of USER, required when running as root\n"
+		"  -v         verbose output\n",
+		PREFETCH_DEFAULT_JOBS);
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static const char *format_size(uint64_t size, char (*buf)[32])
+{
+	const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+	double value = size;
+	size_t i = 0;
+
+	while (value >= 1024 && i < ARRAY_SIZE(units) - 1) {
+		value /= 1024;
+		i += 1;
+	}
+
+	snprintf(*buf, sizeof(*buf), "%.1f %s", value, units[i]);
+
+	return (*buf);
+}
+
+/* Append the options of the pyxis line of a plugstack.conf file, e.g. "required spank_pyxis.so OPTIONS...". */
+static int read_plugstack(const char *path, char ***options, size_t *len)
+{
+	FILE *fp;
+	char *line;
+	char *saveptr;
+	char *token;
+	int field;
+	bool found = false;
+	int rv = 0;
+
+	fp = fopen(path, "re");
+	if (fp == NULL) {
+		fprintf(stderr, "error: couldn't open %s: %s\n", path, strerror(errno));
+		return (-1);
+	}
+
+	while (!found && (line = get_line_from_file(fp)) != NULL) {
+		field = 0;
+		for (token = strtok_r(line, " \t", &saveptr); token != NULL; token = strtok_r(NULL, " \t", &saveptr)) {
+			if (token[0] == '#')
+				break;
+
+			if (field == 1) {
+				found = strlen(token) >= strlen("spank_pyxis.so") &&
+					strcmp(token + strlen(token) - strlen("spank_pyxis.so"), "spank_pyxis.so") == 0;
+				if (!found)
+					break;
+			} else if (field > 1) {
+				if (array_add_unique(options, len, token) < 0) {
+					rv = -1;
+					break;
+				}
+			}
+			field += 1;
+		}
+		free(line);
+	}
+
+	fclose(fp);
+
+	if (rv == 0 && !found) {
+		fprintf(stderr, "error: spank_pyxis.so not found in %s\n", path);
+		rv = -1;
+	}
+
+	return (rv);
+}
+
+/* As root, create the node-wide and per-user directories, like slurmd and the job prolog. */
+static int create_dirs(const struct plugin_config *config, uid_t uid, gid_t gid)
+{
+	int ret;
+	char runtime_dir[PATH_MAX];
+
+	ret = mkdir(config->runtime_path, 0755);
+	if (ret < 0 && errno != EEXIST) {
+		fprintf(stderr, "error: couldn't mkdir %s: %s\n", config->runtime_path, strerror(errno));
+		return (-1);
+	}
+
+	ret = snprintf(runtime_dir, sizeof(runtime_dir), "%s/%u", config->runtime_path, uid);
+	if (ret < 0 || ret >= sizeof(runtime_dir))
+		return (-1);
+
+	if (lock_create_dir(config) < 0 || cache_create_dir(config) < 0 ||
+	    create_user_dir(runtime_dir, uid, gid) < 0 || lock_create_user_dir(config, uid, gid) < 0 ||
+	    cache_create_user_dir(config, uid, gid) < 0)
+		return (-1);
+
+	return (0);
+}
+
+static pid_t start_import(const struct plugin_config *config, uid_t uid, gid_t gid, const char *image,
+			  int admission_fd, int *fd)
+{
+	int ret;
+	int pipe_fds[2];
+	pid_t pid;
+	char *enroot_uri = NULL;
+	struct prefetch_result result;
+	struct prefetch_report report = { .status = -1 };
+
+	ret = pipe2(pipe_fds, O_CLOEXEC);
+	if (ret < 0)
+		return (-1);
+
+	pid = fork();
+	if (pid < 0) {
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+		return (-1);
+	}
+
+	if (pid == 0) {
+		close(pipe_fds[0]);
+
+		/* Squashfs files and images from the local Docker daemon are not cached, like in the prolog. */
+		if (strspn(image, "./") > 0 || strncmp("dockerd://", image, sizeof("dockerd://") - 1) == 0) {
+			slurm_error("pyxis: prefetch: image can't be cached: %s", image);
+		} else if (enroot_image_uri(image, &enroot_uri) == 0) {
+			report.status = prefetch_import(config, uid, gid, 0, admission_fd, enroot_uri, &result);
+			report.cached = result.cached;
+			report.size = result.size;
+		}
+
+		/* Less than PIPE_BUF, the parent reads the report after the child exits. */
+		if (write(pipe_fds[1], &report, sizeof(report)) != sizeof(report))
+			_exit(EXIT_FAILURE);
+		_exit(report.status < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(pipe_fds[1]);
+	*fd = pipe_fds[0];
+
+	return (pid);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	int opt;
+	unsigned int jobs = PREFETCH_DEFAULT_JOBS;
+	const char *user = NULL;
+	char **options = NULL;
+	size_t options_len = 0;
+	struct plugin_config config;
+	struct passwd *pw;
+	uid_t uid;
+	gid_t gid;
+	FILE *fp = stdin;
+	char **images = NULL;
+	size_t images_len = 0;
+	char *line, *image;
+	struct prefetch_slot *slots = NULL;
+	size_t next = 0, running = 0;
+	struct prefetch_report report;
+	struct timespec start;
+	pid_t pid;
+	int status;
+	size_t imported = 0, cached = 0, failed = 0;
+	uint64_t imported_size = 0;
+	char size_buf[32];
+	int rv = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "c:o:j:u:vh")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (read_plugstack(optarg, &options, &options_len) < 0)
+				goto fail;
+			break;
+		case 'o':
+			if (array_add_unique(&options, &options_len, optarg) < 0)
+				goto fail;
+			break;
+		case 'j':
+			if (parse_unsigned(optarg, &jobs) < 0 || jobs == 0) {
+				fprintf(stderr, "error: invalid number of jobs: %s\n", optarg);
+				goto fail;
+			}
+			break;
+		case 'u':
+			user = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			usage(stdout);
+			rv = EXIT_SUCCESS;
+			goto fail;
+		default:
+			usage(stderr);
+			goto fail;
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage(stderr);
+		goto fail;
+	}
+
+	ret = pyxis_config_parse(&config, options_len, options);
+	if (ret < 0)
+		goto fail;
+
+	if (!prefetch_supported(&config)) {
+		fprintf(stderr, "error: the image cache is not enabled, or images are not imported by pyxis (importer, use_enroot_load)\n");
+		goto fail;
+	}
+
+	if (geteuid() == 0 && user == NULL) {
+		fprintf(stderr, "error: -u USER is required when running as root\n");
+		goto fail;
+	}
+
+	pw = (user != NULL) ? getpwnam(user) : getpwuid(getuid());
+	if (pw == NULL) {
+		fprintf(stderr, "error: unknown user: %s\n", user != NULL ? user : "(current)");
+		goto fail;
+	}
+	uid = pw->pw_uid;
+	gid = pw->pw_gid;
+
+	slots = calloc(jobs, sizeof(*slots));
+	if (slots == NULL)
+		goto fail;
+	for (size_t i = 0; i < jobs; ++i)
+		slots[i].admission_fd = -1;
+
+	if (geteuid() == 0) {
+		ret = create_dirs(&config, uid, gid);
+		if (ret < 0)
+			goto fail;
+
+		/*
+		 * The queue file is only accessible by root. flock(2) locks are shared by the processes
+		 * using the same open file, each slot needs its own.
+		 */
+		for (size_t i = 0; admission_enabled(&config) && i < jobs; ++i) {
+			slots[i].admission_fd = admission_open(&config);
+			if (slots[i].admission_fd < 0)
+				goto fail;
+		}
+	} else if (admission_enabled(&config) && jobs > config.max_concurrent_imports) {
+		/* Without privileges, the node admission queue can't be used: stay within its limit. */
+		jobs = config.max_concurrent_imports;
+	}
+
+	/* Without privileges, the directories were created by pyxis for a previous job of the user. */
+	ret = prefetch_become_user(uid, gid);
+	if (ret < 0) {
+		fprintf(stderr, "error: couldn't switch to user %s\n", pw->pw_name);
+		goto fail;
+	}
+
+	if (optind < argc && strcmp(argv[optind], "-") != 0) {
+		fp = fopen(argv[optind], "re");
+		if (fp == NULL) {
+			fprintf(stderr, "error: couldn't open %s: %s\n", argv[optind], strerror(errno));
+			goto fail;
+		}
+	}
+
+	/* '#' is also the registry separator of enroot URIs, only full lines are comments. */
+	while ((line = get_line_from_file(fp)) != NULL) {
+		image = line + strspn(line, " \t");
+		image[strcspn(image, " \t")] = '\0';
+		if (image[0] != '\0' && image[0] != '#' && array_add_unique(&images, &images_len, image) < 0) {
+			free(line);
+			goto fail;
+		}
+		free(line);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (next < images_len || running > 0) {
+		/* Fill all the free slots, then wait for any import to finish. */
+		if (next < images_len && running < jobs) {
+			for (size_t i = 0; i < jobs; ++i) {
+				if (slots[i].pid > 0)
+					continue;
+
+				slots[i].image = images[next++];
+				clock_gettime(CLOCK_MONOTONIC, &slots[i].start);
+				slots[i].pid = start_import(&config, uid, gid, slots[i].image, slots[i].admission_fd,
+							     &slots[i].fd);
+				if (slots[i].pid < 0) {
+					fprintf(stderr, "error: couldn't start the import of %s: %s\n", slots[i].image, strerror(errno));
+					slots[i].pid = 0;
+					failed += 1;
+					break;
+				}
+				running += 1;
+				break;
+			}
+			continue;
+		}
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (size_t i = 0; i < jobs; ++i) {
+			if (slots[i].pid != pid)
+				continue;
+
+			if (read(slots[i].fd, &report, sizeof(report)) != sizeof(report))
+				report.status = -1;
+			close(slots[i].fd);
+
+			if (report.status < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+				printf("failed %s after %.1f s\n", slots[i].image, elapsed(&slots[i].start));
+				failed += 1;
+			} else if (report.cached) {
+				printf("cached %s (%s)\n", slots[i].image, format_size(report.size, &size_buf));
+				cached += 1;
+			} else {
+				printf("imported %s (%s) in %.1f s\n", slots[i].image, format_size(report.size, &size_buf),
+				       elapsed(&slots[i].start));
+				imported += 1;
+				imported_size += report.size;
+			}
+			fflush(stdout);
+
+			slots[i].pid = 0;
+			running -= 1;
+		}
+	}
+
+	printf("%zu images: %zu imported (%s), %zu already cached, %zu failed, in %.1f s\n", images_len, imported,
+	       format_size(imported_size, &size_buf), cached, failed, elapsed(&start));
+
+	if (failed == 0)
+		rv = EXIT_SUCCESS;
+
+fail:
+	if (fp != NULL && fp != stdin)
+		fclose(fp);
+	for (size_t i = 0; slots != NULL && i < jobs; ++i)
+		xclose(slots[i].admission_fd);
+	free(slots);
+	array_free(&images, &images_len);
+	array_free(&options, &options_len);
+
+	return (rv);
+}
@@ -2,6 +2,8 @@
  * Copyright (c) 2019-2026, NVIDIA CORPORATION. All rights reserved.
  */
 
+#include <sys/wait.h>
+
 #include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
@@ -9,6 +11,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <slurm/spank.h>
 
@@ -17,6 +20,13 @@
 #include "common.h"
 #include "config.h"
 #include "enroot.h"
+#include "cache.h"
+#include "lock.h"
+#include "prefetch.h"
+#include "staging.h"
+#include "scratch.h"
+#include "overlay.h"
+#include "shared_mount.h"
 
 int pyxis_slurmd_init(spank_t sp, int ac, char **av)
 {
@@ -42,6 +52,18 @@ int pyxis_slurmd_init(spank_t sp, int ac, char **av)
 		goto fail;
 	}
 
+	ret = lock_create_dir(&config);
+	if (ret < 0)
+		goto fail;
+
+	ret = cache_create_dir(&config);
+	if (ret < 0)
+		goto fail;
+
+	/* Reclaim space left by jobs that ran before slurmd was restarted. */
+	if (cache_gc(&config) < 0)
+		slurm_error("pyxis: couldn't enforce the image cache limits");
+
 	rv = 0;
 
 fail:
@@ -185,9 +207,6 @@ int slurm_spank_job_epilog(spank_t sp, int ac, char **av)
 		return (-1);
 	}
 
-	if (config.container_scope != SCOPE_JOB)
-		return (0);
-
 	ret = job_epilog_fixup();
 	if (ret < 0) {
 		slurm_error("pyxis: epilog: couldn't prepare the job epilog process");
@@ -212,6 +231,47 @@ int slurm_spank_job_epilog(spank_t sp, int ac, char **av)
 		return (-1);
 	}
 
+	/* Before the cleanup of the cache, the prefetch process might still be importing the image. */
+	if (prefetch_enabled(&config)) {
+		ret = prefetch_cancel(&config, jobid);
+		if (ret < 0)
+			slurm_error("pyxis: epilog: couldn't stop the image prefetch of job %u", jobid);
+	}
+
+	ret = scratch_cleanup(&config, uid, jobid);
+	if (ret < 0)
+		slurm_error("pyxis: epilog: couldn't cleanup temporary squashfs files for job %u", jobid);
+
+	ret = overlay_cleanup(&config, uid, jobid);
+	if (ret < 0)
+		slurm_error("pyxis: epilog: couldn't cleanup container filesystems for job %u", jobid);
+
+	ret = shared_mount_release(&config, uid, jobid);
+	if (ret < 0)
+		slurm_error("pyxis: epilog: couldn't release shared image mounts of job %u", jobid);
+
+	ret = cache_ref_release(&config, uid, jobid);
+	if (ret < 0)
+		slurm_error("pyxis: epilog: couldn't release cached images of job %u", jobid);
+
+	/* Lookups happen without privileges, the node-wide limits of the cache are enforced here. */
+	ret = cache_gc(&config);
+	if (ret < 0)
+		slurm_error("pyxis: epilog: couldn't enforce the image cache size limit");
+
+	if (staging_enabled(&config)) {
+		ret = staging_cleanup(&config, uid, gid, jobid);
+		if (ret < 0)
+			slurm_error("pyxis: epilog: couldn't cleanup staged images for job %u", jobid);
+	}
+
+	if (config.container_scope != SCOPE_JOB)
+		return (0);
+
+	ret = overlay_container_cleanup(&config, uid, jobid);
+	if (ret < 0)
+		slurm_error("pyxis: epilog: couldn't cleanup overlay containers for job %u", jobid);
+
 	ret = pyxis_container_cleanup(uid, gid, jobid);
 	if (ret < 0) {
 		slurm_error("pyxis: epilog: couldn't cleanup pyxis containers for job %u", jobid);
@@ -221,6 +281,131 @@ int slurm_spank_job_epilog(spank_t sp, int ac, char **av)
 	return (0);
 }
 
+/*
+ * Start importing the container image of the job into the node-local cache, without delaying the
+ * start of the job. The image is passed by srun/sbatch/salloc through the job control environment.
+ */
+int slurm_spank_job_prolog(spank_t sp, int ac, char **av)
+{
+	struct plugin_config config;
+	spank_err_t rc;
+	uid_t uid;
+	gid_t gid;
+	uint32_t jobid;
+	const char *image;
+	char runtime_dir[PATH_MAX];
+	char *enroot_uri = NULL;
+	int lock_fd = -1;
+	int track_fd = -1;
+	pid_t pid;
+	int ret;
+
+	ret = pyxis_config_parse(&config, ac, av);
+	if (ret < 0) {
+		slurm_error("pyxis: prolog: failed to parse configuration");
+		return (-1);
+	}
+
+	if (!prefetch_enabled(&config))
+		return (0);
+
+	image = getenv("SPANK_PYXIS_CONTAINER_IMAGE");
+	if (image == NULL || *image == '\0')
+		return (0);
+
+	/* Squashfs files and images from the local Docker daemon are not cached. */
+	if (strspn(image, "./") > 0 || strncmp("dockerd://", image, sizeof("dockerd://") - 1) == 0)
+		return (0);
+
+	rc = spank_get_item(sp, S_JOB_UID, &uid);
+	if (rc != ESPANK_SUCCESS) {
+		slurm_error("pyxis: prolog: couldn't get job uid: %s", spank_strerror(rc));
+		return (-1);
+	}
+
+	rc = spank_get_item(sp, S_JOB_GID, &gid);
+	if (rc != ESPANK_SUCCESS) {
+		slurm_error("pyxis: prolog: couldn't get job gid: %s", spank_strerror(rc));
+		return (-1);
+	}
+
+	rc = spank_get_item(sp, S_JOB_ID, &jobid);
+	if (rc != ESPANK_SUCCESS) {
+		slurm_error("pyxis: prolog: couldn't get job ID: %s", spank_strerror(rc));
+		return (-1);
+	}
+
+	ret = snprintf(runtime_dir, sizeof(runtime_dir), "%s/%u", config.runtime_path, uid);
+	if (ret < 0 || ret >= sizeof(runtime_dir))
+		return (-1);
+
+	/* The per-user runtime directory holds the digest map. */
+	ret = create_user_dir(runtime_dir, uid, gid);
+	if (ret < 0)
+		return (-1);
+
+	ret = lock_create_user_dir(&config, uid, gid);
+	if (ret < 0)
+		return (-1);
+
+	ret = cache_create_user_dir(&config, uid, gid);
+	if (ret < 0)
+		return (-1);
+
+	ret = enroot_image_uri(image, &enroot_uri);
+	if (ret < 0)
+		return (-1);
+
+	/*
+	 * Take the prefetch lock before returning from the prolog, job steps wait on it. They key it
+	 * by the same URI, before the image is pinned to a digest.
+	 * If it is already held, the same image is being prefetched for another job of this user.
+	 */
+	ret = lock_try_acquire(&config, "prefetch", uid, enroot_uri, &lock_fd);
+	if (ret <= 0)
+		goto out;
+
+	/* The epilog kills the prefetch process if the job ends before it. */
+	track_fd = prefetch_track(&config, jobid);
+	if (track_fd < 0)
+		goto out;
+
+	pid = fork();
+	if (pid < 0) {
+		slurm_error("pyxis: prolog: fork error: %s", strerror(errno));
+		goto out;
+	}
+
+	if (pid == 0) {
+		/* Double fork, so that the prefetch process is reparented and slurmd doesn't wait for it. */
+		pid = fork();
+		if (pid != 0) {
+			if (pid > 0)
+				prefetch_track_set(track_fd, pid);
+			_exit(pid < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+
+		setsid();
+		lock_set_owner(lock_fd);
+
+		slurm_info("pyxis: prolog: prefetching image %s for job %u", enroot_uri, jobid);
+		ret = prefetch_job(&config, uid, gid, jobid, enroot_uri);
+
+		lock_release(lock_fd);
+		_exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+
+out:
+	/* The locks are still held by the prefetch process, through the inherited file descriptors. */
+	xclose(track_fd);
+	xclose(lock_fd);
+	free(enroot_uri);
+
+	return (0);
+}
+
 int pyxis_slurmd_exit(spank_t sp, int ac, char **av)
 {
 	return (0);
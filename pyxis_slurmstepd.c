@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <grp.h>
 #include <paths.h>
 #include <pthread.h>
 #include <sched.h>
@@ -33,12 +34,28 @@
 #include "seccomp_filter.h"
 #include "enroot.h"
 #include "importer.h"
+#include "cache.h"
+#include "lock.h"
+#include "digest.h"
+#include "prefetch.h"
+#include "pin.h"
+#include "staging.h"
+#include "admission.h"
+#include "scratch.h"
+#include "overlay.h"
+#include "shared_mount.h"
+#include "prewarm.h"
 
 struct container {
 	char *name;
 	char *squashfs_path;
 	char *save_path;
 	char *cwd_path;
+	char *digest;
+	char *overlay_path;
+	char *container_path;
+	char *clone_path;
+	int container_lock_fd;
 	bool reuse_rootfs;
 	bool reuse_ns;
 	bool temporary_rootfs;
@@ -46,6 +63,11 @@ struct container {
 	bool use_enroot_load;
 	bool use_importer;
 	bool use_squashfuse;
+	bool use_cache;
+	bool use_staging;
+	bool use_overlay;
+	bool shared_mount;
+	bool job_rootfs;
 	int userns_fd;
 	int mntns_fd;
 	int cgroupns_fd;
@@ -62,10 +84,14 @@ struct job_info {
 	bool privileged;
 	uint32_t jobid;
 	uint32_t stepid;
+	uint32_t nnodes;
+	uint32_t nodeid;
 	uint32_t local_task_count;
 	uint32_t total_task_count;
 	char **environ;
 	char cwd[PATH_MAX];
+	char image_pin[PATH_MAX];
+	cpu_set_t cpus;
 };
 
 struct shared_memory {
@@ -75,6 +101,7 @@ struct shared_memory {
 	atomic_uint completed_tasks;
 	pid_t pid;
 	pid_t ns_pid;
+	char importer_result[1024];
 };
 
 struct plugin_context {
@@ -86,6 +113,7 @@ struct plugin_context {
 	struct container container;
 	int user_init_rv;
 	struct shared_memory *shm;
+	int admission_fd;
 };
 
 static double timespec_diff_ms(const struct timespec *start, const struct timespec *end)
@@ -105,13 +133,15 @@ static struct plugin_context context = {
 		.environ = NULL, .cwd = { 0 }
 	},
 	.container = {
-		.name = NULL, .squashfs_path = NULL, .save_path = NULL, .cwd_path = NULL,
-		.reuse_rootfs = false, .reuse_ns = false, .temporary_rootfs = false,
+		.name = NULL, .squashfs_path = NULL, .save_path = NULL, .cwd_path = NULL, .digest = NULL,
+		.overlay_path = NULL, .container_path = NULL, .clone_path = NULL, .container_lock_fd = -1, .reuse_rootfs = false, .reuse_ns = false, .temporary_rootfs = false,
 		.use_enroot_import = false, .use_enroot_load = false,
-		.use_importer = false, .use_squashfuse = false,
+		.use_importer = false, .use_squashfuse = false, .use_cache = false, .use_staging = false,
+		.use_overlay = false, .shared_mount = false, .job_rootfs = false,
 		.userns_fd = -1, .mntns_fd = -1, .cgroupns_fd = -1, .netns_fd = -1, .ipcns_fd = -1, .utsns_fd = -1,
 	},
 	.user_init_rv = 0,
+	.admission_fd = -1,
 };
 
 static bool pyxis_execute_entrypoint(void)
@@ -126,6 +156,87 @@ static bool pyxis_can_direct_start_squashfs(void)
 	       context.args->container_save == NULL;
 }
 
+/* Named containers of cached images are an overlay with a persistent upper directory. */
+static bool pyxis_can_overlay_named_container(void)
+{
+	return overlay_enabled(&context.config) || shared_mount_enabled(&context.config);
+}
+
+/* A named container on an overlay is mounted again from the cached image it was created from. */
+static int container_overlay_init(const char *name)
+{
+	int ret;
+
+	/* Referenced before the lookup, cache_gc() could evict the entry right after it otherwise. */
+	(void)cache_ref_add(&context.config, context.job.uid, context.job.jobid, context.container.digest);
+
+	ret = cache_lookup(&context.config, context.job.uid, context.container.digest, &context.container.squashfs_path);
+	if (ret <= 0) {
+		slurm_error("pyxis: error: the image of container \"%s\" is no longer in the cache", name);
+		return (-1);
+	}
+
+	context.container.use_cache = true;
+	context.container.use_overlay = true;
+	context.container.shared_mount = shared_mount_enabled(&context.config);
+
+	return (0);
+}
+
+/* A clone is a new named container, on the image and with the changes of an existing one. */
+static int container_clone_init(void)
+{
+	int ret;
+	char *source_name = NULL;
+	char *digest = NULL;
+	int rv = -1;
+
+	if (!pyxis_can_overlay_named_container()) {
+		slurm_error("pyxis: error: the \"clone\" flag of --container-name requires use_overlay or shared_squashfuse");
+		goto fail;
+	}
+
+	if (context.config.container_scope == SCOPE_JOB)
+		ret = xasprintf(&source_name, "pyxis_%u_%s", context.job.jobid, context.args->container_clone);
+	else
+		ret = xasprintf(&source_name, "pyxis_%s", context.args->container_clone);
+	if (ret < 0)
+		goto fail;
+
+	ret = overlay_container_path(&context.config, context.job.uid, source_name, &context.container.clone_path);
+	if (ret < 0)
+		goto fail;
+
+	ret = overlay_container_lookup(context.container.clone_path, &digest);
+	if (ret < 0)
+		goto fail;
+	if (ret == 0) {
+		slurm_error("pyxis: error: container to clone \"%s\" does not exist", context.args->container_clone);
+		goto fail;
+	}
+
+	context.container.digest = digest;
+	digest = NULL;
+
+	if (context.args->image != NULL)
+		slurm_spank_log("pyxis: ignoring --container-image when cloning a container");
+
+	/* Nothing to import, the clone is created when the step mounts it. */
+	context.container.reuse_rootfs = true;
+
+	ret = container_overlay_init(source_name);
+	if (ret < 0)
+		goto fail;
+
+	rv = 0;
+
+fail:
+	free(digest);
+	free(source_name);
+
+	return (rv);
+}
+
 int pyxis_slurmstepd_init(spank_t sp, int ac, char **av)
 {
 	int ret;
@@ -192,6 +303,18 @@ static int job_get_info(spank_t sp, struct job_info *job)
 		goto fail;
 	}
 
+	rc = spank_get_item(sp, S_JOB_NNODES, &job->nnodes);
+	if (rc != ESPANK_SUCCESS) {
+		slurm_error("pyxis: couldn't get job node count: %s", spank_strerror(rc));
+		goto fail;
+	}
+
+	rc = spank_get_item(sp, S_JOB_NODEID, &job->nodeid);
+	if (rc != ESPANK_SUCCESS) {
+		slurm_error("pyxis: couldn't get job node ID: %s", spank_strerror(rc));
+		goto fail;
+	}
+
 	rc = spank_get_item(sp, S_JOB_LOCAL_TASK_COUNT, &job->local_task_count);
 	if (rc != ESPANK_SUCCESS) {
 		slurm_error("pyxis: couldn't get job local task count: %s", spank_strerror(rc));
@@ -209,6 +332,10 @@ static int job_get_info(spank_t sp, struct job_info *job)
 	if (rc != ESPANK_SUCCESS)
 		slurm_info("pyxis: couldn't get job cwd path: %s", spank_strerror(rc));
 
+	rc = spank_getenv(sp, PIN_ENV_VAR, job->image_pin, sizeof(job->image_pin));
+	if (rc != ESPANK_SUCCESS)
+		job->image_pin[0] = '\0';
+
 	rc = spank_getenv(sp, "ENROOT_ALLOW_SUPERUSER", allow_superuser, sizeof(allow_superuser));
 	if (rc == ESPANK_SUCCESS) {
 		if (job->uid == 0 && strcasecmp(allow_superuser, "no") != 0 && strcasecmp(allow_superuser, "false") != 0 &&
@@ -264,7 +391,10 @@ fail:
 	return (rv);
 }
 
-/* As root, create the per-user runtime directory where temporary squashfs files are stored. */
+/*
+ * As root, create the per-user runtime directory where temporary squashfs files and the digest map
+ * are stored.
+ */
 static int enroot_create_user_runtime_dir(void)
 {
 	int ret;
@@ -274,22 +404,7 @@ static int enroot_create_user_runtime_dir(void)
 	if (ret < 0 || ret >= sizeof(path))
 		return (-1);
 
-	ret = mkdir(path, 0700);
-	if (ret < 0 && errno != EEXIST) {
-		slurm_error("pyxis: couldn't mkdir %s: %s", path, strerror(errno));
-		return (-1);
-	}
-	if (ret < 0 && errno == EEXIST)
-		return (0);
-
-	ret = chown(path, context.job.uid, context.job.gid);
-	if (ret < 0) {
-		slurm_error("pyxis: couldn't chown %s: %s", path, strerror(errno));
-		rmdir(path);
-		return (-1);
-	}
-
-	return (0);
+	return create_user_dir(path, context.job.uid, context.job.gid);
 }
 
 int pyxis_slurmstepd_post_opt(spank_t sp, int ac, char **av)
@@ -312,6 +427,27 @@ int pyxis_slurmstepd_post_opt(spank_t sp, int ac, char **av)
 	if (ret < 0)
 		return (-1);
 
+	ret = lock_create_user_dir(&context.config, context.job.uid, context.job.gid);
+	if (ret < 0)
+		return (-1);
+
+	ret = scratch_create_user_dirs(&context.config, context.job.uid, context.job.gid);
+	if (ret < 0)
+		return (-1);
+
+	/* The admission queue is shared by all users, it can only be opened as root. */
+	if (admission_enabled(&context.config)) {
+		context.admission_fd = admission_open(&context.config);
+		if (context.admission_fd < 0)
+			return (-1);
+	}
+
+	if (cache_enabled(&context.config)) {
+		ret = cache_create_user_dir(&context.config, context.job.uid, context.job.gid);
+		if (ret < 0)
+			return (-1);
+	}
+
 	return (0);
 }
 
@@ -385,6 +521,7 @@ static const struct {
 	PYXIS_ENV_ENTRY("ENROOT_CONNECT_TIMEOUT="),
 	PYXIS_ENV_ENTRY("ENROOT_MAX_CONNECTIONS="),
 	PYXIS_ENV_ENTRY("ENROOT_ALLOW_HTTP="),
+	PYXIS_ENV_ENTRY("PYXIS_IMAGE_DIGEST="),
 	{ NULL, 0 }
 };
 #undef PYXIS_ENV_ENTRY
@@ -430,6 +567,9 @@ static int setenv_unsigned(const char *name, unsigned int value)
 
 static int enroot_set_env(void)
 {
+	int ret;
+	char data_path[PATH_MAX];
+
 	if (slurm_clear_env() < 0)
 		return (-1);
 
@@ -494,6 +634,38 @@ static int enroot_set_env(void)
 	if (setenv("PYXIS_VERSION", PYXIS_VERSION, 1) < 0)
 		return (-1);
 
+	if (context.container.digest != NULL) {
+		if (setenv("PYXIS_IMAGE_DIGEST", context.container.digest, 1) < 0)
+			return (-1);
+	}
+
+	/* The overlay container of the step lives in its own data directory, see overlay.c. */
+	if (context.container.use_overlay) {
+		ret = snprintf(data_path, sizeof(data_path), "%s/data", context.container.overlay_path);
+		if (ret < 0 || ret >= sizeof(data_path))
+			return (-1);
+
+		if (setenv("ENROOT_DATA_PATH", data_path, 1) < 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Helpers importing or extracting images run from the first task, which might be bound to a
+ * single CPU. Give them all the CPUs of the step instead, enroot sizes its parallel stages
+ * (ENROOT_MAX_PROCESSORS defaults to nproc) from the affinity.
+ */
+static int enroot_set_env_step_cpus(void)
+{
+	if (enroot_set_env() < 0)
+		return (-1);
+
+	/* Best effort, the helper can still run on the CPUs of the task. */
+	if (CPU_COUNT(&context.job.cpus) > 0)
+		(void)sched_setaffinity(0, sizeof(context.job.cpus), &context.job.cpus);
+
 	return (0);
 }
 
@@ -515,6 +687,12 @@ static FILE *enroot_exec_output_ctx(char *const argv[])
 				  enroot_set_env, argv);
 }
 
+static int enroot_exec_read_line_ctx(char *const argv[], char **line)
+{
+	return enroot_exec_read_line(context.job.uid, context.job.gid, context.job.ngids, context.job.gids,
+				     enroot_set_env, argv, line);
+}
+
 static void enroot_print_log_ctx(bool error)
 {
 	if (context.log_fd >= 0)
@@ -529,235 +707,948 @@ static void enroot_print_log_ctx(bool error)
  */
 static int enroot_container_get(const char *name, pid_t *pid)
 {
-	FILE *fp;
-	char *line;
-	char *ctr_name, *ctr_pid, *saveptr;
-	unsigned long n;
-	int rv = -1;
+	FILE *fp;
+	char *line;
+	char *ctr_name, *ctr_pid, *saveptr;
+	unsigned long n;
+	int rv = -1;
+
+	if (name == NULL || strlen(name) == 0 || pid == NULL)
+		return (-1);
+
+	*pid = -1;
+
+	fp = enroot_exec_output_ctx((char *const[]){ "enroot", "list", "-f", NULL });
+	if (fp == NULL) {
+		slurm_error("pyxis: couldn't get list of existing container filesystems");
+		return (-1);
+	}
+
+	/* Skip headers line */
+	line = get_line_from_file(fp);
+	if (line == NULL) {
+		slurm_error("pyxis: \"enroot list -f\" did not produce any usable output");
+		goto fail;
+	}
+	free(line);
+	line = NULL;
+
+	while ((line = get_line_from_file(fp)) != NULL) {
+		ctr_name = strtok_r(line, " ", &saveptr);
+		if (ctr_name == NULL || *ctr_name == '\0')
+			goto fail;
+
+		if (strcmp(name, ctr_name) == 0) {
+			ctr_pid = strtok_r(NULL, " ", &saveptr);
+			if (ctr_pid == NULL || *ctr_pid == '\0') {
+				*pid = 0;
+			} else {
+				errno = 0;
+				n = strtoul(ctr_pid, NULL, 10);
+				if (errno != 0 || n != (pid_t)n)
+					goto fail;
+
+				*pid = (pid_t)n;
+			}
+
+			break;
+		}
+
+		free(line);
+		line = NULL;
+	}
+
+	rv = 0;
+
+fail:
+	free(line);
+	if (fp) fclose(fp);
+	return (rv);
+}
+
+static int read_proc_environ(pid_t pid, char **result, size_t *size)
+{
+	int ret;
+	char path[PATH_MAX];
+	int fd = -1;
+	char *buf = NULL;
+	size_t len = 0, capacity = 1024;
+	ssize_t n;
+	char *new_buf = NULL;
+	int rv = -1;
+
+	ret = snprintf(path, sizeof(path), "/proc/%d/environ", pid);
+	if (ret < 0 || ret >= sizeof(path))
+		goto fail;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto fail;
+
+	buf = malloc(capacity + 1);
+	if (buf == NULL)
+		goto fail;
+
+	while ((n = read(fd, buf + len, capacity - len)) > 0) {
+		len += n;
+
+		if (capacity - len == 0) {
+			/* Grow buffer. */
+			capacity *= 2;
+
+			new_buf = realloc(buf, capacity + 1);
+			if (new_buf == NULL)
+				goto fail;
+
+			buf = new_buf;
+		}
+	}
+
+	if (n < 0)
+		goto fail;
+
+	/* From man 5 proc, there might not be a null byte at the end. */
+	if (len > 0 && buf[len - 1] != '\0') {
+		buf[len] = '\0';
+		len += 1;
+	}
+
+	*result = buf;
+	*size = len;
+	rv = 0;
+
+fail:
+	xclose(fd);
+	if (rv < 0)
+		free(buf);
+
+	return (rv);
+}
+
+static const char *container_deny_env[] = {
+	"LANG",
+	"LANGUAGE",
+	"LC_ALL",
+	NULL
+};
+
+static int spank_import_container_env(spank_t sp, pid_t pid)
+{
+	int ret;
+	char *proc_environ = NULL;
+	size_t size;
+	spank_err_t rc;
+	int overwrite;
+	int rv = -1;
+
+	/* First, remove unwanted locale environment variables from the job */
+	for (int i = 0; container_deny_env[i] != NULL; ++i) {
+		/* Check if the user explicitly requested this environment variable to be preserved */
+		if (array_contains(context.args->env_vars, context.args->env_vars_len, container_deny_env[i]))
+			continue;
+
+		rc = spank_unsetenv(sp, container_deny_env[i]);
+		if (rc != ESPANK_SUCCESS) {
+			slurm_error("pyxis: failed to unset %s: %s", container_deny_env[i], spank_strerror(rc));
+			goto fail;
+		}
+	}
+
+	ret = read_proc_environ(pid, &proc_environ, &size);
+	if (ret < 0) {
+		slurm_error("pyxis: couldn't read /proc/%d/environ", pid);
+		goto fail;
+	}
+
+	for (size_t i = 0; i < size;) {
+		char *key, *value;
+
+		value = proc_environ + i;
+		key = strsep(&value, "=");
+
+		if (value == NULL) {
+			i += strlen(key) + 1;
+			continue;
+		}
+
+		overwrite = 1;
+		if (array_contains(context.args->env_vars, context.args->env_vars_len, key))
+			overwrite = 0;
+
+		rc = spank_setenv(sp, key, value, overwrite);
+		if (rc != ESPANK_SUCCESS && rc != ESPANK_ENV_EXISTS) {
+			slurm_error("pyxis: failed to set %s: %s", key, spank_strerror(rc));
+			goto fail;
+		}
+		i += strlen(key) + 1 + strlen(value) + 1;
+	}
+
+	rv = 0;
+
+fail:
+	free(proc_environ);
+	return (rv);
+}
+
+/* Query the registry for the current digest of the image. */
+static int enroot_digest_resolve(const char *enroot_uri, char **digest)
+{
+	int ret;
+
+	ret = enroot_exec_read_line_ctx((char *const[]){ "enroot", "digest", (char *)enroot_uri, NULL }, digest);
+	if (ret < 0) {
+		slurm_error("pyxis: couldn't get digest for image: %s", context.args->image);
+		return (-1);
+	}
+
+	if (!digest_valid(*digest)) {
+		slurm_error("pyxis: invalid digest for image %s: %s", context.args->image, *digest);
+		free(*digest);
+		*digest = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * In a process forked from slurmstepd, switch to the credentials of the job and close the fds of
+ * slurmstepd, like enroot_exec() does before running enroot.
+ */
+static int job_drop_privileges(void)
+{
+	int ret;
+
+	ret = close_extra_fds();
+	if (ret < 0)
+		return (-1);
+
+	if (geteuid() == 0) {
+		ret = setgroups(context.job.ngids, context.job.gids);
+		if (ret < 0)
+			return (-1);
+	}
+
+	ret = setregid(context.job.gid, context.job.gid);
+	if (ret < 0)
+		return (-1);
+
+	ret = setreuid(context.job.uid, context.job.uid);
+	if (ret < 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Refresh a stale entry of the digest map from a detached process, so that the registry query is
+ * not on the critical path of the job step.
+ */
+static void enroot_digest_refresh(const char *enroot_uri)
+{
+	int ret;
+	int lock_fd;
+	pid_t pid, owner;
+	char *digest = NULL;
+	bool stale = true;
+
+	pid = fork();
+	if (pid < 0) {
+		slurm_info("pyxis: couldn't refresh digest of image %s: %s", context.args->image, strerror(errno));
+		return;
+	}
+
+	if (pid == 0) {
+		/*
+		 * The digest map is updated with the credentials of the job, like in the step. The log of
+		 * slurmstepd is closed with its other fds: a failed refresh is retried by the next step.
+		 */
+		if (job_drop_privileges() < 0)
+			_exit(EXIT_FAILURE);
+
+		/* Double fork, the refresh process is reparented and never waited for by the step. */
+		pid = fork();
+		if (pid != 0)
+			_exit(pid < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+		setsid();
+
+		/* Only one refresh at a time for a given image, skip it if another process already did it. */
+		lock_fd = lock_acquire(&context.config, "digest-refresh", context.job.uid, enroot_uri, &owner);
+		if (lock_fd < 0)
+			_exit(EXIT_FAILURE);
+
+		if (owner != 0) {
+			ret = digest_cache_lookup(&context.config, context.job.uid, enroot_uri, &digest, &stale);
+			free(digest);
+			digest = NULL;
+			if (ret == 1 && !stale)
+				_exit(EXIT_SUCCESS);
+		}
+
+		/* Not enroot_digest_resolve(), its errors are for the log of the step. */
+		ret = enroot_exec_read_line_ctx((char *const[]){ "enroot", "digest", (char *)enroot_uri, NULL }, &digest);
+		if (ret < 0 || !digest_valid(digest))
+			_exit(EXIT_FAILURE);
+
+		ret = digest_cache_update(&context.config, context.job.uid, enroot_uri, digest);
+
+		_exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+}
+
+/* Get the digest of the image, from the URI itself, from the node-local digest map, or from the registry. */
+static int enroot_image_digest(const char *enroot_uri, char **digest)
+{
+	int ret;
+	bool stale;
+
+	*digest = digest_from_uri(enroot_uri);
+	if (*digest != NULL)
+		return (0);
+
+	if (context.config.digest_ttl > 0) {
+		ret = digest_cache_lookup(&context.config, context.job.uid, enroot_uri, digest, &stale);
+		if (ret == 1) {
+			slurm_verbose("pyxis: digest of image %s: %s%s", context.args->image, *digest, stale ? " (stale)" : "");
+			if (stale)
+				enroot_digest_refresh(enroot_uri);
+			return (0);
+		}
+		if (ret < 0)
+			slurm_info("pyxis: couldn't read digest map, querying the registry");
+	}
+
+	ret = enroot_digest_resolve(enroot_uri, digest);
+	if (ret < 0)
+		return (-1);
+
+	if (context.config.digest_ttl > 0)
+		(void)digest_cache_update(&context.config, context.job.uid, enroot_uri, *digest);
+
+	return (0);
+}
+
+/*
+ * Serialize imports of the same image by the same user on this node: the first step imports the
+ * image, the other steps wait and then reuse the result.
+ */
+static int import_lock_acquire(const char *type, const char *key)
+{
+	int fd;
+	pid_t owner;
+	struct timespec start_time, end_time;
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+	fd = lock_acquire(&context.config, type, context.job.uid, key, &owner);
+	if (fd < 0) {
+		slurm_error("pyxis: couldn't acquire import lock for image: %s", context.args->image);
+		return (-1);
+	}
+
+	if (owner != 0) {
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		slurm_info("pyxis: waited %.0f ms for a concurrent import of image %s (pid %d)",
+			   timespec_diff_ms(&start_time, &end_time), context.args->image, owner);
+	}
+
+	return (fd);
+}
+
+/* Wait for a slot in the node-wide admission queue (max_concurrent_imports), if enabled. */
+static int admission_acquire_ctx(const char *phase)
+{
+	int ret;
+	unsigned int position;
+	struct timespec start_time, end_time;
+
+	if (!admission_enabled(&context.config))
+		return (0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+	ret = admission_acquire(&context.config, context.admission_fd, &position);
+	if (ret < 0)
+		return (-1);
+
+	if (position > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		slurm_info("pyxis: waited %.0f ms in the node admission queue before %s (position %u)",
+			   timespec_diff_ms(&start_time, &end_time), phase, position);
+	}
+
+	return (0);
+}
+
+static void admission_release_ctx(void)
+{
+	if (admission_enabled(&context.config))
+		admission_release(context.admission_fd);
+}
+
+/* Run an enroot command that imports or creates an image, within the admission limit of the node. */
+static int enroot_exec_admitted_ctx(const char *phase, char *const argv[])
+{
+	int ret;
+
+	ret = admission_acquire_ctx(phase);
+	if (ret < 0)
+		return (-1);
+
+	ret = enroot_exec_wait(context.job.uid, context.job.gid, context.job.ngids, context.job.gids,
+			       enroot_new_log(), enroot_set_env_step_cpus, argv);
+
+	admission_release_ctx();
+
+	return (ret);
+}
+
+/* Import the image into the node-local cache if needed, and point squashfs_path to the cached file. */
+static int enroot_cache_import(const char *enroot_uri)
+{
+	int ret;
+	int lock_fd = -1;
+	const char *digest = context.container.digest;
+	char *digest_uri = NULL;
+	char *temp_path = NULL;
+	int rv = -1;
+
+	/*
+	 * Protect the entry from cache_gc() until the end of the job. Referenced before the lookup,
+	 * cache_gc() could evict the entry right after it otherwise.
+	 */
+	(void)cache_ref_add(&context.config, context.job.uid, context.job.jobid, digest);
+
+	lock_fd = import_lock_acquire("import", digest);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = cache_lookup(&context.config, context.job.uid, digest, &context.container.squashfs_path);
+	if (ret < 0)
+		goto fail;
+
+	if (ret == 1) {
+		slurm_info("pyxis: using cached squashfs for docker image: %s", context.args->image);
+		rv = 0;
+		goto fail;
+	}
+
+	if (context.job.total_task_count == 0 || context.job.total_task_count == 1)
+		slurm_spank_log("pyxis: importing docker image: %s", context.args->image);
+
+	ret = digest_pin_uri(enroot_uri, digest, &digest_uri);
+	if (ret < 0)
+		goto fail;
+
+	ret = cache_temp_path(&context.config, context.job.uid, digest, context.job.jobid, context.job.stepid, &temp_path);
+	if (ret < 0)
+		goto fail;
+
+	ret = enroot_exec_admitted_ctx("import", (char *const[]){ "enroot", "import", "--output", temp_path, digest_uri, NULL });
+	if (ret < 0) {
+		enroot_print_log_ctx(true);
+		goto fail;
+	}
+
+	ret = cache_publish(&context.config, context.job.uid, digest, temp_path, &context.container.squashfs_path);
+	if (ret < 0)
+		goto fail;
+
+	slurm_spank_log("pyxis: imported docker image: %s", context.args->image);
+
+	rv = 0;
+
+fail:
+	if (temp_path != NULL)
+		unlink(temp_path);
+	lock_release(lock_fd);
+	free(temp_path);
+	free(digest_uri);
+
+	return (rv);
+}
+
+/*
+ * Node 0 of the step imports the image into the shared staging directory, the other nodes wait
+ * for it, and then all the nodes use the staged squashfs file.
+ */
+static int enroot_staging_import(const char *enroot_uri)
+{
+	int ret;
+	char *path = NULL;
+	char *temp_path = NULL;
+	pid_t heartbeat;
+	struct timespec start_time, end_time;
+	int rv = -1;
+
+	ret = staging_path(&context.config, context.job.jobid, enroot_uri, &path);
+	if (ret < 0)
+		goto fail;
+
+	ret = xasprintf(&temp_path, "%s.tmp", path);
+	if (ret < 0)
+		goto fail;
+
+claim:
+	if (context.job.nodeid == 0) {
+		ret = staging_claim(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, path, &heartbeat);
+		if (ret < 0)
+			goto fail;
+
+		/* Otherwise, the image was already staged (or is being staged) by a previous step of the job. */
+		if (ret == 1) {
+			slurm_spank_log("pyxis: importing docker image: %s", context.args->image);
+
+			ret = enroot_exec_admitted_ctx("import", (char *const[]){ "enroot", "import", "--output", temp_path, (char *)enroot_uri, NULL });
+			if (ret < 0) {
+				enroot_print_log_ctx(true);
+				/* Let the other nodes know that the import failed, instead of waiting until the timeout. */
+				staging_publish(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, path, false, heartbeat);
+				goto fail;
+			}
+
+			ret = staging_publish(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, path, true, heartbeat);
+			if (ret < 0)
+				goto fail;
+
+			slurm_spank_log("pyxis: imported docker image: %s", context.args->image);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+	/* Only node 0 claims the image again, the other nodes keep waiting for the new claim. */
+	ret = staging_wait(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, path,
+			   context.config.staging_timeout, context.job.nodeid == 0);
+	if (ret < 0)
+		goto fail;
+	if (ret == 1)
+		goto claim;
+
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	slurm_verbose("pyxis: waited %.0f ms for the staged image %s", timespec_diff_ms(&start_time, &end_time), path);
+
+	context.container.squashfs_path = path;
+	path = NULL;
+
+	rv = 0;
+
+fail:
+	free(temp_path);
+	free(path);
+
+	return (rv);
+}
+
+/*
+ * Remove the container filesystem left by an interrupted or failed "enroot create" or "enroot load",
+ * so that a later step doesn't reuse a partial named container. Temporary containers are removed
+ * when the tasks exit.
+ */
+static void enroot_remove_partial_ctx(void)
+{
+	int ret;
+
+	if (context.container.temporary_rootfs)
+		return;
+
+	slurm_info("pyxis: removing partial container filesystem: %s", context.container.name);
+
+	ret = enroot_exec_wait_ctx((char *const[]){ "enroot", "remove", "-f", context.container.name, NULL });
+	if (ret < 0)
+		slurm_info("pyxis: failed to remove container filesystem: %s", context.container.name);
+}
+
+/* Extract the image once per node into the image cache, as the lower directory of the overlay. */
+static int enroot_overlay_rootfs(char **lower)
+{
+	int ret;
+	int lock_fd = -1;
+	const char *digest = context.container.digest;
+	char *temp_path = NULL;
+	int rv = -1;
+
+	lock_fd = import_lock_acquire("rootfs", digest);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = cache_rootfs_lookup(&context.config, context.job.uid, digest, lower);
+	if (ret < 0)
+		goto fail;
+
+	if (ret == 0) {
+		slurm_info("pyxis: extracting shared container filesystem: %s", digest);
+
+		/* Extracted in the data directory of the step, on the same filesystem as the cache. */
+		ret = enroot_exec_admitted_ctx("create", (char *const[]){ "enroot", "create", "--name", "rootfs.tmp", context.container.squashfs_path, NULL });
+		if (ret < 0) {
+			enroot_print_log_ctx(true);
+			goto fail;
+		}
+
+		ret = xasprintf(&temp_path, "%s/data/rootfs.tmp", context.container.overlay_path);
+		if (ret < 0)
+			goto fail;
+
+		ret = cache_rootfs_publish(&context.config, context.job.uid, digest, temp_path, lower);
+		if (ret < 0)
+			goto fail;
+	} else {
+		slurm_info("pyxis: using shared container filesystem: %s", *lower);
+	}
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		free(*lower);
+		*lower = NULL;
+	}
+	lock_release(lock_fd);
+	free(temp_path);
+
+	return (rv);
+}
+
+/* Extract the squashfs file once for all the temporary containers of the job. */
+static int enroot_overlay_job_rootfs(char **lower)
+{
+	int ret;
+	int lock_fd = -1;
+	char *temp_path = NULL;
+	int rv = -1;
+
+	ret = overlay_job_rootfs_path(&context.config, context.job.uid, context.job.jobid, context.container.squashfs_path,
+				      lower);
+	if (ret < 0)
+		goto fail;
+
+	lock_fd = import_lock_acquire("rootfs", *lower);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = overlay_job_rootfs_lookup(*lower);
+	if (ret < 0)
+		goto fail;
+
+	if (ret == 0) {
+		slurm_info("pyxis: extracting container filesystem for the job: %s", context.container.squashfs_path);
+
+		ret = enroot_exec_admitted_ctx("create", (char *const[]){ "enroot", "create", "--name", "rootfs.tmp", context.container.squashfs_path, NULL });
+		if (ret < 0) {
+			enroot_print_log_ctx(true);
+			goto fail;
+		}
+
+		ret = xasprintf(&temp_path, "%s/data/rootfs.tmp", context.container.overlay_path);
+		if (ret < 0)
+			goto fail;
+
+		ret = overlay_job_rootfs_publish(temp_path, *lower);
+		if (ret < 0)
+			goto fail;
+	} else {
+		slurm_info("pyxis: using container filesystem of the job: %s", *lower);
+	}
+
+	rv = 0;
+
+fail:
+	if (rv < 0) {
+		free(*lower);
+		*lower = NULL;
+	}
+	lock_release(lock_fd);
+	free(temp_path);
+
+	return (rv);
+}
+
+/* Use the shared mount of the image as the lower directory, or mount it for the step. */
+static int enroot_overlay_squashfs(char **lower)
+{
+	int ret;
 
-	if (name == NULL || strlen(name) == 0 || pid == NULL)
-		return (-1);
+	ret = shared_mount_get(&context.config, context.job.uid, context.job.jobid, context.container.digest, lower);
+	if (ret == 1) {
+		slurm_info("pyxis: using shared image mount: %s", *lower);
+		return (0);
+	}
 
-	*pid = -1;
+	slurm_info("pyxis: mounting squashfs file for the step: %s", context.container.squashfs_path);
 
-	fp = enroot_exec_output_ctx((char *const[]){ "enroot", "list", "-f", NULL });
-	if (fp == NULL) {
-		slurm_error("pyxis: couldn't get list of existing container filesystems");
+	/* A privileged step runs as root, it doesn't need a FUSE daemon. */
+	if (context.job.privileged)
+		return overlay_mount_loop(context.container.overlay_path, context.container.squashfs_path, lower);
+
+	ret = overlay_mount_squashfs(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, enroot_new_log(),
+				     enroot_set_env, context.container.overlay_path, context.container.squashfs_path, lower);
+	if (ret < 0) {
+		enroot_print_log_ctx(true);
 		return (-1);
 	}
 
-	/* Skip headers line */
-	line = get_line_from_file(fp);
-	if (line == NULL) {
-		slurm_error("pyxis: \"enroot list -f\" did not produce any usable output");
-		goto fail;
-	}
-	free(line);
-	line = NULL;
+	return (0);
+}
 
-	while ((line = get_line_from_file(fp)) != NULL) {
-		ctr_name = strtok_r(line, " ", &saveptr);
-		if (ctr_name == NULL || *ctr_name == '\0')
-			goto fail;
+/* The source container can be cloned by several steps at once, but not modified during the copy. */
+static int enroot_overlay_clone(void)
+{
+	int ret;
+	int lock_fd = -1;
+	const char *source;
+	int rv = -1;
 
-		if (strcmp(name, ctr_name) == 0) {
-			ctr_pid = strtok_r(NULL, " ", &saveptr);
-			if (ctr_pid == NULL || *ctr_pid == '\0') {
-				*pid = 0;
-			} else {
-				errno = 0;
-				n = strtoul(ctr_pid, NULL, 10);
-				if (errno != 0 || n != (pid_t)n)
-					goto fail;
+	source = strrchr(context.container.clone_path, '/') + 1;
 
-				*pid = (pid_t)n;
-			}
+	ret = lock_try_acquire_shared(&context.config, "container", context.job.uid, source, &lock_fd);
+	if (ret == 0)
+		slurm_error("pyxis: error: container \"%s\" is used by another step", source);
+	if (ret <= 0)
+		goto fail;
 
-			break;
-		}
+	slurm_info("pyxis: cloning container filesystem: %s", source);
 
-		free(line);
-		line = NULL;
+	ret = overlay_container_clone(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, enroot_new_log(),
+				      enroot_set_env, context.container.clone_path, context.container.container_path,
+				      context.container.digest);
+	if (ret < 0) {
+		enroot_print_log_ctx(true);
+		goto fail;
 	}
 
 	rv = 0;
 
 fail:
-	free(line);
-	if (fp) fclose(fp);
+	xclose(lock_fd);
+
 	return (rv);
 }
 
-static int read_proc_environ(pid_t pid, char **result, size_t *size)
+/*
+ * Mount the container filesystem of the step as a writable overlay on top of a read-only view of
+ * the image, shared between steps: its extracted root filesystem, or a squashfuse mount.
+ */
+static int enroot_overlay_create(void)
 {
 	int ret;
-	char path[PATH_MAX];
-	int fd = -1;
-	char *buf = NULL;
-	size_t len = 0, capacity = 1024;
-	ssize_t n;
-	char *new_buf = NULL;
+	char *lower = NULL;
+	const char *upper;
 	int rv = -1;
 
-	ret = snprintf(path, sizeof(path), "/proc/%d/environ", pid);
-	if (ret < 0 || ret >= sizeof(path))
-		goto fail;
-
-	fd = open(path, O_RDONLY);
-	if (fd < 0)
+	ret = overlay_prepare(context.container.overlay_path);
+	if (ret < 0)
 		goto fail;
 
-	buf = malloc(capacity + 1);
-	if (buf == NULL)
+	if (context.container.job_rootfs)
+		ret = enroot_overlay_job_rootfs(&lower);
+	else if (context.container.shared_mount)
+		ret = enroot_overlay_squashfs(&lower);
+	else
+		ret = enroot_overlay_rootfs(&lower);
+	if (ret < 0)
 		goto fail;
 
-	while ((n = read(fd, buf + len, capacity - len)) > 0) {
-		len += n;
-
-		if (capacity - len == 0) {
-			/* Grow buffer. */
-			capacity *= 2;
+	/* A named container keeps its upper directory, the step only mounts it. */
+	upper = context.container.overlay_path;
+	if (!context.container.temporary_rootfs) {
+		upper = context.container.container_path;
 
-			new_buf = realloc(buf, capacity + 1);
-			if (new_buf == NULL)
+		if (context.container.clone_path != NULL) {
+			ret = enroot_overlay_clone();
+			if (ret < 0)
 				goto fail;
+		} else if (!context.container.reuse_rootfs) {
+			slurm_info("pyxis: creating container filesystem: %s", context.container.name);
 
-			buf = new_buf;
+			ret = overlay_container_create(upper, context.container.digest);
+			if (ret < 0)
+				goto fail;
 		}
 	}
 
-	if (n < 0)
-		goto fail;
+	slurm_info("pyxis: mounting container filesystem: %s", context.container.name);
 
-	/* From man 5 proc, there might not be a null byte at the end. */
-	if (len > 0 && buf[len - 1] != '\0') {
-		buf[len] = '\0';
-		len += 1;
+	ret = overlay_mount(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, enroot_new_log(),
+			    enroot_set_env, context.container.overlay_path, upper, context.container.name, lower);
+	if (ret < 0) {
+		enroot_print_log_ctx(true);
+		goto fail;
 	}
 
-	*result = buf;
-	*size = len;
 	rv = 0;
 
 fail:
-	xclose(fd);
-	if (rv < 0)
-		free(buf);
+	free(lower);
 
 	return (rv);
 }
 
-static const char *container_deny_env[] = {
-	"LANG",
-	"LANGUAGE",
-	"LC_ALL",
-	NULL
-};
-
-static int spank_import_container_env(spank_t sp, pid_t pid)
+/*
+ * Read the squashfs file ahead from a detached process, while the container starts: squashfuse
+ * reads it right after, on the critical path of the job step. The pages read by a cached image are
+ * recorded once, and requested first by the next starts of the image, see prewarm.c.
+ */
+static void enroot_squashfs_prewarm(void)
 {
 	int ret;
-	char *proc_environ = NULL;
-	size_t size;
-	spank_err_t rc;
-	int overwrite;
-	int rv = -1;
+	pid_t pid;
+	char *profile_path = NULL;
 
-	/* First, remove unwanted locale environment variables from the job */
-	for (int i = 0; container_deny_env[i] != NULL; ++i) {
-		/* Check if the user explicitly requested this environment variable to be preserved */
-		if (array_contains(context.args->env_vars, context.args->env_vars_len, container_deny_env[i]))
-			continue;
+	if (prewarm_profile_enabled(&context.config) && context.container.use_cache && context.container.digest != NULL)
+		(void)cache_profile_path(&context.config, context.job.uid, context.container.digest, &profile_path);
 
-		rc = spank_unsetenv(sp, container_deny_env[i]);
-		if (rc != ESPANK_SUCCESS) {
-			slurm_error("pyxis: failed to unset %s: %s", container_deny_env[i], spank_strerror(rc));
-			goto fail;
-		}
-	}
+	if (!prewarm_enabled(&context.config) && profile_path == NULL)
+		return;
 
-	ret = read_proc_environ(pid, &proc_environ, &size);
-	if (ret < 0) {
-		slurm_error("pyxis: couldn't read /proc/%d/environ", pid);
-		goto fail;
+	pid = fork();
+	if (pid < 0) {
+		slurm_info("pyxis: couldn't prewarm squashfs file: %s", strerror(errno));
+		free(profile_path);
+		return;
 	}
 
-	for (size_t i = 0; i < size;) {
-		char *key, *value;
+	if (pid == 0) {
+		/* The squashfs file can come from the user, it is only opened with the credentials of the job. */
+		if (job_drop_privileges() < 0)
+			_exit(EXIT_FAILURE);
 
-		value = proc_environ + i;
-		key = strsep(&value, "=");
+		/* The ranges of the profile are requested before the tasks of the step start. */
+		ret = 0;
+		if (profile_path != NULL)
+			ret = prewarm_profile_load(context.container.squashfs_path, profile_path);
 
-		if (value == NULL) {
-			i += strlen(key) + 1;
-			continue;
-		}
+		/* Double fork, the prewarm process is reparented and never waited for by the step. */
+		pid = fork();
+		if (pid != 0)
+			_exit(pid < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
 
-		overwrite = 1;
-		if (array_contains(context.args->env_vars, context.args->env_vars_len, key))
-			overwrite = 0;
+		setsid();
 
-		rc = spank_setenv(sp, key, value, overwrite);
-		if (rc != ESPANK_SUCCESS && rc != ESPANK_ENV_EXISTS) {
-			slurm_error("pyxis: failed to set %s: %s", key, spank_strerror(rc));
-			goto fail;
+		/* The page cache is left alone while the profile is recorded. */
+		if (profile_path != NULL && ret == 0) {
+			ret = prewarm_profile_record(context.container.squashfs_path, profile_path,
+						     context.config.squashfs_profile);
+			_exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
 		}
-		i += strlen(key) + 1 + strlen(value) + 1;
-	}
 
-	rv = 0;
+		if (prewarm_enabled(&context.config))
+			ret = prewarm_squashfs(context.container.squashfs_path, context.config.squashfs_prewarm);
 
-fail:
-	free(proc_environ);
-	return (rv);
+		_exit(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	/* Requesting the ranges doesn't wait for the reads, but it might block on a slow filesystem. */
+	ret = child_wait_for_pid_timeout(pid, PREWARM_PROFILE_TIMEOUT);
+	if (ret < 0 && errno == ETIMEDOUT)
+		slurm_info("pyxis: prewarm: profile not loaded after %d seconds, giving up", PREWARM_PROFILE_TIMEOUT);
+	free(profile_path);
 }
 
 static int enroot_container_create(void)
 {
 	int ret;
+	int lock_fd = -1;
 	char *enroot_uri = NULL;
+	char *pinned_digest = NULL;
+	char *importer_result = NULL;
 	struct timespec start_time, end_time;
 	int rv = -1;
 
-	if (context.container.use_squashfuse && !context.container.use_importer) {
+	if (context.container.use_squashfuse && !context.container.use_importer && !context.container.use_cache &&
+	    !context.container.use_staging) {
 		slurm_info("pyxis: skipping container creation (squashfuse enabled)");
+		enroot_squashfs_prewarm();
 		return 0;
 	}
 
-	if (context.container.use_enroot_import || context.container.use_enroot_load || context.container.use_importer) {
-		if (strncmp("docker://", context.args->image, sizeof("docker://") - 1) == 0 ||
-		    strncmp("dockerd://", context.args->image, sizeof("dockerd://") - 1) == 0) {
-			enroot_uri = strdup(context.args->image);
-			if (enroot_uri == NULL)
-				goto fail;
-		} else {
-			/* Assume `image` is an enroot URI for a docker image. */
-			ret = xasprintf(&enroot_uri, "docker://%s", context.args->image);
-			if (ret < 0)
+	if (context.container.use_enroot_import || context.container.use_enroot_load || context.container.use_importer ||
+	    context.container.use_cache || context.container.use_staging) {
+		ret = enroot_image_uri(context.args->image, &enroot_uri);
+		if (ret < 0)
+			goto fail;
+
+		/*
+		 * If the job prolog is still prefetching this image, wait for it instead of importing it twice.
+		 * The prolog keys the lock by the URI of the image before it is pinned, like here.
+		 */
+		if (context.container.use_cache && prefetch_enabled(&context.config)) {
+			lock_fd = import_lock_acquire("prefetch", enroot_uri);
+			if (lock_fd < 0)
 				goto fail;
+			lock_release(lock_fd);
+			lock_fd = -1;
+		}
+
+		/* The image might have been pinned to a digest by srun/sbatch/salloc, for the whole job. */
+		if (pin_enabled(&context.config) && context.job.image_pin[0] != '\0') {
+			pinned_digest = pin_lookup(context.job.image_pin, enroot_uri);
+			if (pinned_digest != NULL) {
+				slurm_verbose("pyxis: using pinned image %s", context.job.image_pin);
+				free(enroot_uri);
+				enroot_uri = strdup(context.job.image_pin);
+				if (enroot_uri == NULL)
+					goto fail;
+			}
 		}
 
 		/*
 		 * Be more verbose if there is a single task in the job (it might be interactive),
 		 * or if we are executing the batch step (S_JOB_TOTAL_TASK_COUNT=0)
 		 */
-		if (context.job.total_task_count == 0 || context.job.total_task_count == 1)
+		if ((context.job.total_task_count == 0 || context.job.total_task_count == 1) && !context.container.use_cache &&
+		    !context.container.use_staging)
 			slurm_spank_log("pyxis: importing docker image: %s", context.args->image);
 	}
 
 	clock_gettime(CLOCK_MONOTONIC, &start_time);
 
+	if (context.container.use_cache) {
+		ret = enroot_image_digest(enroot_uri, &context.container.digest);
+		if (ret < 0) {
+			slurm_error("pyxis: failed to import docker image: %s", context.args->image);
+			goto fail;
+		}
+	} else if (context.container.use_importer && (context.config.digest_ttl > 0 || pinned_digest != NULL)) {
+		/* The digest is only a hint for the importer, it can resolve it by itself. */
+		ret = enroot_image_digest(enroot_uri, &context.container.digest);
+		if (ret < 0)
+			slurm_info("pyxis: continuing without image digest");
+	}
+
 	if (context.container.use_enroot_load) {
-		ret = enroot_exec_wait_ctx((char *const[]){ "enroot", "load", "--name", context.container.name, enroot_uri, NULL });
+		ret = enroot_exec_admitted_ctx("import", (char *const[]){ "enroot", "load", "--name", context.container.name, enroot_uri, NULL });
 		if (ret < 0) {
 			slurm_error("pyxis: failed to import docker image: %s", context.args->image);
 			enroot_print_log_ctx(true);
+			enroot_remove_partial_ctx();
 			goto fail;
 		}
 		slurm_spank_log("pyxis: imported docker image: %s", context.args->image);
 	} else {
-		if (context.container.use_enroot_import) {
-			ret = enroot_exec_wait_ctx((char *const[]){ "enroot", "import", "--output", context.container.squashfs_path, enroot_uri, NULL });
+		if (context.container.use_cache) {
+			ret = enroot_cache_import(enroot_uri);
+			if (ret < 0) {
+				slurm_error("pyxis: failed to import docker image: %s", context.args->image);
+				goto fail;
+			}
+
+			if (context.container.use_squashfuse)
+				slurm_info("pyxis: using cached squashfs directly: %s", context.container.squashfs_path);
+		} else if (context.container.use_staging) {
+			ret = enroot_staging_import(enroot_uri);
+			if (ret < 0) {
+				slurm_error("pyxis: failed to import docker image: %s", context.args->image);
+				goto fail;
+			}
+
+			if (context.container.use_squashfuse)
+				slurm_info("pyxis: using staged squashfs directly: %s", context.container.squashfs_path);
+		} else if (context.container.use_enroot_import) {
+			ret = enroot_exec_admitted_ctx("import", (char *const[]){ "enroot", "import", "--output", context.container.squashfs_path, enroot_uri, NULL });
 			if (ret < 0) {
 				slurm_error("pyxis: failed to import docker image: %s", context.args->image);
 				enroot_print_log_ctx(true);
@@ -765,28 +1656,56 @@ static int enroot_container_create(void)
 			}
 			slurm_spank_log("pyxis: imported docker image: %s", context.args->image);
 		} else if (context.container.use_importer) {
+			if (context.config.importer_single_flight) {
+				lock_fd = import_lock_acquire("import", enroot_uri);
+				if (lock_fd < 0)
+					goto fail;
+			}
+
 			/* Use external importer to get squashfs file */
-			ret = importer_exec_get(context.config.importer_path, context.job.uid, context.job.gid,
-						context.job.ngids, context.job.gids,
-						enroot_set_env, enroot_uri, &context.container.squashfs_path);
+			ret = admission_acquire_ctx("import");
+			if (ret == 0) {
+				ret = importer_exec_get(context.config.importer_path, context.config.importer_protocol,
+							context.job.uid, context.job.gid, context.job.ngids, context.job.gids,
+							enroot_set_env_step_cpus, enroot_uri, &context.container.squashfs_path, &importer_result);
+				admission_release_ctx();
+			}
+			lock_release(lock_fd);
+			lock_fd = -1;
 			if (ret < 0) {
 				slurm_error("pyxis: failed to import docker image: %s (importer: %s)", context.args->image, context.config.importer_path);
 				goto fail;
 			}
 			slurm_spank_log("pyxis: imported docker image: %s", context.args->image);
 
+			if (importer_result != NULL) {
+				slurm_info("pyxis: importer result: %s", importer_result);
+				/* Exposed to the tasks of the step as PYXIS_IMPORTER_RESULT. */
+				snprintf(context.shm->importer_result, sizeof(context.shm->importer_result), "%s", importer_result);
+			}
+
 			if (context.container.use_squashfuse) {
 				slurm_info("pyxis: using importer squashfs directly: %s", context.container.squashfs_path);
 			}
 		}
 
-		if (context.container.squashfs_path != NULL && !context.container.use_squashfuse) {
+		if (context.container.use_squashfuse)
+			enroot_squashfs_prewarm();
+
+		if (context.container.use_overlay) {
+			ret = enroot_overlay_create();
+			if (ret < 0) {
+				slurm_error("pyxis: failed to create container filesystem for image: %s", context.args->image);
+				goto fail;
+			}
+		} else if (context.container.squashfs_path != NULL && !context.container.use_squashfuse) {
 			slurm_info("pyxis: creating container filesystem: %s", context.container.name);
 
-			ret = enroot_exec_wait_ctx((char *const[]){ "enroot", "create", "--name", context.container.name, context.container.squashfs_path, NULL });
+			ret = enroot_exec_admitted_ctx("create", (char *const[]){ "enroot", "create", "--name", context.container.name, context.container.squashfs_path, NULL });
 			if (ret < 0) {
 				slurm_error("pyxis: failed to create container filesystem for image: %s", context.args->image);
 				enroot_print_log_ctx(true);
+				enroot_remove_partial_ctx();
 				goto fail;
 			}
 		}
@@ -798,6 +1717,8 @@ static int enroot_container_create(void)
 	rv = 0;
 
 fail:
+	free(importer_result);
+	free(pinned_digest);
 	free(enroot_uri);
 	if (context.container.use_enroot_import && context.container.squashfs_path != NULL) {
 		ret = unlink(context.container.squashfs_path);
@@ -807,6 +1728,12 @@ fail:
 		context.container.squashfs_path = NULL;
 	}
 
+	/* Direct squashfuse startup needs the cached or staged squashfs path until the container is started. */
+	if ((context.container.use_cache || context.container.use_staging) && (rv < 0 || !context.container.use_squashfuse)) {
+		free(context.container.squashfs_path);
+		context.container.squashfs_path = NULL;
+	}
+
 	if (context.container.use_importer) {
 		bool release_importer = false;
 
@@ -818,7 +1745,7 @@ fail:
 		}
 
 		if (release_importer) {
-			ret = importer_exec_release(context.config.importer_path, context.job.uid, context.job.gid,
+			ret = importer_exec_release(context.config.importer_path, context.config.importer_protocol, context.job.uid, context.job.gid,
 						    context.job.ngids, context.job.gids,
 						    enroot_set_env);
 			if (ret < 0)
@@ -1104,6 +2031,7 @@ static pid_t enroot_container_start(void)
 	char conf_file[PATH_MAX] = { 0 };
 	pid_t pid = -1;
 	int status;
+	struct timespec start_time, end_time;
 	pid_t rv = -1;
 	char *target;
 
@@ -1131,6 +2059,8 @@ static pid_t enroot_container_start(void)
 	 * This requires a shell inside the container, but we could do the same with a
 	 * small static C program bind-mounted inside the container.
 	*/
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
 	pid = enroot_exec_ctx((char *const[]){ "enroot", "start", "--conf", conf_file, target, "sh", "-c",
 					       "kill -STOP $$ ; exit 0", NULL });
 	if (pid < 0) {
@@ -1159,6 +2089,10 @@ static pid_t enroot_container_start(void)
 		goto fail;
 	}
 
+	/* Includes the entrypoint, and the first reads of the image: compare with and without prewarming. */
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	slurm_info("pyxis: started container in %.0f ms", timespec_diff_ms(&start_time, &end_time));
+
 	rv = pid;
 
 fail:
@@ -1281,6 +2215,12 @@ int slurm_spank_user_init(spank_t sp, int ac, char **av)
 	if (ret < 0)
 		goto fail;
 
+	/* Tasks are not bound yet, slurmstepd is only restricted to the CPUs of the step by its cpuset. */
+	if (sched_getaffinity(0, sizeof(context.job.cpus), &context.job.cpus) < 0) {
+		slurm_info("pyxis: couldn't get the CPUs of the step: %s", strerror(errno));
+		CPU_ZERO(&context.job.cpus);
+	}
+
 	if (context.job.stepid == SLURM_BATCH_SCRIPT) {
 		rc = spank_get_item(sp, S_JOB_ARGV, &spank_argc, &spank_argv);
 		if (rc != ESPANK_SUCCESS) {
@@ -1310,16 +2250,37 @@ int slurm_spank_user_init(spank_t sp, int ac, char **av)
 		if (ret < 0)
 			goto fail;
 
-		ret = enroot_container_get(container_name, &pid);
-		if (ret < 0) {
-			slurm_error("pyxis: couldn't get list of containers");
-			goto fail;
+		pid = -1;
+		if (pyxis_can_overlay_named_container()) {
+			ret = overlay_container_path(&context.config, context.job.uid, container_name,
+						     &context.container.container_path);
+			if (ret < 0)
+				goto fail;
+
+			ret = overlay_container_lookup(context.container.container_path, &context.container.digest);
+			if (ret < 0)
+				goto fail;
+			/* The container is mounted by each step, its namespaces can't be shared. */
+			if (ret == 1)
+				pid = 0;
+		}
+
+		if (context.container.digest == NULL) {
+			ret = enroot_container_get(container_name, &pid);
+			if (ret < 0) {
+				slurm_error("pyxis: couldn't get list of containers");
+				goto fail;
+			}
 		}
 
 		if (strcmp(context.args->container_name_flags, "create") == 0 && pid >= 0) {
 			slurm_error("pyxis: error: \"create\" flag was passed to --container-name but the container already exists");
 			goto fail;
 		}
+		if (strcmp(context.args->container_name_flags, "clone") == 0 && pid >= 0) {
+			slurm_error("pyxis: error: \"clone\" flag was passed to --container-name but the container already exists");
+			goto fail;
+		}
 		if (strcmp(context.args->container_name_flags, "exec") == 0 && pid <= 0) {
 			slurm_error("pyxis: error: \"exec\" flag was passed to --container-name but the container is not running");
 			goto fail;
@@ -1335,6 +2296,13 @@ int slurm_spank_user_init(spank_t sp, int ac, char **av)
 		} else if (pid == 0) {
 			slurm_info("pyxis: reusing existing container filesystem");
 			context.container.reuse_rootfs = true;
+
+			if (context.container.digest != NULL && container_overlay_init(container_name) < 0)
+				goto fail;
+		} else if (strcmp(context.args->container_name_flags, "clone") == 0) {
+			ret = container_clone_init();
+			if (ret < 0)
+				goto fail;
 		} else if (context.args->image == NULL) {
 			slurm_error("pyxis: error: a container with name \"%s\" does not exist, and --container-image is not set",
 				    container_name);
@@ -1374,21 +2342,82 @@ int slurm_spank_user_init(spank_t sp, int ac, char **av)
 				if (pyxis_can_direct_start_squashfs())
 					context.container.use_squashfuse = true;
 			} else {
+				bool dockerd = strncmp("dockerd://", context.args->image, sizeof("dockerd://") - 1) == 0;
+
 				/* No importer configured, use the builtin enroot import/load path */
-				context.container.use_enroot_load = context.config.use_enroot_load &&
-					strncmp("dockerd://", context.args->image, sizeof("dockerd://") - 1) != 0;
-				context.container.use_enroot_import = !context.container.use_enroot_load;
+				context.container.use_enroot_load = context.config.use_enroot_load == ENROOT_LOAD_ALWAYS && !dockerd;
+				/* Multi-node steps import the image once, on a shared filesystem. */
+				context.container.use_staging = !context.container.use_enroot_load && !dockerd &&
+					staging_enabled(&context.config) && context.job.nnodes > 1;
+				/* Images from the local Docker daemon are not cached, they don't have a registry digest. */
+				context.container.use_cache = !context.container.use_enroot_load && !dockerd &&
+					!context.container.use_staging && cache_enabled(&context.config);
+				/*
+				 * Without the cache or staging, the squashfs file of "enroot import" is only extracted and
+				 * removed: "enroot load" unpacks the layers directly into the container filesystem instead.
+				 */
+				if (context.config.use_enroot_load == ENROOT_LOAD_AUTO && !dockerd &&
+				    !context.container.use_cache && !context.container.use_staging)
+					context.container.use_enroot_load = true;
+				context.container.use_enroot_import = !context.container.use_enroot_load && !context.container.use_cache &&
+					!context.container.use_staging;
+
+				if ((context.container.use_cache || context.container.use_staging) && pyxis_can_direct_start_squashfs())
+					context.container.use_squashfuse = true;
+
+				/* Instead of a squashfuse mount per step, share a mount of the cached image between jobs. */
+				if (context.container.use_cache && shared_mount_enabled(&context.config)) {
+					context.container.use_squashfuse = false;
+					context.container.shared_mount = true;
+				}
+
+				/*
+				 * A container of a cached image is an overlay on a shared view of the image: its extracted
+				 * root filesystem, or its squashfuse mount.
+				 */
+				context.container.use_overlay = context.container.shared_mount ||
+					(context.container.use_cache && !context.container.use_squashfuse &&
+					 overlay_enabled(&context.config));
 
 				if (context.container.use_enroot_import) {
-					ret = xasprintf(&context.container.squashfs_path, "%s/%u/%u.%u.squashfs",
-							context.config.runtime_path, context.job.uid, context.job.jobid, context.job.stepid);
-					if (ret < 0 || ret >= PATH_MAX)
+					/* Keep large images out of the tmpfs runtime_path if scratch_path is configured. */
+					ret = scratch_select(&context.config, context.job.uid, context.job.jobid, context.job.stepid,
+							     &context.container.squashfs_path);
+					if (ret < 0)
 						goto fail;
 				}
 			}
 		}
 	}
 
+	/*
+	 * Images outside of the cache are not shared between jobs, but consecutive steps of the job can
+	 * still share their extracted squashfs file, instead of creating and removing a container each.
+	 */
+	if (context.container.temporary_rootfs && !context.container.use_overlay && !context.container.use_squashfuse &&
+	    !context.container.use_cache && !context.container.use_enroot_load && !context.container.use_enroot_import &&
+	    overlay_job_rootfs_enabled(&context.config)) {
+		context.container.job_rootfs = true;
+		context.container.use_overlay = true;
+	}
+
+	if (context.container.use_overlay) {
+		ret = overlay_path(&context.config, context.job.uid, context.job.jobid, context.job.stepid,
+				   &context.container.overlay_path);
+		if (ret < 0)
+			goto fail;
+
+		/* Two steps can't mount the same upper directory, keep the container locked until the step exits. */
+		if (!context.container.temporary_rootfs) {
+			ret = lock_try_acquire(&context.config, "container", context.job.uid, context.container.name,
+					       &context.container.container_lock_fd);
+			if (ret == 0)
+				slurm_error("pyxis: error: container \"%s\" is used by another step", context.container.name);
+			if (ret <= 0)
+				goto fail;
+		}
+	}
+
 	if (context.container.reuse_ns && context.args->mounts_len > 0) {
 		slurm_spank_log("pyxis: ignoring --container-mounts when attaching to a running container");
 		remove_all_mounts();
@@ -1506,10 +2535,16 @@ static int enroot_start_once(struct container *container, struct shared_memory *
 			ret = enroot_container_create();
 			if (ret < 0)
 				goto fail;
+		} else if (container->use_overlay) {
+			ret = enroot_overlay_create();
+			if (ret < 0) {
+				slurm_error("pyxis: failed to mount container filesystem: %s", container->name);
+				goto fail;
+			}
 		}
 		shm->pid = enroot_container_start();
 		if (shm->pid < 0 && container->use_importer && container->use_squashfuse) {
-			ret = importer_exec_release(context.config.importer_path, context.job.uid, context.job.gid,
+			ret = importer_exec_release(context.config.importer_path, context.config.importer_protocol, context.job.uid, context.job.gid,
 						    context.job.ngids, context.job.gids,
 						    enroot_set_env);
 			if (ret < 0)
@@ -1562,6 +2597,7 @@ fail:
 int slurm_spank_task_init(spank_t sp, int ac, char **av)
 {
 	int ret;
+	spank_err_t rc;
 	int rv = -1;
 
 	if (!context.enabled)
@@ -1597,6 +2633,12 @@ int slurm_spank_task_init(spank_t sp, int ac, char **av)
 		goto fail;
 	}
 
+	if (context.shm->importer_result[0] != '\0') {
+		rc = spank_setenv(sp, "PYXIS_IMPORTER_RESULT", context.shm->importer_result, 1);
+		if (rc != ESPANK_SUCCESS)
+			slurm_info("pyxis: couldn't set PYXIS_IMPORTER_RESULT: %s", spank_strerror(rc));
+	}
+
 	if (pytorch_setup_needed(sp)) {
 		ret = pytorch_setup(sp);
 		if (ret < 0)
@@ -1741,7 +2783,7 @@ static int enroot_cleanup(void)
 		unlink(context.container.squashfs_path);
 
 	if (context.container.use_importer) {
-		ret = importer_exec_release(context.config.importer_path, context.job.uid, context.job.gid,
+		ret = importer_exec_release(context.config.importer_path, context.config.importer_protocol, context.job.uid, context.job.gid,
 					    context.job.ngids, context.job.gids,
 					    enroot_set_env);
 		if (ret < 0) {
@@ -1750,7 +2792,21 @@ static int enroot_cleanup(void)
 		}
 	}
 
-	if (context.container.temporary_rootfs && !context.container.use_squashfuse) {
+	if (context.container.use_overlay) {
+		slurm_info("pyxis: removing container filesystem: %s", context.container.name);
+
+		ret = overlay_unmount(context.job.uid, context.job.gid, context.job.ngids, context.job.gids, enroot_new_log(),
+				      enroot_set_env, context.container.overlay_path, context.container.name);
+		if (ret < 0) {
+			enroot_print_log_ctx(false);
+			rv = -1;
+		}
+
+		/* Also removes a partial extraction of the image. */
+		ret = overlay_remove(&context.config, context.job.uid, context.job.jobid, context.job.stepid);
+		if (ret < 0)
+			rv = -1;
+	} else if (context.container.temporary_rootfs && !context.container.use_squashfuse) {
 		slurm_info("pyxis: removing container filesystem: %s", context.container.name);
 
 		ret = enroot_exec_wait_ctx((char *const[]){ "enroot", "remove", "-f", context.container.name, NULL });
@@ -1796,6 +2852,10 @@ int pyxis_slurmstepd_exit(spank_t sp, int ac, char **av)
 	free(context.container.name);
 	free(context.container.squashfs_path);
 	free(context.container.save_path);
+	free(context.container.digest);
+	free(context.container.overlay_path);
+	free(context.container.container_path);
+	free(context.container.clone_path);
 
 	free(context.job.gids);
 
@@ -1813,6 +2873,8 @@ int pyxis_slurmstepd_exit(spank_t sp, int ac, char **av)
 	xclose(context.container.utsns_fd);
 	free(context.container.cwd_path);
 	xclose(context.log_fd);
+	xclose(context.admission_fd);
+	xclose(context.container.container_lock_fd);
 
 	ret = shm_destroy(context.shm);
 	if (ret < 0) {
@@ -8,8 +8,11 @@
 
 #include "pyxis_srun.h"
 #include "args.h"
+#include "config.h"
+#include "pin.h"
 
 struct plugin_context {
+	struct plugin_config config;
 	struct plugin_args *args;
 };
 
@@ -19,6 +22,14 @@ static struct plugin_context context = {
 
 int pyxis_srun_init(spank_t sp, int ac, char **av)
 {
+	int ret;
+
+	ret = pyxis_config_parse(&context.config, ac, av);
+	if (ret < 0) {
+		slurm_error("pyxis: failed to parse configuration");
+		return (-1);
+	}
+
 	context.args = pyxis_args_register(sp);
 	if (context.args == NULL) {
 		slurm_error("pyxis: failed to register arguments");
@@ -30,12 +41,25 @@ int pyxis_srun_init(spank_t sp, int ac, char **av)
 
 int pyxis_srun_post_opt(spank_t sp, int ac, char **av)
 {
+	int ret;
+	char *pinned;
+
 	/* Check environment variables for default values after command-line processing */
 	pyxis_args_check_environment_variables(sp);
 
 	/* Calling pyxis_args_enabled() for arguments validation */
 	pyxis_args_enabled();
 
+	/* Resolve the image digest once for the whole job, and check that the image exists. */
+	ret = pin_image(&context.config, context.args->image, &pinned);
+	if (ret < 0)
+		return (-1);
+
+	/* Expose the image to the job prolog, for prefetching. */
+	pyxis_args_export_image(sp, pinned);
+
+	free(pinned);
+
 	return (0);
 }
 
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "scratch.h"
+#include "common.h"
+
+/*
+ * Scratch directories for the temporary squashfs files of the builtin "enroot import" path:
+ * <scratch dir>/<uid>/<jobid>.<stepid>.squashfs
+ *
+ * scratch_path is a colon-separated list of directories, in order of preference (e.g. a tmpfs,
+ * then a local NVMe drive). The first directory with at least scratch_min_free bytes available is
+ * used. If scratch_path is not set, runtime_path is the only scratch directory.
+ */
+
+/* Returns the next directory of the list, or NULL at the end of the list. */
+static char *scratch_next_dir(char *list, char **saveptr)
+{
+	return strtok_r(list, ":", saveptr);
+}
+
+static int scratch_dirs(const struct plugin_config *config, char *list, size_t size)
+{
+	int ret;
+
+	if (config->scratch_path[0] != '\0')
+		ret = snprintf(list, size, "%s", config->scratch_path);
+	else
+		ret = snprintf(list, size, "%s", config->runtime_path);
+	if (ret < 0 || ret >= size)
+		return (-1);
+
+	return (0);
+}
+
+/* As root, create the per-user directory in all the scratch directories. */
+int scratch_create_user_dirs(const struct plugin_config *config, uid_t uid, gid_t gid)
+{
+	int ret;
+	char list[PATH_MAX];
+	char path[PATH_MAX];
+	char *dir;
+	char *saveptr = NULL;
+
+	ret = scratch_dirs(config, list, sizeof(list));
+	if (ret < 0)
+		return (-1);
+
+	for (dir = scratch_next_dir(list, &saveptr); dir != NULL; dir = scratch_next_dir(NULL, &saveptr)) {
+		ret = snprintf(path, sizeof(path), "%s/%u", dir, uid);
+		if (ret < 0 || ret >= sizeof(path))
+			return (-1);
+
+		ret = create_user_dir(path, uid, gid);
+		if (ret < 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+static int scratch_available(const char *dir, uint64_t *available)
+{
+	int ret;
+	struct statvfs st;
+
+	ret = statvfs(dir, &st);
+	if (ret < 0) {
+		slurm_error("pyxis: scratch: couldn't statvfs %s: %s", dir, strerror(errno));
+		return (-1);
+	}
+
+	*available = (uint64_t)st.f_bavail * st.f_frsize;
+
+	return (0);
+}
+
+/*
+ * Select the scratch directory for the temporary squashfs file of a step. If no directory has
+ * scratch_min_free bytes available, the directory with the most space available is used.
+ */
+int scratch_select(const struct plugin_config *config, uid_t uid, uint32_t jobid, uint32_t stepid, char **path)
+{
+	int ret;
+	char list[PATH_MAX];
+	char *dir;
+	char *saveptr = NULL;
+	const char *selected = NULL;
+	const char *fallback = NULL;
+	uint64_t available;
+	uint64_t fallback_available = 0;
+
+	*path = NULL;
+
+	ret = scratch_dirs(config, list, sizeof(list));
+	if (ret < 0)
+		return (-1);
+
+	for (dir = scratch_next_dir(list, &saveptr); dir != NULL; dir = scratch_next_dir(NULL, &saveptr)) {
+		ret = scratch_available(dir, &available);
+		if (ret < 0)
+			continue;
+
+		if (available >= config->scratch_min_free) {
+			selected = dir;
+			break;
+		}
+
+		slurm_verbose("pyxis: scratch: skipping %s, only %llu bytes available", dir, (unsigned long long)available);
+
+		if (fallback == NULL || available > fallback_available) {
+			fallback = dir;
+			fallback_available = available;
+		}
+	}
+
+	if (selected == NULL && fallback != NULL) {
+		slurm_info("pyxis: scratch: no scratch directory has %llu bytes available, using %s",
+			   (unsigned long long)config->scratch_min_free, fallback);
+		selected = fallback;
+	}
+
+	if (selected == NULL) {
+		slurm_error("pyxis: scratch: no usable scratch directory");
+		return (-1);
+	}
+
+	ret = xasprintf(path, "%s/%u/%u.%u.squashfs", selected, uid, jobid, stepid);
+	if (ret < 0 || ret >= PATH_MAX) {
+		free(*path);
+		*path = NULL;
+		return (-1);
+	}
+
+	slurm_verbose("pyxis: scratch: using %s", *path);
+
+	return (0);
+}
+
+static bool scratch_match_job(const char *name, uint32_t jobid)
+{
+	uint32_t id;
+	int n = 0;
+
+	if (sscanf(name, "%u.%*u.squashfs%n", &id, &n) != 1)
+		return (false);
+
+	return (strlen(name) == n && id == jobid);
+}
+
+/*
+ * As root, from the job epilog, remove the temporary squashfs files left by the steps of the job,
+ * e.g. partial imports of a step that was killed.
+ */
+int scratch_cleanup(const struct plugin_config *config, uid_t uid, uint32_t jobid)
+{
+	int ret;
+	char list[PATH_MAX];
+	char path[PATH_MAX];
+	char *dir;
+	char *saveptr = NULL;
+	int dir_fd;
+	DIR *dirp;
+	struct dirent *entry;
+	int rv = 0;
+
+	ret = scratch_dirs(config, list, sizeof(list));
+	if (ret < 0)
+		return (-1);
+
+	for (dir = scratch_next_dir(list, &saveptr); dir != NULL; dir = scratch_next_dir(NULL, &saveptr)) {
+		ret = snprintf(path, sizeof(path), "%s/%u", dir, uid);
+		if (ret < 0 || ret >= sizeof(path)) {
+			rv = -1;
+			continue;
+		}
+
+		/* The directory is owned by the user, don't follow a symlink planted in its place. */
+		dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (dir_fd < 0) {
+			if (errno != ENOENT) {
+				slurm_error("pyxis: scratch: couldn't open %s: %s", path, strerror(errno));
+				rv = -1;
+			}
+			continue;
+		}
+
+		dirp = fdopendir(dir_fd);
+		if (dirp == NULL) {
+			xclose(dir_fd);
+			rv = -1;
+			continue;
+		}
+
+		while ((entry = readdir(dirp)) != NULL) {
+			if (!scratch_match_job(entry->d_name, jobid))
+				continue;
+
+			slurm_verbose("pyxis: scratch: removing leftover %s/%s", path, entry->d_name);
+			ret = unlinkat(dirfd(dirp), entry->d_name, 0);
+			if (ret < 0 && errno != ENOENT) {
+				slurm_error("pyxis: scratch: couldn't remove %s/%s: %s", path, entry->d_name, strerror(errno));
+				rv = -1;
+			}
+		}
+
+		closedir(dirp);
+	}
+
+	return (rv);
+}
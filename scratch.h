@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef SCRATCH_H_
+#define SCRATCH_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+int scratch_create_user_dirs(const struct plugin_config *config, uid_t uid, gid_t gid);
+
+int scratch_select(const struct plugin_config *config, uid_t uid, uint32_t jobid, uint32_t stepid, char **path);
+
+int scratch_cleanup(const struct plugin_config *config, uid_t uid, uint32_t jobid);
+
+#endif /* SCRATCH_H_ */
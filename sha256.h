@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+struct sha256_ctx {
+	uint32_t state[8];
+	uint64_t count;
+	uint8_t buf[64];
+};
+
+void sha256_init(struct sha256_ctx *ctx);
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif /* SHA256_H_ */
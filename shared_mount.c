@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "shared_mount.h"
+#include "cache.h"
+#include "common.h"
+#include "digest.h"
+#include "enroot.h"
+#include "lock.h"
+#include "loop.h"
+#include "overlay.h"
+
+#ifndef UMOUNT_NOFOLLOW
+# define UMOUNT_NOFOLLOW 0x00000008
+#endif
+
+#define REFS_SUFFIX ".refs"
+
+/*
+ * With shared_squashfuse, the squashfs file of a cached image is mounted once per node and per user,
+ * and used as the lower directory of the container filesystem of the steps (see overlay.c). All the
+ * containers of the image share the squashfuse process and its cache:
+ *   <cache_path>/<uid>/mnt/<digest>/       squashfuse mount of <cache_path>/<uid>/<digest>.squashfs
+ *   <cache_path>/<uid>/mnt/<digest>.refs/  one file per job using the mount
+ *
+ * With kernel_squashfs, the image is mounted by root with the kernel driver instead (see loop.c).
+ * The kernel parses a filesystem image written by the user, the option is meant for nodes where
+ * this is acceptable.
+ *
+ * A FUSE daemon started from a job step is killed with the step, and job steps can't mount with the
+ * kernel driver, so the mounts are only created from the job prolog (prolog_prefetch, which both
+ * options require), and they are referenced by jobs rather than steps. The job epilog
+ * drops the references of the job and detaches the mounts that are no longer used. A step that
+ * doesn't find a shared mount of its image, e.g. an image that isn't in SPANK_PYXIS_CONTAINER_IMAGE,
+ * mounts the squashfs file itself, see overlay_mount_squashfs and overlay_mount_loop.
+ *
+ * The mounts of an image, and its references, are serialized by a node-wide lock.
+ */
+
+bool shared_mount_enabled(const struct plugin_config *config)
+{
+	if (!cache_enabled(config) || !config->prolog_prefetch)
+		return (false);
+
+	return (config->kernel_squashfs || (config->shared_squashfuse && config->use_squashfuse));
+}
+
+bool shared_mount_kernel(const struct plugin_config *config)
+{
+	return (shared_mount_enabled(config) && config->kernel_squashfs);
+}
+
+/* Create a directory for the owner of the parent directory, also as root. */
+static int shared_mount_mkdir(int dir_fd, const char *name, mode_t mode)
+{
+	int ret;
+	struct stat st;
+
+	ret = mkdirat(dir_fd, name, mode);
+	if (ret < 0)
+		return (errno == EEXIST ? 0 : -1);
+
+	if (geteuid() != 0)
+		return (0);
+
+	if (fstat(dir_fd, &st) < 0 || fchownat(dir_fd, name, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) < 0) {
+		unlinkat(dir_fd, name, AT_REMOVEDIR);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int shared_mount_dir_open(const struct plugin_config *config, uid_t uid, bool create)
+{
+	int ret;
+	int dir_fd;
+	int fd;
+	char path[PATH_MAX];
+
+	ret = snprintf(path, sizeof(path), "%s/%u", config->cache_path, uid);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dir_fd < 0)
+		return (-1);
+
+	if (create && shared_mount_mkdir(dir_fd, "mnt", 0700) < 0) {
+		close(dir_fd);
+		return (-1);
+	}
+
+	/* The directory belongs to the user, don't follow a symlink planted in its place. */
+	fd = openat(dir_fd, "mnt", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+	close(dir_fd);
+
+	return (fd);
+}
+
+/* Returns 1 if the image is mounted, 0 if not, -1 on error (ENOTCONN if its squashfuse process is gone). */
+static int shared_mount_state(int mnt_fd, const char *name)
+{
+	struct stat mnt_st, st;
+
+	if (fstatat(mnt_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	if (fstat(mnt_fd, &mnt_st) < 0)
+		return (-1);
+
+	return (S_ISDIR(st.st_mode) && st.st_dev != mnt_st.st_dev);
+}
+
+static int shared_mount_ref_add(int mnt_fd, const char *name, uint32_t jobid)
+{
+	int ret;
+	int refs_fd;
+	int fd;
+	char refs[NAME_MAX + 1];
+	char job[32];
+
+	ret = snprintf(refs, sizeof(refs), "%s" REFS_SUFFIX, name);
+	if (ret < 0 || ret >= sizeof(refs))
+		return (-1);
+
+	ret = shared_mount_mkdir(mnt_fd, refs, 0700);
+	if (ret < 0)
+		return (-1);
+
+	refs_fd = openat(mnt_fd, refs, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (refs_fd < 0)
+		return (-1);
+
+	snprintf(job, sizeof(job), "%u", jobid);
+	fd = open_user_file(refs_fd, job, O_WRONLY | O_CREAT);
+
+	close(refs_fd);
+
+	if (fd < 0)
+		return (-1);
+
+	close(fd);
+
+	return (0);
+}
+
+static int shared_mount_squashfuse(uid_t uid, gid_t gid, const char *squashfs_path, const char *target)
+{
+	int ret;
+	int log_fd;
+
+	log_fd = pyxis_memfd_create("enroot-log", MFD_CLOEXEC);
+	if (log_fd < 0) {
+		slurm_error("pyxis: mount: couldn't create in-memory log file: %s", strerror(errno));
+		return (-1);
+	}
+
+	/* squashfuse goes to the background once the filesystem is mounted. */
+	ret = enroot_exec_wait(uid, gid, 0, NULL, log_fd, NULL,
+			       (char *const[]){ "squashfuse", (char *)squashfs_path, (char *)target, NULL });
+	if (ret < 0) {
+		slurm_error("pyxis: mount: couldn't mount %s", squashfs_path);
+		memfd_print_log(&log_fd, true, "squashfuse");
+	}
+
+	xclose(log_fd);
+
+	return (ret);
+}
+
+/* As root, the squashfs file and the mount point are in directories controlled by the user. */
+static int shared_mount_loop(const struct plugin_config *config, uid_t uid, const char *squashfs_path, int mnt_fd,
+			     const char *name)
+{
+	int ret;
+	int dir_fd = -1;
+	int file_fd = -1;
+	int target_fd = -1;
+	char path[PATH_MAX];
+	const char *file;
+	int rv = -1;
+
+	ret = snprintf(path, sizeof(path), "%s/%u", config->cache_path, uid);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+
+	file = strrchr(squashfs_path, '/');
+	if (file == NULL)
+		return (-1);
+	file++;
+
+	dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dir_fd < 0) {
+		slurm_error("pyxis: mount: couldn't open %s: %s", path, strerror(errno));
+		goto fail;
+	}
+
+	/* A regular file of the user, not a link to a file or a device the user can't read. */
+	file_fd = open_user_file(dir_fd, file, O_RDONLY);
+	if (file_fd < 0) {
+		slurm_error("pyxis: mount: couldn't open %s: %s", squashfs_path, strerror(errno));
+		goto fail;
+	}
+
+	target_fd = openat(mnt_fd, name, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (target_fd < 0) {
+		slurm_error("pyxis: mount: couldn't open mount point %s: %s", name, strerror(errno));
+		goto fail;
+	}
+
+	rv = loop_mount_squashfs(file_fd, target_fd);
+
+fail:
+	xclose(target_fd);
+	xclose(file_fd);
+	xclose(dir_fd);
+
+	return (rv);
+}
+
+/*
+ * From the prolog prefetch: mount the squashfs file of a cached image if it isn't mounted yet, and
+ * reference the mount until the end of the job. Squashfuse mounts are made with the credentials of
+ * the user, kernel mounts (kernel_squashfs) as root.
+ */
+int shared_mount_acquire(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid, const char *digest)
+{
+	int ret;
+	int mnt_fd = -1;
+	int lock_fd = -1;
+	pid_t owner;
+	char name[NAME_MAX + 1];
+	char *squashfs_path = NULL;
+	char *target = NULL;
+	int rv = -1;
+
+	if (!shared_mount_enabled(config) || (config->kernel_squashfs && geteuid() != 0))
+		return (0);
+
+	ret = digest_dir_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	ret = cache_lookup(config, uid, digest, &squashfs_path);
+	if (ret <= 0)
+		goto fail;
+
+	ret = xasprintf(&target, "%s/%u/mnt/%s", config->cache_path, uid, name);
+	if (ret < 0)
+		goto fail;
+
+	lock_fd = lock_acquire(config, "mount", uid, name, &owner);
+	if (lock_fd < 0)
+		goto fail;
+
+	mnt_fd = shared_mount_dir_open(config, uid, true);
+	if (mnt_fd < 0) {
+		slurm_error("pyxis: mount: couldn't open mount directory: %s", strerror(errno));
+		goto fail;
+	}
+
+	ret = shared_mount_state(mnt_fd, name);
+	if (ret < 0 && errno == ENOTCONN) {
+		slurm_info("pyxis: mount: removing stale mount %s", target);
+		ret = overlay_fuse_unmount(uid, gid, 0, NULL, -1, NULL, target);
+		if (ret == 0)
+			ret = shared_mount_state(mnt_fd, name);
+	}
+	if (ret < 0)
+		goto fail;
+
+	if (ret == 0) {
+		ret = shared_mount_mkdir(mnt_fd, name, 0755);
+		if (ret < 0) {
+			slurm_error("pyxis: mount: couldn't mkdir %s: %s", target, strerror(errno));
+			goto fail;
+		}
+
+		if (config->kernel_squashfs)
+			ret = shared_mount_loop(config, uid, squashfs_path, mnt_fd, name);
+		else
+			ret = shared_mount_squashfuse(uid, gid, squashfs_path, target);
+		if (ret < 0)
+			goto fail;
+
+		slurm_info("pyxis: mount: mounted image %s for job %u", digest, jobid);
+	}
+
+	ret = shared_mount_ref_add(mnt_fd, name, jobid);
+	if (ret < 0) {
+		slurm_error("pyxis: mount: couldn't add reference to %s for job %u: %s", digest, jobid, strerror(errno));
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	xclose(mnt_fd);
+	lock_release(lock_fd);
+	free(target);
+	free(squashfs_path);
+
+	return (rv);
+}
+
+/*
+ * From a job step, with the credentials of the user: returns 1 and the path of the shared mount of
+ * an image if there is one, and references it until the end of the job. Returns 0 otherwise.
+ */
+int shared_mount_get(const struct plugin_config *config, uid_t uid, uint32_t jobid, const char *digest, char **path)
+{
+	int ret;
+	int mnt_fd = -1;
+	int lock_fd = -1;
+	pid_t owner;
+	char name[NAME_MAX + 1];
+	int rv = -1;
+
+	*path = NULL;
+
+	ret = digest_dir_name(digest, &name);
+	if (ret < 0)
+		return (-1);
+
+	mnt_fd = shared_mount_dir_open(config, uid, false);
+	if (mnt_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	lock_fd = lock_acquire(config, "mount", uid, name, &owner);
+	if (lock_fd < 0)
+		goto fail;
+
+	ret = shared_mount_state(mnt_fd, name);
+	if (ret <= 0) {
+		rv = 0;
+		goto fail;
+	}
+
+	ret = shared_mount_ref_add(mnt_fd, name, jobid);
+	if (ret < 0)
+		goto fail;
+
+	ret = xasprintf(path, "%s/%u/mnt/%s", config->cache_path, uid, name);
+	if (ret < 0)
+		goto fail;
+
+	rv = 1;
+
+fail:
+	lock_release(lock_fd);
+	xclose(mnt_fd);
+
+	return (rv);
+}
+
+/* Remove the reference of a job, and the stale references from before the last boot. Returns the references left. */
+static int shared_mount_ref_remove(int refs_fd, uint32_t jobid, time_t boot)
+{
+	int fd;
+	DIR *dirp;
+	struct dirent *d;
+	struct stat st;
+	char job[32];
+	int count = 0;
+
+	snprintf(job, sizeof(job), "%u", jobid);
+	if (unlinkat(refs_fd, job, 0) < 0 && errno != ENOENT)
+		return (-1);
+
+	fd = dup(refs_fd);
+	if (fd < 0)
+		return (-1);
+
+	dirp = fdopendir(fd);
+	if (dirp == NULL) {
+		close(fd);
+		return (-1);
+	}
+
+	while ((d = readdir(dirp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+
+		if (fstatat(dirfd(dirp), d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && st.st_mtime < boot) {
+			slurm_info("pyxis: mount: removing stale reference of job %s", d->d_name);
+			unlinkat(dirfd(dirp), d->d_name, 0);
+			continue;
+		}
+
+		count++;
+	}
+
+	closedir(dirp);
+
+	return (count);
+}
+
+/* Drop the reference of a job to a mount, and detach the mount if it was the last one. */
+static int shared_mount_put(const struct plugin_config *config, uid_t uid, uint32_t jobid, int mnt_fd,
+			    const char *name, time_t boot)
+{
+	int ret;
+	int lock_fd = -1;
+	int refs_fd = -1;
+	pid_t owner;
+	char refs[NAME_MAX + 1];
+	char target[PATH_MAX];
+	int rv = -1;
+
+	ret = snprintf(refs, sizeof(refs), "%s" REFS_SUFFIX, name);
+	if (ret < 0 || ret >= sizeof(refs))
+		return (-1);
+
+	lock_fd = lock_acquire(config, "mount", uid, name, &owner);
+	if (lock_fd < 0)
+		goto fail;
+
+	refs_fd = openat(mnt_fd, refs, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (refs_fd < 0)
+		goto fail;
+
+	ret = shared_mount_ref_remove(refs_fd, jobid, boot);
+	if (ret != 0) {
+		rv = (ret < 0 ? -1 : 0);
+		goto fail;
+	}
+
+	/* Resolve the path through the file descriptor, the user controls the directories. */
+	ret = snprintf(target, sizeof(target), "/proc/self/fd/%d/%s", mnt_fd, name);
+	if (ret < 0 || ret >= sizeof(target))
+		goto fail;
+
+	/* Containers of the last job might still be exiting, detach the filesystem. */
+	ret = umount2(target, MNT_DETACH | UMOUNT_NOFOLLOW);
+	if (ret == 0)
+		slurm_info("pyxis: mount: detached unused mount %s", name);
+	else if (errno != EINVAL && errno != ENOENT)
+		goto fail;
+
+	ret = unlinkat(mnt_fd, name, AT_REMOVEDIR);
+	if (ret < 0 && errno != ENOENT)
+		goto fail;
+
+	ret = unlinkat(mnt_fd, refs, AT_REMOVEDIR);
+	if (ret < 0 && errno != ENOENT)
+		goto fail;
+
+	rv = 0;
+
+fail:
+	if (rv < 0)
+		slurm_info("pyxis: mount: couldn't release %s for job %u: %s", name, jobid, strerror(errno));
+	xclose(refs_fd);
+	lock_release(lock_fd);
+
+	return (rv);
+}
+
+/* As root, from the job epilog, drop the references of a job and detach the mounts no longer used. */
+int shared_mount_release(const struct plugin_config *config, uid_t uid, uint32_t jobid)
+{
+	int ret;
+	int mnt_fd;
+	DIR *dirp;
+	struct dirent *d;
+	char name[NAME_MAX + 1];
+	size_t len;
+	time_t boot;
+	int rv = 0;
+
+	if (!shared_mount_enabled(config))
+		return (0);
+
+	mnt_fd = shared_mount_dir_open(config, uid, false);
+	if (mnt_fd < 0)
+		return (errno == ENOENT ? 0 : -1);
+
+	dirp = fdopendir(mnt_fd);
+	if (dirp == NULL) {
+		close(mnt_fd);
+		return (-1);
+	}
+
+	boot = boot_time();
+
+	while ((d = readdir(dirp)) != NULL) {
+		len = strlen(d->d_name);
+		if (len <= strlen(REFS_SUFFIX) || strcmp(d->d_name + len - strlen(REFS_SUFFIX), REFS_SUFFIX) != 0)
+			continue;
+
+		snprintf(name, sizeof(name), "%.*s", (int)(len - strlen(REFS_SUFFIX)), d->d_name);
+
+		ret = shared_mount_put(config, uid, jobid, dirfd(dirp), name, boot);
+		if (ret < 0)
+			rv = -1;
+	}
+
+	closedir(dirp);
+
+	return (rv);
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef SHARED_MOUNT_H_
+#define SHARED_MOUNT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+bool shared_mount_enabled(const struct plugin_config *config);
+
+bool shared_mount_kernel(const struct plugin_config *config);
+
+int shared_mount_acquire(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid, const char *digest);
+
+int shared_mount_get(const struct plugin_config *config, uid_t uid, uint32_t jobid, const char *digest, char **path);
+
+int shared_mount_release(const struct plugin_config *config, uid_t uid, uint32_t jobid);
+
+#endif /* SHARED_MOUNT_H_ */
@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <grp.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <slurm/spank.h>
+
+#include "staging.h"
+#include "common.h"
+
+/*
+ * Multi-node jobs can stage the image on a shared filesystem (staging_path), instead of importing
+ * it on every node. Node 0 of the step imports the image, the other nodes wait for it.
+ *
+ * Layout: <staging_path>/pyxis_<jobid>/<hash of the image URI>.squashfs
+ * Next to the squashfs file:
+ *   .claim    created (O_EXCL) by the node importing the image, with its hostname and pid
+ *   .tmp      the squashfs file being imported
+ *   .done     the squashfs file is complete
+ *   .failed   the import failed, the other nodes stop waiting
+ *
+ * While it imports the image, the claiming node refreshes the modification time of .claim. If the
+ * step is killed during the import, neither .done nor .failed is ever written: node 0 of a later
+ * step sees that .claim stopped changing, removes it and claims the image again. The age of the
+ * claim is measured with the clock of the waiting node, only changes of the mtime are compared,
+ * not the clocks of two nodes.
+ *
+ * Shared filesystems are often mounted with root squashing, so all file operations are done in a
+ * child process with the credentials of the user. The directory is removed by the job epilog.
+ */
+
+#define STAGING_HEARTBEAT_INTERVAL 10
+#define STAGING_CLAIM_EXPIRY 60
+
+enum {
+	STAGING_OK = 0,
+	STAGING_BUSY = 1,
+	STAGING_FAILED = 2,
+	STAGING_TIMEOUT = 3,
+	STAGING_ERROR = 4,
+	STAGING_STALE = 5,
+};
+
+struct staging_op {
+	const char *path;
+	bool success;
+	bool reclaim;
+	unsigned int timeout;
+};
+
+typedef int (*staging_fn)(const struct staging_op *op);
+
+bool staging_enabled(const struct plugin_config *config)
+{
+	return (config->staging_path[0] != '\0');
+}
+
+static pid_t staging_fork(uid_t uid, gid_t gid, int ngids, const gid_t *gids, staging_fn fn, const struct staging_op *op)
+{
+	int ret;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		slurm_error("pyxis: fork error: %s", strerror(errno));
+		return (-1);
+	}
+
+	if (pid == 0) {
+		if (geteuid() == 0) {
+			ret = setgroups(ngids, gids);
+			if (ret < 0)
+				_exit(STAGING_ERROR);
+		}
+
+		ret = setregid(gid, gid);
+		if (ret < 0)
+			_exit(STAGING_ERROR);
+
+		ret = setreuid(uid, uid);
+		if (ret < 0)
+			_exit(STAGING_ERROR);
+
+		_exit(fn(op));
+	}
+
+	return (pid);
+}
+
+static int staging_exec(uid_t uid, gid_t gid, int ngids, const gid_t *gids, staging_fn fn, const struct staging_op *op)
+{
+	int status;
+	pid_t pid;
+
+	pid = staging_fork(uid, gid, ngids, gids, fn, op);
+	if (pid < 0)
+		return (-1);
+
+	status = child_wait_for_pid(pid);
+	if (status < 0 || !WIFEXITED(status))
+		return (-1);
+
+	return (WEXITSTATUS(status));
+}
+
+int staging_path(const struct plugin_config *config, uint32_t jobid, const char *enroot_uri, char **path)
+{
+	int ret;
+
+	ret = xasprintf(path, "%s/pyxis_%u/%016" PRIx64 ".squashfs", config->staging_path, jobid, hash_string(enroot_uri));
+	if (ret < 0 || ret >= PATH_MAX - sizeof(".claim")) {
+		free(*path);
+		*path = NULL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int marker_path(char (*buf)[PATH_MAX], const char *path, const char *suffix)
+{
+	int ret;
+
+	ret = snprintf(*buf, sizeof(*buf), "%s.%s", path, suffix);
+	if (ret < 0 || ret >= sizeof(*buf))
+		return (-1);
+
+	return (0);
+}
+
+static int marker_create(const char *path, const char *suffix)
+{
+	int fd;
+	char buf[PATH_MAX];
+
+	if (marker_path(&buf, path, suffix) < 0)
+		return (-1);
+
+	fd = open(buf, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return (-1);
+
+	/* Make the marker visible to the other nodes. */
+	fsync(fd);
+	close(fd);
+
+	return (0);
+}
+
+static bool marker_exists(const char *path, const char *suffix)
+{
+	char buf[PATH_MAX];
+
+	if (marker_path(&buf, path, suffix) < 0)
+		return (false);
+
+	return (access(buf, F_OK) == 0);
+}
+
+static int do_claim(const struct staging_op *op)
+{
+	int fd;
+	char dir[PATH_MAX];
+	char buf[PATH_MAX];
+	char host[HOST_NAME_MAX + 1] = { 0 };
+
+	snprintf(dir, sizeof(dir), "%s", op->path);
+	if (mkdir(dirname(dir), 0700) < 0 && errno != EEXIST)
+		return (STAGING_ERROR);
+
+	if (marker_path(&buf, op->path, "claim") < 0)
+		return (STAGING_ERROR);
+
+	fd = open(buf, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return (errno == EEXIST ? STAGING_BUSY : STAGING_ERROR);
+
+	/* Only to find out which node holds the claim, it is never parsed. */
+	(void)gethostname(host, sizeof(host) - 1);
+	dprintf(fd, "%s %d\n", host, (int)getppid());
+	fsync(fd);
+	close(fd);
+
+	return (STAGING_OK);
+}
+
+static int do_heartbeat(const struct staging_op *op)
+{
+	char buf[PATH_MAX];
+
+	if (marker_path(&buf, op->path, "claim") < 0)
+		return (STAGING_ERROR);
+
+	/* Killed by staging_publish(), or with the step. */
+	for (;;) {
+		sleep(STAGING_HEARTBEAT_INTERVAL);
+
+		if (utimensat(AT_FDCWD, buf, NULL, 0) < 0)
+			return (STAGING_ERROR);
+	}
+}
+
+/*
+ * Returns 1 if the calling node must import the image into path.tmp and then call staging_publish,
+ * 0 if the image was already claimed by another step, -1 on error. Once the image is claimed,
+ * *heartbeat is the process refreshing the claim until staging_publish.
+ */
+int staging_claim(uid_t uid, gid_t gid, int ngids, const gid_t *gids, const char *path, pid_t *heartbeat)
+{
+	struct staging_op op = { .path = path };
+	int ret;
+
+	*heartbeat = -1;
+
+	ret = staging_exec(uid, gid, ngids, gids, do_claim, &op);
+	if (ret == STAGING_BUSY)
+		return (0);
+	if (ret != STAGING_OK) {
+		slurm_error("pyxis: couldn't create staging directory for %s", path);
+		return (-1);
+	}
+
+	/* Without a heartbeat, the claim would expire during a long import: give up on the claim. */
+	*heartbeat = staging_fork(uid, gid, ngids, gids, do_heartbeat, &op);
+	if (*heartbeat < 0) {
+		staging_publish(uid, gid, ngids, gids, path, false, -1);
+		return (-1);
+	}
+
+	return (1);
+}
+
+static int do_publish(const struct staging_op *op)
+{
+	char tmp[PATH_MAX];
+
+	if (marker_path(&tmp, op->path, "tmp") < 0)
+		return (STAGING_ERROR);
+
+	if (op->success && rename(tmp, op->path) == 0 && marker_create(op->path, "done") == 0)
+		return (STAGING_OK);
+
+	unlink(tmp);
+	marker_create(op->path, "failed");
+
+	return (op->success ? STAGING_ERROR : STAGING_OK);
+}
+
+int staging_publish(uid_t uid, gid_t gid, int ngids, const gid_t *gids, const char *path, bool success, pid_t heartbeat)
+{
+	struct staging_op op = { .path = path, .success = success };
+	int ret;
+
+	if (heartbeat > 0) {
+		kill(heartbeat, SIGKILL);
+		while (waitpid(heartbeat, NULL, 0) < 0 && errno == EINTR);
+	}
+
+	ret = staging_exec(uid, gid, ngids, gids, do_publish, &op);
+	if (ret != STAGING_OK) {
+		slurm_error("pyxis: couldn't publish staged image %s", path);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Remove a claim that stopped changing, unless it was replaced by a new claim in the meantime. */
+static int staging_remove_stale(const char *path, const struct stat *stale)
+{
+	char buf[PATH_MAX];
+	struct stat st;
+
+	if (marker_path(&buf, path, "claim") < 0)
+		return (-1);
+
+	if (stat(buf, &st) < 0 || st.st_ino != stale->st_ino || st.st_mtim.tv_sec != stale->st_mtim.tv_sec ||
+	    st.st_mtim.tv_nsec != stale->st_mtim.tv_nsec)
+		return (0);
+
+	/* The partial import is not written to anymore, "enroot import" doesn't overwrite files. */
+	if (marker_path(&buf, path, "tmp") < 0 || (unlink(buf) < 0 && errno != ENOENT))
+		return (-1);
+
+	if (marker_path(&buf, path, "claim") < 0 || (unlink(buf) < 0 && errno != ENOENT))
+		return (-1);
+
+	return (0);
+}
+
+static int do_wait(const struct staging_op *op)
+{
+	time_t start = time(NULL);
+	time_t changed = start;
+	char claim[PATH_MAX];
+	struct stat st, last = { 0 };
+
+	if (marker_path(&claim, op->path, "claim") < 0)
+		return (STAGING_ERROR);
+
+	for (;;) {
+		if (marker_exists(op->path, "done"))
+			return (STAGING_OK);
+		if (marker_exists(op->path, "failed"))
+			return (STAGING_FAILED);
+		if (op->timeout > 0 && time(NULL) - start >= op->timeout)
+			return (STAGING_TIMEOUT);
+
+		if (stat(claim, &st) == 0) {
+			if (st.st_ino != last.st_ino || st.st_mtim.tv_sec != last.st_mtim.tv_sec ||
+			    st.st_mtim.tv_nsec != last.st_mtim.tv_nsec) {
+				last = st;
+				changed = time(NULL);
+			} else if (op->reclaim && time(NULL) - changed >= STAGING_CLAIM_EXPIRY) {
+				if (staging_remove_stale(op->path, &last) < 0)
+					return (STAGING_ERROR);
+				return (STAGING_STALE);
+			}
+		}
+
+		sleep(1);
+	}
+}
+
+/*
+ * Returns 0 once the staged image is complete, -1 on error. With reclaim (node 0), returns 1 if the
+ * node that claimed the image stopped importing it: the caller must claim it again.
+ */
+int staging_wait(uid_t uid, gid_t gid, int ngids, const gid_t *gids, const char *path, unsigned int timeout,
+		 bool reclaim)
+{
+	struct staging_op op = { .path = path, .timeout = timeout, .reclaim = reclaim };
+	int ret;
+
+	ret = staging_exec(uid, gid, ngids, gids, do_wait, &op);
+	switch (ret) {
+	case STAGING_OK:
+		return (0);
+	case STAGING_STALE:
+		slurm_info("pyxis: the node staging the image stopped updating %s.claim, importing it again", path);
+		return (1);
+	case STAGING_FAILED:
+		slurm_error("pyxis: the import of the staged image failed on another node");
+		break;
+	case STAGING_TIMEOUT:
+		slurm_error("pyxis: timed out after %u seconds waiting for the staged image %s", timeout, path);
+		break;
+	default:
+		slurm_error("pyxis: couldn't wait for the staged image %s", path);
+		break;
+	}
+
+	return (-1);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	if (remove(path) < 0 && errno != ENOENT)
+		return (-1);
+
+	return (0);
+}
+
+static int do_cleanup(const struct staging_op *op)
+{
+	/* Every node of the job runs this, the directory might be already gone. */
+	if (nftw(op->path, remove_entry, 16, FTW_DEPTH | FTW_PHYS) < 0 && errno != ENOENT)
+		return (STAGING_ERROR);
+
+	return (STAGING_OK);
+}
+
+int staging_cleanup(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid)
+{
+	struct staging_op op = { 0 };
+	char path[PATH_MAX];
+	int ret;
+
+	ret = snprintf(path, sizeof(path), "%s/pyxis_%u", config->staging_path, jobid);
+	if (ret < 0 || ret >= sizeof(path))
+		return (-1);
+	op.path = path;
+
+	ret = staging_exec(uid, gid, 0, NULL, do_cleanup, &op);
+	if (ret != STAGING_OK) {
+		slurm_error("pyxis: couldn't remove staging directory %s", path);
+		return (-1);
+	}
+
+	return (0);
+}
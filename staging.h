@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ */
+
+#ifndef STAGING_H_
+#define STAGING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+bool staging_enabled(const struct plugin_config *config);
+
+int staging_path(const struct plugin_config *config, uint32_t jobid, const char *enroot_uri, char **path);
+
+int staging_claim(uid_t uid, gid_t gid, int ngids, const gid_t *gids, const char *path, pid_t *heartbeat);
+
+int staging_publish(uid_t uid, gid_t gid, int ngids, const gid_t *gids, const char *path, bool success, pid_t heartbeat);
+
+int staging_wait(uid_t uid, gid_t gid, int ngids, const gid_t *gids, const char *path, unsigned int timeout,
+		 bool reclaim);
+
+int staging_cleanup(const struct plugin_config *config, uid_t uid, gid_t gid, uint32_t jobid);
+
+#endif /* STAGING_H_ */
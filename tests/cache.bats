@@ -0,0 +1,88 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path=/tmp/pyxis-cache and cache_max_size=1 in the pyxis configuration: cache_gc() removes every
+# entry that no running job references.
+
+CACHE_DIR=/tmp/pyxis-cache
+
+function setup() {
+    enroot_cleanup cache-test || true
+}
+
+function teardown() {
+    enroot_cleanup cache-test || true
+}
+
+@test "image cache: repeated import" {
+    run_enroot digest docker://ubuntu:24.04
+    squashfs="${CACHE_DIR}/$(id -u)/${lines[-1]}.squashfs"
+    node=$(srun -N1 hostname)
+
+    run_srun -w "${node}" --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    run_srun -w "${node}" sh -c "stat -c %i ${squashfs}; awk '/^stats / { print \$2 }' ${CACHE_DIR}/\$(id -u)/index"
+    inode="${lines[0]}"
+    hits="${lines[1]}"
+
+    # The second step uses the same file, and counts a hit.
+    run_srun -w "${node}" --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    run_srun -w "${node}" sh -c "stat -c %i ${squashfs}; awk '/^stats / { print \$2 }' ${CACHE_DIR}/\$(id -u)/index"
+    [ "${lines[0]}" == "${inode}" ]
+    [ "${lines[1]}" -eq $((hits + 1)) ]
+}
+
+@test "image cache: tag and digest of the same image" {
+    run_enroot digest docker://ubuntu:24.04
+    digest="${lines[-1]}"
+
+    run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    run_srun --container-image=ubuntu@${digest} grep 'Ubuntu 24.04' /etc/os-release
+}
+
+@test "image cache: named container from a cached image" {
+    run_srun --container-image=ubuntu:24.04 true
+    run_srun --container-image=ubuntu:24.04 --container-name=cache-test sh -c 'echo pyxis > /test'
+    run_srun --container-name=cache-test cat /test
+    [ "${lines[-1]}" == "pyxis" ]
+}
+
+@test "image cache: concurrent imports of the same image" {
+    pids=()
+    for i in {0..4}; do
+        srun -n1 --overlap --container-image=ubuntu:22.04 grep 'Ubuntu 22.04' /etc/os-release &
+        pids+=($!)
+    done
+
+    for pid in "${pids[@]}"; do
+        wait $pid
+        [ $? -eq 0 ]
+    done
+}
+
+@test "image cache: image pinned for the whole job" {
+    run_enroot digest docker://ubuntu:24.04
+    digest="${lines[-1]}"
+
+    # With pin_digest=1, srun reuses the pinned reference from the job environment.
+    PYXIS_IMAGE_PIN="docker://ubuntu:24.04@${digest}" run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+}
+
+@test "image cache: entry removed by the epilog once unreferenced" {
+    # An image that no other step of this job uses, the references of the job would protect it.
+    run_enroot digest docker://alpine:3.19
+    squashfs="${CACHE_DIR}/$(id -u)/${lines[-1]}.squashfs"
+    node=$(srun -N1 hostname)
+
+    # The job sees the entry in the cache.
+    run_sbatch --parsable -N1 -w "${node}" --oversubscribe --container-image=alpine:3.19 \
+               --container-mounts="${CACHE_DIR}:${CACHE_DIR}" --wrap "test -e ${squashfs}"
+    jobid="${lines[-1]}"
+
+    # Wait for the end of the epilog.
+    while squeue -h -j "${jobid}" 2>/dev/null | grep -q .; do
+        sleep 1
+    done
+
+    run_srun -w "${node}" sh -c "! test -e ${squashfs}"
+}
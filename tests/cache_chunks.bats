@@ -0,0 +1,31 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path=/tmp/pyxis-cache and cache_chunks=1 in the pyxis configuration.
+
+CACHE_DIR=/tmp/pyxis-cache
+
+@test "cache chunks: squashfs file assembled again after its eviction" {
+    run_enroot digest docker://ubuntu:24.04
+    digest="${lines[-1]}"
+    user_dir="${CACHE_DIR}/$(id -u)"
+    node=$(srun -N1 hostname)
+
+    run_srun -w "${node}" --container-image=ubuntu:24.04 true
+    run_srun -w "${node}" sh -c "test -s ${user_dir}/${digest}.chunks && sha256sum ${user_dir}/${digest}.squashfs"
+    checksum=$(cut -d' ' -f1 <<< "${lines[-1]}")
+    run_srun -w "${node}" awk '/^stats / { print $3 }' "${user_dir}/index"
+    misses="${lines[-1]}"
+
+    # Evict the squashfs file like cache_gc() does, only its manifest and its chunks are left.
+    run_srun -w "${node}" rm "${user_dir}/${digest}.squashfs"
+
+    run_srun -w "${node}" --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+
+    # Assembled from the chunks, not imported again.
+    run_srun -w "${node}" sha256sum "${user_dir}/${digest}.squashfs"
+    [ "$(cut -d' ' -f1 <<< "${lines[-1]}")" == "${checksum}" ]
+    run_srun -w "${node}" awk '/^stats / { print $3 }' "${user_dir}/index"
+    [ "${lines[-1]}" == "${misses}" ]
+}
@@ -0,0 +1,25 @@
+#!/usr/bin/env bats
+
+load ./common
+
+@test "cancel: no import process left after the step is cancelled" {
+    node=$(srun -N1 hostname)
+
+    # A large image, so that the step is cancelled during the import.
+    srun -N1 -w "${node}" --oversubscribe --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 true &
+    pid=$!
+
+    for i in $(seq 120); do
+        srun -N1 -w "${node}" --oversubscribe pgrep -u "$(id -u)" -f "[e]nroot import" >/dev/null && break
+        sleep 1
+    done
+
+    step=$(squeue -h -s -j "${SLURM_JOB_ID}" -o %i | sort -t. -k2 -n | tail -n1)
+    scancel "${step}"
+    wait ${pid} || true
+
+    # The process group of the import gets SIGKILL 10 seconds after SIGTERM.
+    # The brackets keep the pattern from matching the command line of the shell.
+    sleep 15
+    run_srun -w "${node}" sh -c '! pgrep -u "$(id -u)" -f "[e]nroot import|[m]ksquashfs|[e]nroot-aufs2ovlfs|[p]igz|[c]url"'
+}
@@ -0,0 +1,38 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires use_enroot_load=auto in the pyxis configuration, without cache_path, staging_path and use_squashfuse.
+
+function setup() {
+    enroot_cleanup load-test || true
+}
+
+function teardown() {
+    enroot_cleanup load-test || true
+}
+
+@test "use_enroot_load=auto: image loaded without an intermediate squashfs file" {
+    node=$(srun -N1 hostname)
+
+    # A large image, so that the import command can be seen while it runs.
+    srun -N1 -w "${node}" --oversubscribe --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 true &
+    pid=$!
+
+    cmd=""
+    for i in $(seq 120); do
+        cmd=$(srun -N1 -w "${node}" --oversubscribe pgrep -u "$(id -u)" -f -a "[e]nroot (import|load) ") && break
+        sleep 1
+    done
+
+    wait ${pid}
+    log "+ ${cmd}"
+    grep -q "enroot load " <<< "${cmd}"
+    ! grep -q "enroot import " <<< "${cmd}"
+}
+
+@test "use_enroot_load=auto: named container" {
+    run_srun --container-image=ubuntu:24.04 --container-name=load-test sh -c 'echo pyxis > /test'
+    run_srun --container-name=load-test cat /test
+    [ "${lines[-1]}" == "pyxis" ]
+}
@@ -0,0 +1,24 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires task/affinity or task/cgroup binding the tasks to their CPUs, and 2 CPUs on a node.
+
+@test "import cpus: import runs on all the CPUs of the step" {
+    node=$(srun -N1 hostname)
+
+    # Two tasks of one CPU each: the first task imports the image, on the two CPUs of the step.
+    # A large image, so that the import can be seen while it runs.
+    srun -N1 -w "${node}" -n2 -c1 --cpu-bind=cores --oversubscribe --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 true &
+    pid=$!
+
+    cpus=""
+    for i in $(seq 120); do
+        cpus=$(srun -N1 -w "${node}" --oversubscribe sh -c 'p=$(pgrep -u "$(id -u)" -f -o "[e]nroot import") && grep "^Cpus_allowed_list:" /proc/${p}/status') && break
+        sleep 1
+    done
+
+    wait ${pid}
+    log "+ enroot import: ${cpus}"
+    grep -Eq '^Cpus_allowed_list:\s+[0-9]+[,-][0-9]' <<< "${cpus}"
+}
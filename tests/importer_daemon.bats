@@ -0,0 +1,44 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires importer=unix:/tmp/pyxis-importer.sock and importer_protocol=2 in the pyxis configuration.
+# The tests start importers/importer_daemon.py on the node, it serves images from a stand-in directory.
+
+IMPORTER_DIR=/tmp/pyxis-importer-test
+IMPORTER_DAEMON="${BATS_TEST_DIRNAME:-$(pwd)}/../importers/importer_daemon.py"
+
+function setup() {
+    run_srun sh -c "mkdir -p ${IMPORTER_DIR}/stand-in && rm -f /tmp/pyxis-importer.sock"
+    if ! srun -N1 --oversubscribe test -f "${IMPORTER_DIR}/stand-in/ubuntu+24.04.sqsh"; then
+        run_enroot import -o "${IMPORTER_DIR}/stand-in/ubuntu+24.04.sqsh" docker://ubuntu:24.04
+    fi
+
+    srun -N1 --oversubscribe python3 "${IMPORTER_DAEMON}" --socket /tmp/pyxis-importer.sock \
+         --cache-dir "${IMPORTER_DIR}/cache" --stand-in "${IMPORTER_DIR}/stand-in" 3>&- &
+    daemon_pid=$!
+
+    for i in $(seq 30); do
+        srun -N1 --oversubscribe test -S /tmp/pyxis-importer.sock && return 0
+        sleep 1
+    done
+    return 1
+}
+
+function teardown() {
+    kill ${daemon_pid} || true
+    wait ${daemon_pid} || true
+}
+
+@test "importer daemon: image served by the daemon" {
+    run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    run_srun --container-image=ubuntu:24.04 sh -c 'echo "${PYXIS_IMPORTER_RESULT}"'
+    grep -q "path=${IMPORTER_DIR}/stand-in/ubuntu+24.04.sqsh" <<< "${output}"
+    grep -q "cache_hit=1" <<< "${output}"
+}
+
+@test "importer daemon: error response reported to the user" {
+    run_srun_unchecked --container-image=ubuntu:22.04 true
+    [ "${status}" -ne 0 ]
+    grep -q "image not found in stand-in directory" <<< "${output}"
+}
@@ -0,0 +1,20 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires importer=/path/to/pyxis/importers/caching_importer.sh and importer_protocol=2 in the pyxis configuration.
+
+@test "importer protocol v2: progress records before the result" {
+    # The importer writes "progress phase=..." records first, they must not be taken for the squashfs path.
+    run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+}
+
+@test "importer protocol v2: result record exposed to the tasks" {
+    run_srun --container-image=ubuntu:24.04 true
+    run_srun --container-image=ubuntu:24.04 sh -c 'echo "${PYXIS_IMPORTER_RESULT}"'
+    grep -q "^path=/tmp/pyxis-cache-$(id -u)/sha256:[0-9a-f]*\.sqsh " <<< "${output}"
+    grep -q " digest=sha256:[0-9a-f]* " <<< "${output}"
+    grep -q " size=[0-9]* " <<< "${output}"
+    grep -q " cache_hit=1 " <<< "${output}"
+    grep -q " total_ms=[0-9]*$" <<< "${output}"
+}
@@ -0,0 +1,29 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path, use_overlay=1 and job_rootfs=1 in the pyxis configuration, without use_squashfuse.
+
+function setup() {
+    run_srun --container-image=ubuntu:24.04 --container-save=/tmp/pyxis-job-rootfs.sqsh true
+}
+
+function teardown() {
+    rm -f /tmp/pyxis-job-rootfs.sqsh
+}
+
+@test "job_rootfs: steps share the extracted squashfs file" {
+    run_srun --container-image=/tmp/pyxis-job-rootfs.sqsh grep 'Ubuntu 24.04' /etc/os-release
+    run_srun --container-image=/tmp/pyxis-job-rootfs.sqsh grep -q ' fuse.fuse-overlayfs ' /proc/self/mountinfo
+}
+
+@test "job_rootfs: writes are private to the step" {
+    run_srun --container-image=/tmp/pyxis-job-rootfs.sqsh --container-writable sh -c 'echo pyxis > /test && rm /etc/os-release'
+    run_srun --container-image=/tmp/pyxis-job-rootfs.sqsh sh -c '! test -e /test && grep "Ubuntu 24.04" /etc/os-release'
+}
+
+@test "job_rootfs: a new squashfs file at the same path is extracted again" {
+    run_srun --container-image=/tmp/pyxis-job-rootfs.sqsh --container-save=/tmp/pyxis-job-rootfs.sqsh sh -c 'echo pyxis > /test'
+    run_srun --container-image=/tmp/pyxis-job-rootfs.sqsh cat /test
+    [ "${lines[-1]}" == "pyxis" ]
+}
@@ -0,0 +1,16 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path, prolog_prefetch=1 and kernel_squashfs=1 in the pyxis configuration.
+# Run with an image passed to sbatch/salloc, so that the job prolog mounts it.
+
+@test "kernel_squashfs: steps use the kernel mount of the image" {
+    run_srun --container-image=ubuntu:24.04 sh -c 'grep "Ubuntu 24.04" /etc/os-release'
+    run_srun --container-image=ubuntu:24.04 grep -q ' squashfs ' /proc/self/mountinfo
+}
+
+@test "kernel_squashfs: writes are private to the step" {
+    run_srun --container-image=ubuntu:24.04 sh -c 'echo pyxis > /test'
+    run_srun --container-image=ubuntu:24.04 sh -c '! test -e /test'
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path and use_overlay=1 in the pyxis configuration.
+
+@test "overlay: repeated steps from the same image" {
+    run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+}
+
+@test "overlay: writes are private to the step" {
+    run_srun --container-image=ubuntu:24.04 --container-writable sh -c 'echo pyxis > /test && rm /etc/os-release'
+    run_srun --container-image=ubuntu:24.04 sh -c '! test -e /test && grep "Ubuntu 24.04" /etc/os-release'
+}
+
+@test "overlay: concurrent steps from the same image" {
+    pids=()
+    for i in {0..4}; do
+        srun -n1 --overlap --container-image=ubuntu:22.04 --container-writable sh -c "echo $i > /test && sleep 1 && grep -qx $i /test" &
+        pids+=($!)
+    done
+
+    for pid in "${pids[@]}"; do
+        wait $pid
+        [ $? -eq 0 ]
+    done
+}
+
+@test "overlay: export the container of the step" {
+    run_srun --container-image=ubuntu:24.04 --container-writable --container-save=/tmp/pyxis-overlay.sqsh sh -c 'echo pyxis > /test'
+    run_srun --container-image=/tmp/pyxis-overlay.sqsh cat /test
+    rm -f /tmp/pyxis-overlay.sqsh
+    [ "${lines[-1]}" == "pyxis" ]
+}
+
+@test "overlay: named container keeps its changes" {
+    run_srun --container-image=ubuntu:24.04 --container-name=overlay-test-${SLURM_JOB_ID}:create sh -c 'echo pyxis > /test'
+    run_srun --container-name=overlay-test-${SLURM_JOB_ID} sh -c 'cat /test && grep "Ubuntu 24.04" /etc/os-release'
+    [ "${lines[0]}" == "pyxis" ]
+}
+
+@test "overlay: export a named container" {
+    run_srun --container-image=ubuntu:24.04 --container-name=overlay-save-${SLURM_JOB_ID} sh -c 'echo pyxis > /test'
+    run_srun --container-name=overlay-save-${SLURM_JOB_ID} --container-save=/tmp/pyxis-overlay-named.sqsh true
+    run_srun --container-image=/tmp/pyxis-overlay-named.sqsh cat /test
+    rm -f /tmp/pyxis-overlay-named.sqsh
+    [ "${lines[-1]}" == "pyxis" ]
+}
+
+@test "overlay: clone a named container" {
+    run_srun --container-image=ubuntu:24.04 --container-name=overlay-base-${SLURM_JOB_ID} sh -c 'echo pyxis > /test'
+    run_srun --container-name=overlay-clone-${SLURM_JOB_ID}:clone=overlay-base-${SLURM_JOB_ID} sh -c 'cat /test && echo clone > /test'
+    [ "${lines[-1]}" == "pyxis" ]
+    run_srun --container-name=overlay-base-${SLURM_JOB_ID} cat /test
+    [ "${lines[-1]}" == "pyxis" ]
+    run_srun --container-name=overlay-clone-${SLURM_JOB_ID} cat /test
+    [ "${lines[-1]}" == "clone" ]
+}
+
+@test "overlay: clone a missing container" {
+    run_srun_unchecked --container-name=overlay-clone-missing-${SLURM_JOB_ID}:clone=overlay-missing-${SLURM_JOB_ID} true
+    [ "${status}" -ne 0 ]
+    grep -q 'container to clone' <<< "${output}"
+}
@@ -0,0 +1,31 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path in the pyxis configuration, and pyxis-prefetch installed on the nodes (make install-prefetch).
+# PYXIS_CONF is the pyxis configuration file on the nodes.
+
+PYXIS_CONF="${PYXIS_CONF:-/etc/slurm/plugstack.conf.d/pyxis.conf}"
+
+@test "pyxis-prefetch: report of imported and cached images" {
+    node=$(srun -N1 hostname)
+
+    # Without privileges, the cache directories of the user are created by a previous step.
+    run_srun -w "${node}" --container-image=ubuntu:22.04 true
+
+    run_srun -w "${node}" sh -c "printf '# images\nubuntu:24.04\n  ubuntu:24.04\nubuntu:22.04\n' | pyxis-prefetch -c ${PYXIS_CONF} -j 2 -"
+    grep -Eq '^(imported|cached) ubuntu:24.04 \([0-9.]+ [KMG]iB\)' <<< "${output}"
+    grep -Eq '^cached ubuntu:22.04 \([0-9.]+ [KMG]iB\)$' <<< "${output}"
+    grep -Eq '^2 images: [01] imported \(.*\), [12] already cached, 0 failed, in [0-9.]+ s$' <<< "${output}"
+
+    run_srun -w "${node}" sh -c "echo ubuntu:24.04 | pyxis-prefetch -c ${PYXIS_CONF} -"
+    grep -Eq '^cached ubuntu:24.04 \([0-9.]+ [KMG]iB\)$' <<< "${output}"
+    grep -q '^1 images: 0 imported (0.0 B), 1 already cached, 0 failed, in ' <<< "${output}"
+}
+
+@test "pyxis-prefetch: failed image reported" {
+    run_srun_unchecked sh -c "echo ./missing.sqsh | pyxis-prefetch -c ${PYXIS_CONF} -"
+    [ "${status}" -ne 0 ]
+    grep -q '^failed ./missing.sqsh after ' <<< "${output}"
+    grep -q '^1 images: 0 imported (0.0 B), 0 already cached, 1 failed, in ' <<< "${output}"
+}
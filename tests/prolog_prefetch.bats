@@ -0,0 +1,20 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path and prolog_prefetch=1 in the pyxis configuration.
+
+@test "prolog_prefetch: the prefetch is killed when the job ends" {
+    node=$(srun -N1 hostname)
+
+    # A large image, so that the job is cancelled during the prefetch.
+    jobid=$(sbatch --parsable -N1 -w "${node}" --oversubscribe --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 --wrap true)
+    sleep 15
+    scancel "${jobid}"
+
+    while squeue -h -j "${jobid}" 2>/dev/null | grep -q .; do
+        sleep 1
+    done
+
+    run_srun -w "${node}" sh -c '! pgrep -u "$(id -u)" -f "enroot import"'
+}
@@ -27,3 +27,12 @@ EOF
 grep 'CentOS Linux release 8.' /etc/redhat-release
 EOF
 }
+
+@test "sbatch image prefetch" {
+    # With prolog_prefetch=1, the batch step waits for the import started by the job prolog.
+    run_sbatch --container-image=ubuntu:24.04 <<EOF
+#!/bin/bash
+grep 'Ubuntu 24.04' /etc/os-release
+srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+EOF
+}
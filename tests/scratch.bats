@@ -0,0 +1,40 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires scratch_path=/tmp/pyxis-scratch-a:/tmp/pyxis-scratch-b and scratch_min_free=1 in the pyxis
+# configuration, without cache_path: both directories qualify, the first one must be selected.
+
+@test "scratch: temporary squashfs written to the first scratch directory" {
+    node=$(srun -N1 hostname)
+
+    # A large image, so that the temporary squashfs file can be seen during the import.
+    srun -N1 -w "${node}" --oversubscribe --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 true &
+    pid=$!
+
+    found=0
+    for i in $(seq 300); do
+        if srun -N1 -w "${node}" --oversubscribe sh -c "ls /tmp/pyxis-scratch-a/\$(id -u)/${SLURM_JOB_ID}.*.squashfs" >/dev/null 2>&1; then
+            found=1
+            break
+        fi
+        sleep 1
+    done
+
+    wait ${pid}
+    [ "${found}" -eq 1 ]
+}
+
+@test "scratch: leftover temporary squashfs removed by the epilog" {
+    node=$(srun -N1 hostname)
+
+    # The per-user scratch directories are created by the first step using a container.
+    run_srun -w "${node}" --container-image=ubuntu:24.04 true
+
+    jobid=$(sbatch --parsable -N1 -w "${node}" --oversubscribe --wrap 'touch /tmp/pyxis-scratch-a/$(id -u)/${SLURM_JOB_ID}.99.squashfs')
+    while squeue -h -j "${jobid}" 2>/dev/null | grep -q .; do
+        sleep 1
+    done
+
+    run_srun -w "${node}" sh -c "! test -e /tmp/pyxis-scratch-a/\$(id -u)/${jobid}.99.squashfs"
+}
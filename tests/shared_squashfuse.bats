@@ -0,0 +1,15 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path, use_squashfuse=1, prolog_prefetch=1 and shared_squashfuse=1 in the pyxis configuration.
+
+@test "shared_squashfuse: repeated steps from the same image" {
+    run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    run_srun --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+}
+
+@test "shared_squashfuse: writes are private to the step" {
+    run_srun --container-image=ubuntu:24.04 sh -c 'echo pyxis > /test'
+    run_srun --container-image=ubuntu:24.04 sh -c '! test -e /test'
+}
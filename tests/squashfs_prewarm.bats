@@ -0,0 +1,21 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires use_squashfuse=1 and squashfs_prewarm=1G in the pyxis configuration, and fincore (util-linux) on the nodes.
+
+SQUASHFS=/tmp/pyxis-prewarm-test.sqsh
+
+@test "squashfs_prewarm: squashfs file read into the page cache" {
+    node=$(srun -N1 hostname)
+
+    run_srun -w "${node}" sh -c "test -f ${SQUASHFS} || enroot import -o ${SQUASHFS} docker://ubuntu:24.04"
+
+    # Drop the pages of the file from the page cache, the container itself only reads a few of them.
+    run_srun -w "${node}" dd if="${SQUASHFS}" iflag=nocache count=0 status=none
+    run_srun -w "${node}" --container-image="${SQUASHFS}" sleep 5
+
+    run_srun -w "${node}" sh -c "echo \$(fincore --bytes --noheadings --output RES ${SQUASHFS}) \$(stat -c %s ${SQUASHFS})"
+    read resident size <<< "${lines[-1]}"
+    [ $((resident * 10)) -ge $((size * 9)) ]
+}
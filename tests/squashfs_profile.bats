@@ -0,0 +1,42 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires cache_path=/tmp/pyxis-cache, use_squashfuse=1 and squashfs_profile=5 in the pyxis configuration,
+# without squashfs_prewarm, and fincore (util-linux) on the nodes.
+
+CACHE_DIR=/tmp/pyxis-cache
+
+@test "squashfs_profile: pages recorded on the first start and prefetched on the next ones" {
+    run_enroot digest docker://ubuntu:24.04
+    digest="${lines[-1]}"
+    squashfs="${CACHE_DIR}/$(id -u)/${digest}.squashfs"
+    profile="${CACHE_DIR}/$(id -u)/${digest}.profile"
+    node=$(srun -N1 hostname)
+
+    run_srun -w "${node}" --container-image=ubuntu:24.04 true
+    run_srun -w "${node}" rm -f "${profile}"
+
+    # Record: the container reads its libraries within the first 5 seconds, and outlives the recording.
+    run_srun -w "${node}" dd if="${squashfs}" iflag=nocache count=0 status=none
+    run_srun -w "${node}" --container-image=ubuntu:24.04 sh -c 'cat /usr/lib/x86_64-linux-gnu/*.so* > /dev/null 2>&1; sleep 10'
+
+    # Format: a header with the size of the squashfs file, then page-aligned "<offset> <length>" ranges.
+    run_srun -w "${node}" sh -c "stat -c %s ${squashfs}; cat ${profile}"
+    size="${lines[0]}"
+    [ "${lines[1]}" == "pyxis-profile 1 ${size}" ]
+    [ "${#lines[@]}" -gt 2 ]
+    total=0
+    for line in "${lines[@]:2}"; do
+        grep -Eq '^[0-9]+ [0-9]+$' <<< "${line}"
+        read offset length <<< "${line}"
+        [ $((offset % 4096)) -eq 0 ]
+        total=$((total + length))
+    done
+
+    # Replay: the ranges of the profile are in the page cache, even if the container doesn't read them.
+    run_srun -w "${node}" dd if="${squashfs}" iflag=nocache count=0 status=none
+    run_srun -w "${node}" --container-image=ubuntu:24.04 sleep 5
+    run_srun -w "${node}" fincore --bytes --noheadings --output RES "${squashfs}"
+    [ $((lines[-1] * 10)) -ge $((total * 9)) ]
+}
@@ -0,0 +1,44 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires staging_path to be configured, e.g. a local directory standing in for a shared filesystem
+# on a test cluster where all the nodes run on the same host.
+
+function setup() {
+    if [ "${SLURM_JOB_NUM_NODES:-1}" -lt 2 ]; then
+        skip "requires an allocation with at least 2 nodes"
+    fi
+}
+
+@test "staging: multi-node import" {
+    log "+ srun -N2 --ntasks-per-node=1 --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release"
+    run srun -N2 --ntasks-per-node=1 --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    log "${output}"
+    [ "${status}" -eq 0 ]
+}
+
+@test "staging: image reused by a later step" {
+    run srun -N2 --ntasks-per-node=1 --container-image=ubuntu:24.04 true
+    [ "${status}" -eq 0 ]
+    run srun -N2 --ntasks-per-node=1 --container-image=ubuntu:24.04 grep 'Ubuntu 24.04' /etc/os-release
+    log "${output}"
+    [ "${status}" -eq 0 ]
+}
+
+@test "staging: import claimed again after the claiming step is cancelled" {
+    # A large image, so that the step is cancelled during the import.
+    srun -N2 --ntasks-per-node=1 --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 true &
+    pid=$!
+    sleep 15
+
+    step=$(squeue -h -s -j "${SLURM_JOB_ID}" -o %i | sort -t. -k2 -n | tail -n1)
+    scancel "${step}"
+    wait ${pid} || true
+
+    # The claim of the cancelled step expires after a minute, not after staging_timeout.
+    log "+ timeout 900 srun -N2 --ntasks-per-node=1 --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 true"
+    run timeout 900 srun -N2 --ntasks-per-node=1 --container-image=nvidia/cuda:11.8.0-devel-ubuntu22.04 true
+    log "${output}"
+    [ "${status}" -eq 0 ]
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/env bats
+
+load ./common
+
+# Requires submit_check=1 in the pyxis configuration.
+# Set PYXIS_TEST_REGISTRY (e.g. localhost:5000) to run against a local registry standing in for
+# Docker Hub, with ubuntu:24.04 pushed to it (and ENROOT_ALLOW_HTTP=y for a plain HTTP registry).
+
+function image() {
+    if [ -n "${PYXIS_TEST_REGISTRY:-}" ]; then
+        echo "${PYXIS_TEST_REGISTRY}#$1"
+    else
+        echo "$1"
+    fi
+}
+
+@test "submit check: existing image" {
+    run_srun --container-image=$(image ubuntu:24.04) grep 'Ubuntu 24.04' /etc/os-release
+}
+
+@test "submit check: unknown tag is rejected by srun" {
+    run_srun_unchecked --container-image=$(image ubuntu:pyxis-does-not-exist) true
+    [ "${status}" -ne 0 ]
+    grep -q "not found" <<< "${output}"
+}
+
+@test "submit check: unknown tag is rejected by sbatch" {
+    run sbatch --container-image=$(image ubuntu:pyxis-does-not-exist) --wrap true
+    log "${output}"
+    [ "${status}" -ne 0 ]
+}
+
+@test "submit check: missing squashfs file fails on the compute node" {
+    run_srun_unchecked --container-image=./pyxis-does-not-exist.sqsh true
+    [ "${status}" -ne 0 ]
+    ! grep -q "couldn't check container image" <<< "${output}"
+}
+
+@test "submit check: squashfs file missing on the submit host" {
+    # The path is resolved on the compute node, the submit host only warns.
+    run_srun_unchecked --container-image=/tmp/pyxis-does-not-exist.sqsh true
+    grep -q "couldn't check container image" <<< "${output}"
+}